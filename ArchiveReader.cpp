@@ -0,0 +1,306 @@
+/* ArchiveReader.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "ArchiveReader.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const quint32 kZipEndSignature = 0x06054b50;
+const quint32 kZip64EndSignature = 0x06064b50;
+const quint32 kZip64LocatorSignature = 0x07064b50;
+const quint32 kZipCentralSignature = 0x02014b50;
+const quint32 kZipLocalSignature = 0x04034b50;
+const int kZipEndSize = 22;
+const int kZipMaxComment = 0xffff;
+const int kZip64EndSize = 56;
+const int kZip64LocatorSize = 20;
+const int kZipCentralSize = 46;
+const int kZipLocalSize = 30;
+const quint16 kZip64Extra = 0x0001;
+const quint16 kZipEncrypted = 0x0001;
+const quint16 kZipUtf8 = 0x0800;
+const int kZipUnixHost = 3;
+const quint32 kUnixTypeMask = 0170000;
+const quint32 kUnixSymLink = 0120000;
+const int kZipStored = 0;
+const int kZipDeflated = 8;
+const int kTarBlock = 512;
+// deflated input read for a prefix of an entry, plenty for the sniffed bytes
+const int kPrefixInput = 1 << 16;
+
+inline quint16 u16(const char* data) {
+    return qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(data));
+}
+
+inline quint32 u32(const char* data) {
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(data));
+}
+
+inline quint64 u64(const char* data) {
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(data));
+}
+
+// Octal text, or base-256 big endian when the top bit of the first byte is set.
+qint64 tarNumber(const char* field, int length) {
+    if (uchar(field[0]) & 0x80) {
+        qint64 value = field[0] & 0x7f;
+        for (int n = 1; n < length; ++n)
+            value = (value << 8) | uchar(field[n]);
+        return value;
+    }
+
+    qint64 value = 0;
+    for (int n = 0; n < length && field[n]; ++n) {
+        if (field[n] >= '0' && field[n] <= '7')
+            value = value * 8 + (field[n] - '0');
+        else if (field[n] != ' ')
+            break;
+    }
+    return value;
+}
+
+inline QString tarString(const char* field, int length) {
+    return QString::fromUtf8(field, int(qstrnlen(field, uint(length))));
+}
+
+// "./sprites//a.png" and "sprites/a.png" name the same frame
+inline QString entryName(const QString& name) {
+    return QDir::cleanPath(name);
+}
+
+}
+
+ArchiveReader::ArchiveReader(const QString& path)
+: _file(path)
+, _zip(QFileInfo(path).suffix().compare("zip", Qt::CaseInsensitive) == 0) {
+}
+
+auto ArchiveReader::isArchive(const QString& path)->bool {
+    const QFileInfo info(path);
+    const QString suffix = info.suffix().toLower();
+    return info.isFile() && (suffix == "zip" || suffix == "tar");
+}
+
+auto ArchiveReader::open()->bool {
+    _entries.clear();
+    if (!_file.open(QIODevice::ReadOnly))
+        return false;
+    return _zip ? _openZip() : _openTar();
+}
+
+auto ArchiveReader::read(const Entry& entry, qint64 maxSize)->QByteArray {
+    const qint64 size = maxSize < 0 ? entry.size : std::min(maxSize, entry.size);
+    qint64 dataOffset = entry.offset;
+    if (_zip) {
+        // the local header can carry a different extra field than the central one
+        if (!_file.seek(entry.offset))
+            return QByteArray();
+        const QByteArray local = _file.read(kZipLocalSize);
+        if (local.size() < kZipLocalSize || u32(local.constData()) != kZipLocalSignature)
+            return QByteArray();
+        dataOffset += kZipLocalSize + u16(local.constData() + 26) + u16(local.constData() + 28);
+    }
+
+    if (!_file.seek(dataOffset))
+        return QByteArray();
+    if (!_zip || entry.method == kZipStored)
+        return _file.read(size);
+
+    const qint64 packedSize = maxSize < 0 ? entry.packedSize : std::min<qint64>(entry.packedSize, kPrefixInput);
+    return _inflate(_file.read(packedSize), size);
+}
+
+auto ArchiveReader::_openZip()->bool {
+    const qint64 fileSize = _file.size();
+    const qint64 tailOffset = std::max<qint64>(0, fileSize - kZipEndSize - kZipMaxComment);
+    if (!_file.seek(tailOffset))
+        return false;
+    const QByteArray tail = _file.read(fileSize - tailOffset);
+
+    // the end of central directory record sits before a comment of unknown length
+    int end = -1;
+    for (int n = tail.size() - kZipEndSize; n >= 0 && end < 0; --n) {
+        if (u32(tail.constData() + n) == kZipEndSignature)
+            end = n;
+    }
+    if (end < 0)
+        return false;
+
+    const char* record = tail.constData() + end;
+    quint64 count = u16(record + 10);
+    quint64 directorySize = u32(record + 12);
+    quint64 directoryOffset = u32(record + 16);
+
+    if (count == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+        const qint64 locatorOffset = tailOffset + end - kZip64LocatorSize;
+        if (locatorOffset < 0 || !_file.seek(locatorOffset))
+            return false;
+        const QByteArray locator = _file.read(kZip64LocatorSize);
+        if (locator.size() < kZip64LocatorSize || u32(locator.constData()) != kZip64LocatorSignature)
+            return false;
+        if (!_file.seek(qint64(u64(locator.constData() + 8))))
+            return false;
+        const QByteArray end64 = _file.read(kZip64EndSize);
+        if (end64.size() < kZip64EndSize || u32(end64.constData()) != kZip64EndSignature)
+            return false;
+        count = u64(end64.constData() + 32);
+        directorySize = u64(end64.constData() + 40);
+        directoryOffset = u64(end64.constData() + 48);
+    }
+
+    if (!_file.seek(qint64(directoryOffset)))
+        return false;
+    const QByteArray directory = _file.read(qint64(directorySize));
+    if (quint64(directory.size()) != directorySize)
+        return false;
+
+    int position = 0;
+    for (quint64 n = 0; n < count; ++n) {
+        const char* header = directory.constData() + position;
+        if (position + kZipCentralSize > directory.size() || u32(header) != kZipCentralSignature)
+            return false;
+
+        const int host = u16(header + 4) >> 8;
+        const quint16 flags = u16(header + 8);
+        const int nameLength = u16(header + 28);
+        const int extraLength = u16(header + 30);
+        const int commentLength = u16(header + 32);
+        const quint32 mode = u32(header + 38) >> 16;
+        if (position + kZipCentralSize + nameLength + extraLength > directory.size())
+            return false;
+
+        const QByteArray name(header + kZipCentralSize, nameLength);
+        Entry entry;
+        entry.name = flags & kZipUtf8 ? QString::fromUtf8(name) : QString::fromLatin1(name);
+        entry.method = u16(header + 10);
+        entry.packedSize = u32(header + 20);
+        entry.size = u32(header + 24);
+        entry.offset = u32(header + 42);
+
+        // zip64 values follow in this order, each only when its 32-bit field is saturated
+        const char* extra = header + kZipCentralSize + nameLength;
+        for (int e = 0; e + 4 <= extraLength; e += 4 + u16(extra + e + 2)) {
+            if (u16(extra + e) != kZip64Extra)
+                continue;
+            const char* field = extra + e + 4;
+            const char* fieldEnd = field + std::min<int>(u16(extra + e + 2), extraLength - e - 4);
+            if (entry.size == 0xffffffff && field + 8 <= fieldEnd) {
+                entry.size = qint64(u64(field));
+                field += 8;
+            }
+            if (entry.packedSize == 0xffffffff && field + 8 <= fieldEnd) {
+                entry.packedSize = qint64(u64(field));
+                field += 8;
+            }
+            if (entry.offset == 0xffffffff && field + 8 <= fieldEnd)
+                entry.offset = qint64(u64(field));
+        }
+        position += kZipCentralSize + nameLength + extraLength + commentLength;
+
+        const bool symLink = host == kZipUnixHost && (mode & kUnixTypeMask) == kUnixSymLink;
+        if (entry.name.endsWith('/') || symLink || (flags & kZipEncrypted) ||
+            (entry.method != kZipStored && entry.method != kZipDeflated))
+            continue;
+
+        entry.name = entryName(entry.name);
+        _entries.push_back(entry);
+    }
+    return true;
+}
+
+auto ArchiveReader::_openTar()->bool {
+    QString longName;
+    while (true) {
+        const qint64 headerOffset = _file.pos();
+        const QByteArray header = _file.read(kTarBlock);
+        if (header.size() < kTarBlock)
+            return header.isEmpty();
+
+        const char* block = header.constData();
+        if (!block[0])
+            return true;
+
+        const qint64 size = tarNumber(block + 124, 12);
+        const char type = block[156];
+        const qint64 dataOffset = headerOffset + kTarBlock;
+
+        if (type == 'L') {
+            // GNU long name of the next member
+            longName = QString::fromUtf8(_file.read(size).constData());
+        } else if (type == 'x') {
+            // pax records: "<length> <key>=<value>\n"
+            const QByteArray records = _file.read(size);
+            for (int position = 0; position < records.size();) {
+                const int space = records.indexOf(' ', position);
+                const int length = space < 0 ? 0 : records.mid(position, space - position).toInt();
+                if (length <= 0)
+                    break;
+                const QByteArray record = records.mid(space + 1, position + length - space - 2);
+                if (record.startsWith("path="))
+                    longName = QString::fromUtf8(record.mid(5));
+                position += length;
+            }
+        } else if (type != 'g') {
+            if (type == '0' || type == '7' || !type) {
+                QString name = tarString(block, 100);
+                if (!std::memcmp(block + 257, "ustar", 5) && block[345])
+                    name = tarString(block + 345, 155) + '/' + name;
+
+                Entry entry;
+                entry.name = entryName(longName.isEmpty() ? name : longName);
+                entry.offset = dataOffset;
+                entry.packedSize = size;
+                entry.size = size;
+                entry.method = 0;
+                _entries.push_back(entry);
+            }
+            longName.clear();
+        }
+
+        if (!_file.seek(dataOffset + (size + kTarBlock - 1) / kTarBlock * kTarBlock))
+            return false;
+    }
+}
+
+auto ArchiveReader::_inflate(const QByteArray& packed, qint64 size)->QByteArray {
+    QByteArray result(int(size), Qt::Uninitialized);
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return QByteArray();
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(packed.constData()));
+    stream.avail_in = uInt(packed.size());
+    stream.next_out = reinterpret_cast<Bytef*>(result.data());
+    stream.avail_out = uInt(result.size());
+    // a prefix stops with the output full, before the end of the stream
+    const int status = inflate(&stream, Z_FINISH);
+    const qint64 produced = qint64(stream.total_out);
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END && status != Z_BUF_ERROR && status != Z_OK)
+        return QByteArray();
+    result.resize(int(produced));
+    return result;
+}
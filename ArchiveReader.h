@@ -0,0 +1,61 @@
+/* ArchiveReader.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#ifndef ARCHIVEREADER_H
+#define ARCHIVEREADER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <vector>
+
+// Lists and reads the files of a zip or tar archive in place, without
+// extracting it. Zip members may be stored or deflated (zip64 included); tar
+// archives are read uncompressed, with GNU long names and pax paths.
+// Directories, links and encrypted members are left out.
+class ArchiveReader {
+public:
+    struct Entry {
+        QString name;       // path inside the archive, '/' separated
+        qint64  offset;     // zip: local header, tar: data
+        qint64  packedSize;
+        qint64  size;
+        int     method;     // zip compression method, 0 for tar
+    };
+
+    ArchiveReader(const QString& path);
+
+    // True for an existing file named .zip or .tar.
+    static auto isArchive(const QString& path)->bool;
+
+    auto open()->bool;
+    auto entries() const->const std::vector<Entry>& { return _entries; }
+
+    // The uncompressed bytes of the entry, only the first maxSize of them if it is not negative.
+    auto read(const Entry& entry, qint64 maxSize = -1)->QByteArray;
+
+protected:
+    auto _openZip()->bool;
+    auto _openTar()->bool;
+    auto _inflate(const QByteArray& packed, qint64 size)->QByteArray;
+
+    QFile               _file;
+    bool                _zip;
+    std::vector<Entry>  _entries;
+};
+
+#endif // ARCHIVEREADER_H
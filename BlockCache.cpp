@@ -0,0 +1,93 @@
+/* BlockCache.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "BlockCache.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+const quint32 kBlockCacheMagic = 0x53474243; // "SGBC"
+const quint32 kBlockCacheVersion = 2;
+
+BlockCache::BlockCache(const QString& path)
+: _path(path) {
+}
+
+auto BlockCache::load()->bool {
+    QFile file(_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != kBlockCacheMagic || version != kBlockCacheVersion)
+        return false;
+
+    _loaded.reserve(count);
+    for (quint32 n = 0; n < count && in.status() == QDataStream::Ok; ++n) {
+        Entry entry;
+        in >> entry.key;
+        in.readRawData(reinterpret_cast<char*>(entry.pixels.data()), int(entry.pixels.size()));
+        in.readRawData(reinterpret_cast<char*>(entry.block.data()), int(entry.block.size()));
+        _loaded[entry.key] = entry;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+auto BlockCache::save() const->bool {
+    QMutexLocker lock(&_mutex);
+    if (_used.empty())
+        return true;
+
+    QSaveFile file(_path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out << kBlockCacheMagic << kBlockCacheVersion << quint32(_used.size());
+    for (const auto& entry : _used) {
+        out << entry.first;
+        out.writeRawData(reinterpret_cast<const char*>(entry.second.pixels.data()), int(entry.second.pixels.size()));
+        out.writeRawData(reinterpret_cast<const char*>(entry.second.block.data()), int(entry.second.block.size()));
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+auto BlockCache::find(quint64 key, const Pixels& pixels, Block& block) const->bool {
+    const auto it = _loaded.find(key);
+    if (it == _loaded.end() || it->second.pixels != pixels)
+        return false;
+    block = it->second.block;
+    return true;
+}
+
+auto BlockCache::insert(const std::vector<Entry>& entries)->void {
+    QMutexLocker lock(&_mutex);
+    for (const auto& entry : entries)
+        _used[entry.key] = entry;
+}
+
+auto BlockCache::key(const uchar* rgba, int format)->quint64 {
+    quint64 hash = 0x9e3779b97f4a7c15ull ^ quint64(format);
+    for (int n = 0; n < 64; n += 4) {
+        const quint64 word = quint64(rgba[n]) | quint64(rgba[n + 1]) << 8 | quint64(rgba[n + 2]) << 16 | quint64(rgba[n + 3]) << 24;
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
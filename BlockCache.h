@@ -0,0 +1,62 @@
+/* BlockCache.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <QMutex>
+#include <QString>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+// Compressed 4x4 blocks of the previous build keyed by a hash of their pixels
+// and format. The pixels are kept with every block and compared on lookup, so
+// a hash collision is a miss rather than a wrong block. Block aligned layouts
+// keep every block inside one sprite, so the blocks of unchanged sprites are
+// found again wherever the sprites move. Only the blocks looked up or added
+// during this build are saved.
+class BlockCache {
+public:
+    typedef std::array<uchar, 16> Block;
+    typedef std::array<uchar, 64> Pixels;
+    struct Entry {
+        quint64 key;
+        Pixels  pixels;
+        Block   block;
+    };
+
+    BlockCache(const QString& path);
+
+    auto load()->bool;
+    auto save() const->bool;
+
+    // Only reads what load() left, so any number of threads may call it.
+    // True when the block cached under key was encoded from these pixels.
+    auto find(quint64 key, const Pixels& pixels, Block& block) const->bool;
+    auto insert(const std::vector<Entry>& entries)->void;
+
+    // 16 straight RGBA pixels, row by row.
+    static auto key(const uchar* rgba, int format)->quint64;
+
+protected:
+    QString                                 _path;
+    std::unordered_map<quint64, Entry>      _loaded;
+    std::unordered_map<quint64, Entry>      _used;
+    mutable QMutex                          _mutex;
+};
+
+#endif // BLOCKCACHE_H
@@ -0,0 +1,199 @@
+/* FileScanner.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "FileScanner.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QtConcurrent>
+
+#include <cstring>
+
+namespace {
+
+struct Magic {
+    int         offset;
+    const char* bytes;
+    int         length;
+    const char* format;
+};
+
+// TGA has no signature, so it is recognised by extension only.
+const Magic kMagics[] = {
+    { 0, "\x89PNG\r\n\x1a\n", 8, "png" },
+    { 0, "\xff\xd8\xff", 3, "jpeg" },
+    { 0, "GIF87a", 6, "gif" },
+    { 0, "GIF89a", 6, "gif" },
+    { 0, "BM", 2, "bmp" },
+    { 8, "WEBP", 4, "webp" },
+    { 0, "II*\0", 4, "tiff" },
+    { 0, "MM\0*", 4, "tiff" },
+    { 0, "\0\0\1\0", 4, "ico" },
+    { 0, "DDS ", 4, "dds" },
+    { 0, "icns", 4, "icns" },
+    { 0, "P1", 2, "pbm" },
+    { 0, "P4", 2, "pbm" },
+    { 0, "P2", 2, "pgm" },
+    { 0, "P5", 2, "pgm" },
+    { 0, "P3", 2, "ppm" },
+    { 0, "P6", 2, "ppm" }
+};
+
+inline const QList<QByteArray>& supportedFormats() {
+    static const QList<QByteArray> formats = QImageReader::supportedImageFormats();
+    return formats;
+}
+
+}
+
+FileScanner::FileScanner(const QString& rootPath)
+: _rootPath(QDir::cleanPath(rootPath)) {
+}
+
+auto FileScanner::setIncludePatterns(const QStringList& patterns)->void {
+    _include = _compile(patterns);
+}
+
+auto FileScanner::setExcludePatterns(const QStringList& patterns)->void {
+    _exclude = _compile(patterns);
+}
+
+auto FileScanner::scan(int& skipped) const->std::shared_ptr<std::set<QString>> {
+    auto result = std::make_shared<std::set<QString>>();
+    skipped = 0;
+
+    std::vector<QString> level = { _rootPath };
+    while (!level.empty()) {
+        std::vector<QFuture<_Listing>> listings;
+        for (const auto& directory : level) {
+            listings.push_back(QtConcurrent::run([this, directory]() {
+                return _list(directory);
+            }));
+        }
+
+        level.clear();
+        for (auto& future : listings) {
+            const auto listing = future.result();
+            result->insert(listing.files.begin(), listing.files.end());
+            level.insert(level.end(), listing.directories.begin(), listing.directories.end());
+            skipped += listing.skipped;
+        }
+    }
+    return result;
+}
+
+auto FileScanner::sniffFormat(const QString& path)->QByteArray {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    return sniffFormat(file.read(kSniffSize), path);
+}
+
+auto FileScanner::isSupportedImage(const QString& path)->bool {
+    const auto format = sniffFormat(path);
+    return !format.isEmpty() && supportedFormats().contains(format);
+}
+
+auto FileScanner::sniffFormat(const QByteArray& head, const QString& fileName)->QByteArray {
+    for (const auto& magic : kMagics) {
+        if (head.size() >= magic.offset + magic.length && !std::memcmp(head.constData() + magic.offset, magic.bytes, magic.length))
+            return magic.format;
+    }
+    if (QFileInfo(fileName).suffix().compare("tga", Qt::CaseInsensitive) == 0)
+        return "tga";
+    return QByteArray();
+}
+
+auto FileScanner::isSupportedImage(const QByteArray& head, const QString& fileName)->bool {
+    const auto format = sniffFormat(head, fileName);
+    return !format.isEmpty() && supportedFormats().contains(format);
+}
+
+auto FileScanner::accepts(const QString& relativePath) const->bool {
+    for (int slash = relativePath.indexOf('/'); slash >= 0; slash = relativePath.indexOf('/', slash + 1)) {
+        if (_matches(_exclude, relativePath.left(slash + 1)))
+            return false;
+    }
+    return (_include.empty() || _matches(_include, relativePath)) && !_matches(_exclude, relativePath);
+}
+
+auto FileScanner::_list(const QString& directory) const->_Listing {
+    _Listing listing;
+    const auto entries = QDir(directory).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    for (const auto& entry : entries) {
+        const QString path = entry.filePath();
+        const QString relativePath = _relativePath(path);
+        if (entry.isDir()) {
+            if (!entry.isSymLink() && !_matches(_exclude, relativePath + '/'))
+                listing.directories.push_back(path);
+            continue;
+        }
+
+        if ((!_include.empty() && !_matches(_include, relativePath)) || _matches(_exclude, relativePath))
+            continue;
+
+        if (isSupportedImage(path))
+            listing.files.push_back(path);
+        else
+            ++listing.skipped;
+    }
+    return listing;
+}
+
+auto FileScanner::_relativePath(const QString& path) const->QString {
+    return path.startsWith(_rootPath + '/') ? path.mid(_rootPath.length() + 1) : path;
+}
+
+auto FileScanner::_matches(const std::vector<QRegularExpression>& patterns, const QString& relativePath)->bool {
+    const QString fileName = relativePath.section('/', -1, -1, QString::SectionSkipEmpty);
+    for (const auto& pattern : patterns) {
+        const bool wholePath = pattern.pattern().contains('/');
+        if (pattern.match(wholePath ? relativePath : fileName).hasMatch())
+            return true;
+    }
+    return false;
+}
+
+// Translates shell globs (*, ?, [...]) into anchored regular expressions.
+auto FileScanner::_compile(const QStringList& patterns)->std::vector<QRegularExpression> {
+    std::vector<QRegularExpression> result;
+    for (const auto& glob : patterns) {
+        QString expression;
+        bool inClass = false;
+        for (const auto c : glob) {
+            if (inClass) {
+                expression += c == '\\' ? QString("\\\\") : QString(c);
+                inClass = c != ']';
+            } else if (c == '*') {
+                expression += ".*";
+            } else if (c == '?') {
+                expression += '.';
+            } else if (c == '[') {
+                expression += '[';
+                inClass = true;
+            } else {
+                expression += QRegularExpression::escape(QString(c));
+            }
+        }
+        QRegularExpression regularExpression("\\A" + expression + "\\z");
+        regularExpression.optimize();
+        result.push_back(regularExpression);
+    }
+    return result;
+}
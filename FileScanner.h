@@ -0,0 +1,75 @@
+/* FileScanner.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <QRegularExpression>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <set>
+#include <vector>
+
+// Collects the image files under a directory. Every level of the tree is listed
+// with one task per directory, and each file is kept only when its first bytes
+// identify an image format this Qt build can decode.
+//
+// Patterns are shell globs. A pattern without '/' is matched against the file
+// name, one with '/' against the path relative to the root ('*' also crosses
+// '/'). An exclude pattern matching "dir/" skips that whole directory.
+class FileScanner {
+public:
+    FileScanner(const QString& rootPath);
+
+    auto setIncludePatterns(const QStringList& patterns)->void;
+    auto setExcludePatterns(const QStringList& patterns)->void;
+
+    // skipped receives the number of files dropped for not being a supported image.
+    auto scan(int& skipped) const->std::shared_ptr<std::set<QString>>;
+
+    // Whether the patterns keep a file found elsewhere (an archive member), also
+    // checking each of its directories against the exclude patterns.
+    auto accepts(const QString& relativePath) const->bool;
+
+    // Format name (as used by QImageReader) identified by the magic bytes of the file.
+    static auto sniffFormat(const QString& path)->QByteArray;
+    static auto isSupportedImage(const QString& path)->bool;
+    // The same from the first kSniffSize bytes of a file and its name.
+    static auto sniffFormat(const QByteArray& head, const QString& fileName)->QByteArray;
+    static auto isSupportedImage(const QByteArray& head, const QString& fileName)->bool;
+
+    static const int kSniffSize = 16;
+
+protected:
+    struct _Listing {
+        _Listing() : skipped(0) {}
+        std::vector<QString> directories;
+        std::vector<QString> files;
+        int                  skipped;
+    };
+
+    auto _list(const QString& directory) const->_Listing;
+    auto _relativePath(const QString& path) const->QString;
+    static auto _matches(const std::vector<QRegularExpression>& patterns, const QString& relativePath)->bool;
+    static auto _compile(const QStringList& patterns)->std::vector<QRegularExpression>;
+
+    QString                         _rootPath;
+    std::vector<QRegularExpression> _include;
+    std::vector<QRegularExpression> _exclude;
+};
+
+#endif // FILESCANNER_H
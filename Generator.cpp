@@ -15,52 +15,460 @@ program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
 Suite 330, Boston, MA 02111-1307 USA */
 
 #include "Generator.h"
+#include "FileScanner.h"
+#include "ArchiveReader.h"
+#include "TrimCache.h"
+#include "SpriteCache.h"
 #include "imageTools/ImageTrim.h"
 #include "binPack/MaxRectsBinPack.h"
 #include "imageTools/imagerotate.h"
+#include "imageTools/ImageConvert.h"
+#include "imageTools/ImageScale.h"
+#include "imageTools/PngStripWriter.h"
+#include "imageTools/ColorQuantizer.h"
+#include "imageTools/CompressedTextureWriter.h"
+#include "BlockCache.h"
+#include "imageTools/PolygonTrim.h"
 #include "plist/plistserializer.h"
 #include "ImageSorter.h"
+#include "PackOptimizer.h"
+#include "LayoutCompactor.h"
+#include "OutputFile.h"
+#include "ScenePartitioner.h"
+#include "Trace.h"
 
-#include <QDirIterator>
 #include <QPainter>
 #include <QImageWriter>
 #include <QImageReader>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QSaveFile>
 #include <QVariantMap>
 #include <QTextStream>
-#include <QTemporaryFile>
+#include <QtConcurrent>
+#include <QTransform>
+#include <QThread>
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <map>
+#include <numeric>
 
 const float kSidePercent = 1.5f;
 const float kStepSidePercent = 0.1f;
 const int kBasePercent = 6;
 const int kStepPercent = 2;
 const int kAreaMarginMagic = 2;
+const int kAliasTransforms = 8;
+const int kAliasMirror = 4;
+const int kAliasQuarterTurns = 3;
+// bump whenever the same sources and options start producing different outputs
+const int kFingerprintVersion = 2;
+const int kMaxOptimizeTargets = 64;
+const float kOptimizeStep = 0.02f;
+const int kBlockSize = 4;
+// how far a --scales ratio may be off a whole number, for factors like 0.333
+const float kScaleRatioTolerance = 0.01f;
+// share of the max size area a page is first filled to, lowered while a page doesn't fit
+const float kPageFill = 0.9f;
+const float kPageFillStep = 0.05f;
+const int kPageFillSteps = 8;   // down to 0.5
 
 Generator::Generator(const QString& inputImageDirPath)
     : _inputImageDirPath(inputImageDirPath) {
 }
 
+// Every sheet is named @Nx after its ratio to the smallest factor, so the
+// ratios must be distinct whole numbers.
+auto Generator::setScales(const std::vector<float>& scales)->bool {
+    const float smallest = scales.empty() ? 0.0f : *std::min_element(scales.begin(), scales.end());
+    if (smallest <= 0.0f)
+        return false;
+
+    std::vector<int> ratios;
+    for (auto factor : scales) {
+        const float ratio = factor / smallest;
+        if (std::fabs(ratio - qRound(ratio)) > kScaleRatioTolerance || std::count(ratios.begin(), ratios.end(), qRound(ratio)))
+            return false;
+        ratios.push_back(qRound(ratio));
+    }
+    _scales = scales;
+    return true;
+}
+
 auto Generator::generateTo(const QString& finalImagePath, const QString& plistPath)->bool {
-    auto imageData = _processImages();
-    ImageSorter::FrameSizes frameSizes;
-    std::transform(imageData->begin(), imageData->end(), std::back_inserter(frameSizes), [](const std::pair<QString, _Data>& data) {
-        return std::make_pair(data.first, data.second.cropRect.size());
-    });
+    TRACE_SCOPE("generateTo");
+    CompressedTextureWriter::Container container;
+    if (_compression != BlockEncoder::NONE && !CompressedTextureWriter::containerForPath(finalImagePath, container)) {
+        fprintf(stderr, "%s\n", qPrintable(finalImagePath + " - block compressed textures are written to a .ktx or .pvr sheet"));
+        return false;
+    }
+    const auto sources = _readSources();
 
-    auto area = std::accumulate(imageData->begin(), imageData->end(), 0, [this](int sum, const std::pair<QString, _Data>& data) {
-        return data.second.duplicated
-            ? sum
-            : sum + (
-                (data.second.cropRect.width() + 2 * _padding + _margin / kAreaMarginMagic) *
-                (data.second.cropRect.height() + 2 * _padding + _margin / kAreaMarginMagic));
-    });
+    // images added in memory have nothing cheap to fingerprint, and the pages
+    // written with scenes are only known once the sprites are partitioned
+    const bool fingerprinted = _skipUnchanged && !_dryRun && _images.empty() && _scenes.empty();
+    const QString fingerprintPath = finalImagePath + ".fingerprint";
+    const QStringList outputs = _outputPaths(finalImagePath, plistPath);
+    QByteArray fingerprint;
+    if (fingerprinted) {
+        TRACE_SCOPE("fingerprint");
+        fingerprint = _fingerprint(sources, outputs);
+        if (_isUpToDate(fingerprintPath, fingerprint)) {
+            fprintf(stdout, "%s\n", qPrintable(finalImagePath + " - up to date"));
+            return true;
+        }
+        // a build that fails halfway must not leave the old record behind
+        QFile::remove(fingerprintPath);
+    }
+
+    _sprites = std::make_shared<SpriteCache>(_memoryBudget);
+    if (_compression != BlockEncoder::NONE && !_blockCachePath.isEmpty() && !_dryRun) {
+        _blocks = std::make_shared<BlockCache>(_blockCachePath);
+        _blocks->load();
+    }
+    const auto variants = _processImages(sources, _dryRun);
 
-    ImageSorter sorter(frameSizes);
-    const auto sortedFrames = sorter.sort();
+    bool succeeded = true;
+    if (!_scenes.empty()) {
+        succeeded = _generatePages(variants, finalImagePath, plistPath);
+    } else if (variants.size() == 1) {
+        succeeded = _generateVariant(variants.front(), finalImagePath, plistPath);
+    } else {
+        // every resolution gets its own sheet and data file, packed concurrently
+        std::vector<QFuture<bool>> builds;
+        for (size_t n = 0; n < variants.size(); ++n) {
+            const auto imageData = variants[n];
+            const auto variantImagePath = _variantPath(finalImagePath, n);
+            const auto variantPlistPath = plistPath.isEmpty() ? plistPath : _variantPath(plistPath, n);
+            builds.push_back(QtConcurrent::run([this, imageData, variantImagePath, variantPlistPath]() {
+                return _generateVariant(imageData, variantImagePath, variantPlistPath);
+            }));
+        }
+        for (auto& build : builds)
+            succeeded = build.result() && succeeded;
+    }
 
-    _adjustSortedPaths(*sortedFrames, *imageData);
+    const qint64 kMegabyte = 1 << 20;
+    fprintf(stdout, "peak memory: %lld MB resident, %lld MB of sprites in memory, %lld MB spilled to scratch\n",
+            SpriteCache::processPeakBytes() / kMegabyte, _sprites->peakResidentBytes() / kMegabyte, _sprites->spilledBytes() / kMegabyte);
+    _sprites.reset();
+
+    if (_blocks && succeeded && !_blocks->save())
+        fprintf(stderr, "%s\n", qPrintable("Can't write the block cache " + _blockCachePath));
+    _blocks.reset();
+
+    if (fingerprinted && succeeded && !_saveFingerprint(fingerprintPath, fingerprint, outputs))
+        fprintf(stderr, "%s\n", qPrintable("Can't write the build fingerprint " + fingerprintPath));
+    return succeeded;
+}
+
+auto Generator::addImage(const QString& name, const QImage& image)->void {
+    _images[name] = image;
+}
+
+auto Generator::addImage(const QString& name, const uchar* rgba, int width, int height, int bytesPerLine)->void {
+    // the caller keeps its buffer, the copy detaches from it
+    _images[name] = QImage(rgba, width, height, bytesPerLine > 0 ? bytesPerLine : width * 4, QImage::Format_RGBA8888).copy();
+}
+
+auto Generator::generate(std::vector<Atlas>& atlases)->bool {
+    TRACE_SCOPE("generate");
+    // no budget, so nothing is ever spilled to a scratch file
+    _sprites = std::make_shared<SpriteCache>(0);
+    const auto variants = _processImages(_readSources(), false);
+
+    const auto render = [this](Atlas& atlas, const _Layout& layout) {
+        std::map<size_t, QImage> carried;
+        const QImage canvas = _composite(layout.placements, layout.crop, carried);
+        atlas.image = _outputFormat == QImage::Format_Indexed8 ? _quantize(canvas) : ImageConvert::convert(canvas, _outputFormat);
+        atlas.frames = _atlasFrames(layout.frames);
+        atlas.animations = layout.animations;
+    };
+
+    atlases.clear();
+    bool succeeded = true;
+    if (!_scenes.empty()) {
+        std::vector<std::vector<std::shared_ptr<ImageData>>> pages;
+        std::vector<std::vector<_Layout>> layouts;
+        succeeded = _layoutPages(variants, "atlas", pages, layouts);
+        for (size_t n = 0; n < layouts.size() && succeeded; ++n) {
+            for (size_t page = 0; page < layouts[n].size(); ++page) {
+                Atlas atlas;
+                atlas.scale = _scales[n];
+                atlas.page = int(page);
+                render(atlas, layouts[n][page]);
+                atlases.push_back(atlas);
+            }
+        }
+        for (const auto& imageData : variants)
+            _releaseSprites(*imageData);
+    }
+
+    // the next scale is laid out while the previous one composites
+    std::vector<_Layout> layouts(variants.size());
+    const auto layOut = [this, &variants, &layouts](size_t n) {
+        return QtConcurrent::run([this, &variants, &layouts, n]() {
+            return _layoutVariant(*variants[n], QString("atlas %1x").arg(_scales[n]), layouts[n]);
+        });
+    };
+    QFuture<bool> next;
+    if (_scenes.empty() && !variants.empty())
+        next = layOut(0);
+    for (size_t n = 0; n < variants.size() && _scenes.empty(); ++n) {
+        const bool laidOut = next.result();
+        if (n + 1 < variants.size())
+            next = layOut(n + 1);
+
+        Atlas atlas;
+        atlas.scale = _scales[n];
+        if (laidOut)
+            render(atlas, layouts[n]);
+        else
+            succeeded = false;
+        _releaseSprites(*variants[n]);
+        layouts[n] = _Layout();
+        atlases.push_back(atlas);
+    }
+
+    _sprites.reset();
+    return succeeded;
+}
+
+auto Generator::_generateVariant(std::shared_ptr<ImageData> imageData, const QString& finalImagePath, const QString& plistPath) const->bool {
+    Trace::Scope variantScope("variant");
+    variantScope.arg("path", finalImagePath);
+    variantScope.arg("frames", int(imageData->size()));
+
+    _Layout layout;
+    if (!_layoutVariant(*imageData, finalImagePath, layout)) {
+        _releaseSprites(*imageData);
+        return false;
+    }
+    return _writeLayout(layout, *imageData, finalImagePath, plistPath);
+}
+
+auto Generator::_writeLayout(_Layout& layout, const ImageData& imageData, const QString& finalImagePath, const QString& plistPath) const->bool {
+    _formatFrames(layout.frames);
+    if (_dryRun) {
+        _reportLayout(finalImagePath, layout);
+        return true;
+    }
+
+    const bool saved = _saveResults(layout, finalImagePath, plistPath);
+    _releaseSprites(imageData);
+    return saved;
+}
+
+auto Generator::_generatePages(const std::vector<std::shared_ptr<ImageData>>& variants, const QString& finalImagePath, const QString& plistPath) const->bool {
+    std::vector<std::vector<std::shared_ptr<ImageData>>> pages;
+    std::vector<std::vector<_Layout>> layouts;
+    if (!_layoutPages(variants, finalImagePath, pages, layouts)) {
+        for (const auto& imageData : variants)
+            _releaseSprites(*imageData);
+        return false;
+    }
+
+    std::vector<QFuture<bool>> builds;
+    for (size_t n = 0; n < layouts.size(); ++n) {
+        for (size_t page = 0; page < layouts[n].size(); ++page) {
+            auto pageImagePath = _pagePath(finalImagePath, int(page));
+            auto pagePlistPath = plistPath.isEmpty() ? plistPath : _pagePath(plistPath, int(page));
+            if (variants.size() > 1) {
+                pageImagePath = _variantPath(pageImagePath, n);
+                pagePlistPath = pagePlistPath.isEmpty() ? pagePlistPath : _variantPath(pagePlistPath, n);
+            }
+            auto& layout = layouts[n][page];
+            const auto imageData = pages[n][page];
+            builds.push_back(QtConcurrent::run([this, &layout, imageData, pageImagePath, pagePlistPath]() {
+                return _writeLayout(layout, *imageData, pageImagePath, pagePlistPath);
+            }));
+        }
+    }
+
+    bool succeeded = true;
+    for (auto& build : builds)
+        succeeded = build.result() && succeeded;
+    return succeeded;
+}
+
+// Sprites that must share a page (duplicates and their originals, in any
+// variant) form one unit. unitOf receives the unit of every frame name, the
+// result is the number of units.
+auto Generator::_pageUnits(const std::vector<std::shared_ptr<ImageData>>& variants, std::map<QString, int>& unitOf) const->int {
+    std::map<QString, QString> parent;
+    std::function<QString(const QString&)> find = [&](const QString& name) {
+        auto it = parent.find(name);
+        if (it == parent.end())
+            it = parent.insert(std::make_pair(name, name)).first;
+        if (it->second != name)
+            it->second = find(it->second);
+        return it->second;
+    };
+    for (const auto& imageData : variants) {
+        for (const auto& item : *imageData) {
+            const QString root = find(item.first);
+            if (item.second.duplicated)
+                parent[root] = find(item.second.spriteOrDuplicateFrameName);
+        }
+    }
+
+    std::map<QString, int> units;
+    unitOf.clear();
+    for (const auto& item : parent) {
+        const QString root = find(item.first);
+        const auto unit = units.insert(std::make_pair(root, int(units.size()))).first;
+        unitOf[item.first] = unit->second;
+    }
+    return int(units.size());
+}
+
+// The sprites are partitioned once for every variant, on the areas of the
+// largest scale. When a page doesn't fit the max size the partition is made
+// again with less area per page.
+auto Generator::_layoutPages(const std::vector<std::shared_ptr<ImageData>>& variants, const QString& finalImagePath,
+                             std::vector<std::vector<std::shared_ptr<ImageData>>>& pages, std::vector<std::vector<_Layout>>& layouts) const->bool {
+    TRACE_SCOPE("pages");
+    if (_maxSize.isEmpty()) {
+        fprintf(stderr, "%s\n", qPrintable(finalImagePath + " - scenes need a max size to split the sprites into pages"));
+        return false;
+    }
+
+    std::map<QString, int> unitOf;
+    const int unitCount = _pageUnits(variants, unitOf);
+
+    const size_t largest = std::max_element(_scales.begin(), _scales.end()) - _scales.begin();
+    const int alignment = _alignment();
+    const auto alignUp = [alignment](int side) { return (side + alignment - 1) / alignment * alignment; };
+    std::vector<qint64> areas(unitCount, 0);
+    for (const auto& item : *variants[largest]) {
+        if (!item.second.duplicated) {
+            const auto& crop = item.second.cropRect;
+            areas[unitOf[item.first]] += qint64(alignUp(crop.width() + _padding * 2 + _margin)) * alignUp(crop.height() + _padding * 2 + _margin);
+        }
+    }
+
+    std::vector<std::set<int>> sceneSets(unitCount);
+    std::vector<double> weights;
+    for (int scene = 0; scene < int(_scenes.size()); ++scene) {
+        FileScanner matcher(QString());
+        matcher.setIncludePatterns(_scenes[scene].sprites);
+        bool used = false;
+        for (const auto& unit : unitOf) {
+            if (matcher.accepts(unit.first)) {
+                sceneSets[unit.second].insert(scene);
+                used = true;
+            }
+        }
+        if (!used)
+            fprintf(stderr, "%s\n", qPrintable("Scene " + _scenes[scene].name + " uses none of the sprites."));
+        weights.push_back(_scenes[scene].weight);
+    }
+    std::vector<std::vector<int>> unitScenes;
+    for (const auto& scenes : sceneSets)
+        unitScenes.push_back(std::vector<int>(scenes.begin(), scenes.end()));
+
+    const ScenePartitioner partitioner(areas, unitScenes, weights);
+    const qint64 maxArea = qint64(_maxSize.width()) * _maxSize.height();
+    for (int step = 0; step <= kPageFillSteps; ++step) {
+        const float fill = kPageFill - step * kPageFillStep;
+        const auto unitPages = partitioner.partition(qint64(maxArea * fill));
+        const int pageCount = unitPages.empty() ? 0 : *std::max_element(unitPages.begin(), unitPages.end()) + 1;
+
+        pages.assign(variants.size(), std::vector<std::shared_ptr<ImageData>>());
+        layouts.assign(variants.size(), std::vector<_Layout>(pageCount));
+        std::vector<QFuture<bool>> attempts;
+        for (size_t n = 0; n < variants.size(); ++n) {
+            for (int page = 0; page < pageCount; ++page)
+                pages[n].push_back(std::make_shared<ImageData>());
+            for (const auto& item : *variants[n])
+                (*pages[n][unitPages[unitOf[item.first]]])[item.first] = item.second;
+
+            for (int page = 0; page < pageCount; ++page) {
+                const auto imageData = pages[n][page];
+                const auto pageImagePath = _pagePath(finalImagePath, page);
+                auto& layout = layouts[n][page];
+                // the partition may still be rejected, so optimizing waits for the accepted one
+                attempts.push_back(QtConcurrent::run([this, imageData, pageImagePath, &layout]() {
+                    return _layoutVariant(*imageData, pageImagePath, layout, false, false);
+                }));
+            }
+        }
+
+        bool fits = true;
+        for (auto& attempt : attempts)
+            fits = attempt.result() && fits;
+        if (fits) {
+            // one page at a time, each optimizer runs on every core
+            for (size_t n = 0; n < pages.size() && _optimizeSeconds > 0.0; ++n) {
+                for (int page = 0; page < pageCount; ++page) {
+                    _Layout optimized;
+                    if (_layoutVariant(*pages[n][page], _pagePath(finalImagePath, page), optimized, false))
+                        layouts[n][page] = optimized;
+                }
+            }
+            _reportPages(finalImagePath, partitioner.cost(unitPages), unitScenes, unitPages, pageCount);
+            return true;
+        }
+    }
+
+    fprintf(stderr, "%s%dx%d\n", qPrintable(finalImagePath + " - the sprites don't fit pages of the max size: "), _maxSize.width(), _maxSize.height());
+    return false;
+}
+
+auto Generator::_reportPages(const QString& finalImagePath, double cost, const std::vector<std::vector<int>>& unitScenes, const std::vector<int>& unitPages, int pageCount) const->void {
+    std::vector<std::set<int>> scenePages(_scenes.size());
+    for (size_t unit = 0; unit < unitScenes.size(); ++unit) {
+        for (auto scene : unitScenes[unit])
+            scenePages[scene].insert(unitPages[unit]);
+    }
+
+    QString report;
+    QTextStream out(&report);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(2);
+    double weight = 0.0;
+    for (const auto& scene : _scenes)
+        weight += scene.weight;
+    out << finalImagePath << " - " << pageCount << " pages, " << cost / weight << " pages bound per scene on average\n";
+    for (size_t scene = 0; scene < _scenes.size(); ++scene) {
+        QStringList pageNumbers;
+        for (auto page : scenePages[scene])
+            pageNumbers << QString::number(page);
+        out << "\t" << _scenes[scene].name << ": " << pageNumbers.join(", ") << "\n";
+    }
+    out.flush();
+    fprintf(stdout, "%s", qPrintable(report));
+}
+
+auto Generator::_layoutVariant(const ImageData& imageData, const QString& finalImagePath, _Layout& layout, bool reportTooLarge, bool optimize) const->bool {
+    auto table = _makeFrameTable(imageData);
+
+    ImageSorter::FrameSizes frameSizes;
+    int area = 0;
+    for (const auto entry : table.entries) {
+        frameSizes.push_back(std::make_pair(entry->first, entry->second.cropRect.size()));
+        if (!entry->second.duplicated) {
+            area += (entry->second.cropRect.width() + 2 * _padding + _margin / kAreaMarginMagic) *
+                    (entry->second.cropRect.height() + 2 * _padding + _margin / kAreaMarginMagic);
+        }
+    }
+
+    std::vector<int> animations;
+    const QStringList animationNames = _groupAnimations ? _findAnimations(table, animations) : QStringList();
+
+    // duplicates are never packed, they take the rectangle of their original afterwards
+    std::vector<int> packOrder;
+    {
+        TRACE_SCOPE("sort");
+        const ImageSorter sorter(frameSizes);
+        for (auto index : animationNames.isEmpty() ? sorter.sort() : sorter.group(sorter.sort(), animations)) {
+            if (!table.entries[index]->second.duplicated)
+                packOrder.push_back(int(index));
+        }
+    }
 
     int notUsedPercent = kBasePercent;
     int desiredRatioWidth = _maxSize.width() / _maxSize.height();
@@ -70,8 +478,6 @@ auto Generator::generateTo(const QString& finalImagePath, const QString& plistPa
     float sidePercent = kSidePercent;
 
     int left, top, right, bottom;
-    QVariantMap frames;
-    QImage result(_maxSize, _outputFormat);
     QRect finalCrop(QPoint(0, 0), _maxSize);
 
     bool optimal = true;
@@ -79,7 +485,12 @@ auto Generator::generateTo(const QString& finalImagePath, const QString& plistPa
     bool notFinished;
     bool widthCompresingStarted = false;
     const bool nonSquarePowerOf2 = !_square && _isPowerOf2;
+    Trace::Scope searchScope("size search");
+    int attempts = 0;
+    rbp::MaxRectsStats packStats;
     do {
+        Trace::Scope attemptScope("pack attempt");
+        ++attempts;
         enoughSpace = true;
         if ((!nonSquarePowerOf2 || optimal) && !widthCompresingStarted)
             notUsedPercent += kStepPercent;
@@ -104,87 +515,61 @@ auto Generator::generateTo(const QString& finalImagePath, const QString& plistPa
             beforeSize.setHeight(side * desiredRatioHeight);
         }
 
+        attemptScope.arg("width", beforeSize.width());
+        attemptScope.arg("height", beforeSize.height());
         rbp::MaxRectsBinPack bin(beforeSize.width(), beforeSize.height());
-        result.fill(QColor(0, 0, 0 ,0));
-        QPainter painter(&result);
-        frames.clear();
+        bin.SetAlignment(_alignment());
         left = beforeSize.width() - 1;
         top = beforeSize.height() - 1;
         right = 0;
         bottom = 0;
 
-        for (const auto& frame : *sortedFrames) {
-            const auto imageDataIt = imageData->find(frame);
-            if (imageDataIt == imageData->end())
-                continue;
-
-            const auto& beforeTrimSize = imageDataIt->second.beforeCropSize;
-            const auto& cropRect = imageDataIt->second.cropRect;
-            QVariantMap frameInfo;
-
-            if (!imageDataIt->second.duplicated) {
-                QImage image(imageDataIt->second.pathOrDuplicateFrameName);
-
-                bool orientation = cropRect.width() > cropRect.height();
-                const auto packedRect = bin.Insert(cropRect.width() + _padding * 2 + _margin, cropRect.height() + _padding * 2 + _margin, rbp::MaxRectsBinPack::RectBestLongSideFit);
-
-                if (packedRect.height > 0) {
-                    const bool isRotated = packedRect.width > packedRect.height != orientation;
-
-                    frameInfo["rotated"] = isRotated;
-                    frameInfo["frame"] = QRect(packedRect.x + _padding,
-                                            packedRect.y + _padding,
-                                            cropRect.width(),
-                                            cropRect.height());
-
-                    if (isRotated)
-                        image = rotate90(image);
-                    painter.drawImage(packedRect.x + _padding, packedRect.y + _padding, image);
-
-                    if (packedRect.x < left)
-                        left = packedRect.x;
-                    if (packedRect.y < top)
-                        top = packedRect.y;
-                    if (packedRect.x + packedRect.width - 1 > right)
-                        right = packedRect.x + packedRect.width - 1;
-                    if (packedRect.y + packedRect.height - 1 > bottom)
-                        bottom = packedRect.y + packedRect.height - 1;
-                } else {
-                    enoughSpace = false;
-                    break;
-                }
-            } else {
-                const auto otherImageInfo = frames[imageDataIt->second.pathOrDuplicateFrameName].toMap();
-                frameInfo["rotated"] = otherImageInfo["rotated"].toBool();
-                frameInfo["frame"] = otherImageInfo["frame"].toRect();
+        // the area taken so far by each animation, which its next frame goes next to
+        std::vector<rbp::Rect> regions(animationNames.size(), rbp::Rect());
+        for (auto index : packOrder) {
+            const auto& packSize = table.packSizes[index];
+            const bool orientation = packSize.width() > packSize.height();
+            const int animation = animations.empty() ? -1 : animations[index];
+            const bool grouped = animation >= 0 && regions[animation].height > 0;
+            const auto packedRect = grouped
+                ? bin.InsertNear(packSize.width(), packSize.height(), regions[animation])
+                : bin.Insert(packSize.width(), packSize.height(), rbp::MaxRectsBinPack::RectBestLongSideFit);
+            if (packedRect.height <= 0) {
+                enoughSpace = false;
+                break;
             }
-
-            if (beforeTrimSize.width() != cropRect.width() || beforeTrimSize.height() != cropRect.height()) {
-                const int w = std::floor(cropRect.x() + 0.5f * (-beforeTrimSize.width() + cropRect.width()));
-                const int h = std::floor(-cropRect.y() + 0.5f * (beforeTrimSize.height() - cropRect.height()));
-                frameInfo["offset"] = QString("{%1,%2}").arg(QString::number(w), QString::number(h));
-            } else {
-                frameInfo["offset"] = "{0,0}";
+            if (animation >= 0) {
+                auto& region = regions[animation];
+                const QRect united = QRect(region.x, region.y, region.width, region.height)
+                    .united(QRect(packedRect.x, packedRect.y, packedRect.width, packedRect.height));
+                region.x = united.x();
+                region.y = united.y();
+                region.width = united.width();
+                region.height = united.height();
             }
 
-            frameInfo["sourceColorRect"] = QString("{{%1,%2},{%3,%4}}").arg(
-                                QString::number(cropRect.x()),
-                                QString::number(cropRect.y()),
-                                QString::number(cropRect.width()),
-                                QString::number(cropRect.height()));
-
-            frameInfo["sourceSize"] = QString("{%1,%2}").arg(
-                        QString::number(beforeTrimSize.width() + 2 * _padding + _margin),
-                        QString::number(beforeTrimSize.height() + 2 * _padding + _margin));
+            table.rotated[index] = packedRect.width > packedRect.height != orientation;
+            table.frameRects[index] = QRect(packedRect.x + _padding,
+                                            packedRect.y + _padding,
+                                            packSize.width() - _padding * 2 - _margin,
+                                            packSize.height() - _padding * 2 - _margin);
 
-            frames[frame] = frameInfo;
+            if (packedRect.x < left)
+                left = packedRect.x;
+            if (packedRect.y < top)
+                top = packedRect.y;
+            if (packedRect.x + packedRect.width - 1 > right)
+                right = packedRect.x + packedRect.width - 1;
+            if (packedRect.y + packedRect.height - 1 > bottom)
+                bottom = packedRect.y + packedRect.height - 1;
         }
-        painter.end();
 
         right -= _margin;
         bottom -= _margin;
         finalCrop = QRect(QPoint(left, top), QPoint(right, bottom));
         finalCrop.setSize(_fitSize(finalCrop.size(), optimal));
+        attemptScope.arg("fits", enoughSpace);
+        packStats += bin.Stats();
 
         notFinished = !enoughSpace || (nonSquarePowerOf2 && !optimal);
         if (!widthCompresingStarted && !_square && !_isPowerOf2) {
@@ -192,20 +577,271 @@ auto Generator::generateTo(const QString& finalImagePath, const QString& plistPa
             notFinished = true;
         }
     } while (notFinished);
-
-    _removeTempFiles(*imageData);
-
+    searchScope.arg("attempts", attempts);
+    searchScope.end();
+    // compaction and the optimizer would scatter grouped frames again
+    if (animationNames.isEmpty())
+        _compactLayout(table, packOrder, finalCrop);
     if (finalCrop.width() > _maxSize.width() || finalCrop.height() > _maxSize.height()) {
-        fprintf(stderr, "%s%dx%d%s%dx%d\n", qPrintable(finalImagePath + " "), finalCrop.width(), finalCrop.height(), " - too large for available max size: ", _maxSize.width(), _maxSize.height());
+        if (reportTooLarge)
+            fprintf(stderr, "%s%dx%d%s%dx%d\n", qPrintable(finalImagePath + " "), finalCrop.width(), finalCrop.height(), " - too large for available max size: ", _maxSize.width(), _maxSize.height());
         return false;
     }
 
-    _adjustFrames(frames, [&finalCrop](QRect& rect) {
-        rect.setX(rect.x() - finalCrop.x());
-        rect.setY(rect.y() - finalCrop.y());
-    });
+    if (optimize && _optimizeSeconds > 0.0 && !packOrder.empty() && animationNames.isEmpty())
+        _optimizeLayout(table, packOrder, finalCrop);
+
+    layout.crop = finalCrop;
+    layout.placements.clear();
+    for (auto index : packOrder) {
+        const auto& frameRect = table.frameRects[index];
+        _Placement placement;
+        placement.sprite = table.entries[index]->second.spriteOrDuplicateFrameName;
+        placement.rect = QRect(frameRect.topLeft(), table.rotated[index] ? frameRect.size().transposed() : frameRect.size());
+        placement.rotated = table.rotated[index];
+        layout.placements.push_back(placement);
+    }
+
+    // names and QVariants only from here on, once for the final layout
+    layout.frames.clear();
+    for (size_t n = 0; n < table.entries.size(); ++n) {
+        const auto& entry = *table.entries[n];
+        const int packed = entry.second.duplicated ? table.duplicateOf[n] : int(n);
+        if (packed >= 0)
+            layout.frames[entry.first] = _frameInfo(entry.second, table.frameRects[packed].translated(-finalCrop.topLeft()), table.rotated[packed]);
+    }
+    layout.animations = _animationRegions(table, animations, animationNames, finalCrop);
+
+    if (_printStats)
+        _reportStats(finalImagePath, attempts, layout, packStats);
+    return true;
+}
+
+// Slides the sprites of the chosen layout left and up and moves those along the
+// right and bottom edges into the gaps, keeping the result when it crops smaller.
+auto Generator::_compactLayout(_FrameTable& table, const std::vector<int>& packOrder, QRect& finalCrop) const->void {
+    TRACE_SCOPE("compact");
+    const int alignment = _alignment();
+    const auto alignUp = [alignment](int side) { return (side + alignment - 1) / alignment * alignment; };
+    std::vector<rbp::Rect> rects;
+    for (auto index : packOrder) {
+        const auto& frameRect = table.frameRects[index];
+        const auto packSize = table.rotated[index] ? table.packSizes[index].transposed() : table.packSizes[index];
+        const rbp::Rect rect = { frameRect.x() - _padding, frameRect.y() - _padding, alignUp(packSize.width()), alignUp(packSize.height()) };
+        rects.push_back(rect);
+    }
+
+    LayoutCompactor compactor(rects, true);
+    compactor.compact();
+
+    int left = std::numeric_limits<int>::max();
+    int top = std::numeric_limits<int>::max();
+    int right = 0;
+    int bottom = 0;
+    for (size_t n = 0; n < packOrder.size(); ++n) {
+        const auto& rect = compactor.rects()[n];
+        const bool rotated = table.rotated[packOrder[n]] != compactor.flipped()[n];
+        const auto packSize = rotated ? table.packSizes[packOrder[n]].transposed() : table.packSizes[packOrder[n]];
+        left = std::min(left, rect.x);
+        top = std::min(top, rect.y);
+        right = std::max(right, rect.x + packSize.width() - 1);
+        bottom = std::max(bottom, rect.y + packSize.height() - 1);
+    }
+
+    bool optimal;
+    QRect crop(QPoint(left, top), QPoint(right - _margin, bottom - _margin));
+    crop.setSize(_fitSize(crop.size(), optimal));
+    if (packOrder.empty() || qint64(crop.width()) * crop.height() >= qint64(finalCrop.width()) * finalCrop.height())
+        return;
+
+    for (size_t n = 0; n < packOrder.size(); ++n) {
+        const int index = packOrder[n];
+        const auto& rect = compactor.rects()[n];
+        const auto& packSize = table.packSizes[index];
+        table.rotated[index] = table.rotated[index] != compactor.flipped()[n];
+        table.frameRects[index] = QRect(rect.x + _padding, rect.y + _padding,
+                                        packSize.width() - _padding * 2 - _margin,
+                                        packSize.height() - _padding * 2 - _margin);
+    }
+    finalCrop = crop;
+}
+
+// Ever smaller texture sizes obeying --square and --powerOf2, down to the packed
+// area, each with room for the trailing margin that the crop drops again.
+auto Generator::_optimizeTargets(const QSize& size, qint64 minArea) const->std::vector<QSize> {
+    std::vector<QSize> result;
+    QSize target = size;
+    while (int(result.size()) < kMaxOptimizeTargets) {
+        const bool shrinkWidth = _square || target.width() >= target.height();
+        const bool shrinkHeight = _square || !shrinkWidth;
+        const auto shrink = [this](int side) {
+            return _isPowerOf2 ? side / 2 : std::min(side - 1, int(side * (1.0f - kOptimizeStep)));
+        };
+        if (shrinkWidth)
+            target.setWidth(shrink(target.width()));
+        if (shrinkHeight)
+            target.setHeight(shrink(target.height()));
+
+        const QSize bin(target.width() + _margin, target.height() + _margin);
+        if (target.width() <= 0 || target.height() <= 0 || qint64(bin.width()) * bin.height() < minArea)
+            break;
+        result.push_back(bin);
+    }
+    return result;
+}
+
+auto Generator::_optimizeLayout(_FrameTable& table, const std::vector<int>& packOrder, QRect& finalCrop) const->void {
+    Trace::Scope scope("optimize");
+    std::vector<QSize> sizes;
+    std::vector<bool> rotated;
+    qint64 minArea = 0;
+    for (auto index : packOrder) {
+        sizes.push_back(table.packSizes[index]);
+        rotated.push_back(table.rotated[index]);
+        minArea += qint64(table.packSizes[index].width()) * table.packSizes[index].height();
+    }
+    std::vector<int> order(sizes.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    const auto targets = _optimizeTargets(finalCrop.size(), minArea);
+    const auto result = PackOptimizer(sizes, order, rotated, _alignment()).optimize(targets, _optimizeSeconds, QThread::idealThreadCount());
+    scope.arg("targets", int(targets.size()));
+    scope.arg("solved", result.target + 1);
+    if (result.target < 0)
+        return;
+
+    int left = std::numeric_limits<int>::max(), top = std::numeric_limits<int>::max(), right = 0, bottom = 0;
+    for (const auto& rect : result.rects) {
+        left = std::min(left, rect.x);
+        top = std::min(top, rect.y);
+        right = std::max(right, rect.x + rect.width - 1);
+        bottom = std::max(bottom, rect.y + rect.height - 1);
+    }
+    QRect crop(QPoint(left, top), QPoint(right - _margin, bottom - _margin));
+    bool optimal;
+    crop.setSize(_fitSize(crop.size(), optimal));
+    if (qint64(crop.width()) * crop.height() >= qint64(finalCrop.width()) * finalCrop.height())
+        return;
+
+    for (size_t n = 0; n < packOrder.size(); ++n) {
+        const int index = packOrder[n];
+        const auto& rect = result.rects[n];
+        const auto& packSize = table.packSizes[index];
+        table.rotated[index] = rect.width != packSize.width();
+        table.frameRects[index] = QRect(rect.x + _padding,
+                                        rect.y + _padding,
+                                        packSize.width() - _padding * 2 - _margin,
+                                        packSize.height() - _padding * 2 - _margin);
+    }
+    scope.arg("from", QString("%1x%2").arg(finalCrop.width()).arg(finalCrop.height()));
+    scope.arg("to", QString("%1x%2").arg(crop.width()).arg(crop.height()));
+    if (_printStats)
+        fprintf(stdout, "optimized %dx%d to %dx%d\n", finalCrop.width(), finalCrop.height(), crop.width(), crop.height());
+    finalCrop = crop;
+}
+
+auto Generator::_makeFrameTable(const ImageData& imageData) const->_FrameTable {
+    _FrameTable table;
+    std::map<QString, int> indices;
+    for (const auto& item : imageData) {
+        indices[item.first] = int(table.entries.size());
+        table.entries.push_back(&item);
+    }
+
+    for (const auto entry : table.entries) {
+        const auto& data = entry->second;
+        table.packSizes.push_back(QSize(data.cropRect.width() + _padding * 2 + _margin, data.cropRect.height() + _padding * 2 + _margin));
+        const auto original = data.duplicated ? indices.find(data.spriteOrDuplicateFrameName) : indices.end();
+        table.duplicateOf.push_back(original != indices.end() ? original->second : -1);
+    }
+    table.frameRects.resize(table.entries.size());
+    table.rotated.resize(table.entries.size(), false);
+    return table;
+}
+
+// Sets animations[n] to the index in the result of the animation of frame n, or
+// to -1 when no other frame shares its animation.
+auto Generator::_findAnimations(const _FrameTable& table, std::vector<int>& animations)->QStringList {
+    std::vector<QString> names;
+    std::map<QString, int> counts;
+    for (const auto entry : table.entries) {
+        int number;
+        names.push_back(ImageSorter::animationName(entry->first, number));
+        if (!names.back().isEmpty())
+            ++counts[names.back()];
+    }
+
+    QStringList result;
+    std::map<QString, int> indices;
+    animations.assign(names.size(), -1);
+    for (size_t n = 0; n < names.size(); ++n) {
+        if (names[n].isEmpty() || counts[names[n]] < 2)
+            continue;
+        const auto found = indices.find(names[n]);
+        if (found != indices.end()) {
+            animations[n] = found->second;
+        } else {
+            animations[n] = indices[names[n]] = result.size();
+            result << names[n];
+        }
+    }
+    return result;
+}
+
+// The atlas rectangles of the frames of every animation united, relative to the crop.
+auto Generator::_animationRegions(const _FrameTable& table, const std::vector<int>& animations, const QStringList& names, const QRect& crop)->std::vector<Animation> {
+    std::vector<Animation> result(names.size());
+    std::vector<std::vector<std::pair<int, QString>>> frames(names.size());
+    for (size_t n = 0; n < animations.size(); ++n) {
+        if (animations[n] < 0)
+            continue;
+        const auto& entry = *table.entries[n];
+        const int packed = entry.second.duplicated ? table.duplicateOf[n] : int(n);
+        if (packed < 0)
+            continue;
+
+        const auto& frameRect = table.frameRects[packed];
+        const QRect rect(frameRect.topLeft() - crop.topLeft(), table.rotated[packed] ? frameRect.size().transposed() : frameRect.size());
+        auto& animation = result[animations[n]];
+        animation.rect = animation.rect.united(rect);
+        int number;
+        ImageSorter::animationName(entry.first, number);
+        frames[animations[n]].push_back(std::make_pair(number, entry.first));
+    }
+
+    for (int n = 0; n < names.size(); ++n) {
+        result[n].name = names[n];
+        std::sort(frames[n].begin(), frames[n].end());
+        for (const auto& frame : frames[n])
+            result[n].frames << frame.second;
+    }
+    return result;
+}
+
+auto Generator::_frameInfo(const _Data& data, const QRect& frameRect, bool rotated) const->QVariantMap {
+    const auto& beforeTrimSize = data.beforeCropSize;
+    const auto& cropRect = data.cropRect;
+
+    QVariantMap frameInfo;
+    frameInfo["rotated"] = rotated;
+    frameInfo["frame"] = frameRect;
+    if (data.duplicated && data.aliasTransform != 0)
+        _addAliasTransform(frameInfo, data.aliasTransform);
+
+    if (!data.outline.empty() && data.aliasTransform == 0)
+        _addPolygon(frameInfo, data);
+
+    if (beforeTrimSize.width() != cropRect.width() || beforeTrimSize.height() != cropRect.height()) {
+        const int w = std::floor(cropRect.x() + 0.5f * (-beforeTrimSize.width() + cropRect.width()));
+        const int h = std::floor(-cropRect.y() + 0.5f * (beforeTrimSize.height() - cropRect.height()));
+        frameInfo["offset"] = QPoint(w, h);
+    } else {
+        frameInfo["offset"] = QPoint(0, 0);
+    }
 
-    return _saveResults(result.copy(finalCrop), frames, finalImagePath, plistPath);
+    frameInfo["sourceColorRect"] = cropRect;
+    frameInfo["sourceSize"] = QSize(beforeTrimSize.width() + 2 * _padding + _margin, beforeTrimSize.height() + 2 * _padding + _margin);
+    return frameInfo;
 }
 
 auto Generator::_roundToPowerOf2(int value)->int {
@@ -224,99 +860,382 @@ auto Generator::_floorToPowerOf2(int value)->int {
     return power / 2;
 }
 
-auto Generator::_adjustFrames(QVariantMap& frames, const std::function<void(QRect&)>& cb)->void {
+auto Generator::_formatRect(const QRect& rect)->QString {
+    return QString("{{%1,%2},{%3,%4}}").arg(
+                QString::number(rect.x()),
+                QString::number(rect.y()),
+                QString::number(rect.width()),
+                QString::number(rect.height()));
+}
+
+auto Generator::_formatFrames(QVariantMap& frames)->void {
+    const auto formatPoints = [](const QVariantList& points) {
+        QStringList coordinates;
+        for (const auto& point : points)
+            coordinates << QString::number(point.toPoint().x()) << QString::number(point.toPoint().y());
+        return coordinates.join(' ');
+    };
+
     for (auto it = frames.begin(); it != frames.end(); ++it) {
         QVariantMap frame = qvariant_cast<QVariantMap>(*it);
-        QRect outRect = frame["frame"].toRect();
-        cb(outRect);
-        frame["frame"] = QString("{{%1,%2},{%3,%4}}").arg(
-                         QString::number(outRect.x()),
-                         QString::number(outRect.y()),
-                         QString::number(outRect.width()),
-                         QString::number(outRect.height()));
+        const QPoint offset = frame["offset"].toPoint();
+        const QSize sourceSize = frame["sourceSize"].toSize();
+        frame["frame"] = _formatRect(frame["frame"].toRect());
+        frame["offset"] = QString("{%1,%2}").arg(QString::number(offset.x()), QString::number(offset.y()));
+        frame["sourceColorRect"] = _formatRect(frame["sourceColorRect"].toRect());
+        frame["sourceSize"] = QString("{%1,%2}").arg(QString::number(sourceSize.width()), QString::number(sourceSize.height()));
+
+        if (frame.contains("verticesUV")) {
+            QStringList triangles;
+            for (const auto& index : frame["triangles"].toList())
+                triangles << QString::number(index.toInt());
+            frame["vertices"] = formatPoints(frame["vertices"].toList());
+            frame["verticesUV"] = formatPoints(frame["verticesUV"].toList());
+            frame["triangles"] = triangles.join(' ');
+        }
         *it = frame;
     }
 }
 
-auto Generator::_removeTempFiles(const ImageData& paths)->void {
-    for (auto data : paths) {
-        if (!data.second.duplicated) {
-            QFile file(data.second.pathOrDuplicateFrameName);
-            file.remove();
-        }
+// Root "animations" plist key: every animation with its region and frame names.
+auto Generator::_formatAnimations(const std::vector<Animation>& animations)->QVariantMap {
+    QVariantMap result;
+    for (const auto& animation : animations) {
+        QVariantList frames;
+        for (const auto& frame : animation.frames)
+            frames << frame;
+        QVariantMap info;
+        info["rect"] = _formatRect(animation.rect);
+        info["frames"] = frames;
+        result[animation.name] = info;
     }
+    return result;
 }
 
-auto Generator::_checkDuplicate(const QImage& image, const std::map<QString, QString> paths, QString& out)->bool {
-    for (auto item : paths) {
-        QImageReader reader(item.second);
-        if (reader.canRead()) {
-            if (image.size() == reader.size()) {
-                auto size = image.size();
-                auto image2 = reader.read();
-                if (image.pixel(0, 0) == image2.pixel(0, 0) &&
-                    image.pixel(size.width() - 1, size.height() - 1) == image2.pixel(size.width() - 1, size.height() - 1) &&
-                    image.pixel(size.width() / 2, size.height() / 2) == image2.pixel(size.width() / 2, size.height() / 2) &&
-                    image.pixel(size.width() * 3.0f/4.0f, size.height() / 4) == image2.pixel(size.width() * 3.0f/4.0f, size.height() / 4) &&
-                    image.pixel(size.width() / 4, size.height() * 3.0f/4.0f) == image2.pixel(size.width() / 4, size.height() * 3.0f/4.0f))
-                {
-                    if (image == image2) {
-                       out = item.first;
-                       return true;
-                    }
-                }
+auto Generator::_atlasFrames(const QVariantMap& frames)->std::vector<Frame> {
+    std::vector<Frame> result;
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        const QVariantMap info = it.value().toMap();
+        Frame frame;
+        frame.name = it.key();
+        frame.rect = info["frame"].toRect();
+        frame.rotated = info["rotated"].toBool();
+        frame.offset = info["offset"].toPoint();
+        frame.sourceColorRect = info["sourceColorRect"].toRect();
+        frame.sourceSize = info["sourceSize"].toSize();
+        frame.flipX = info["flipX"].toBool();
+        frame.flipY = info["flipY"].toBool();
+        frame.rotation = info["rotation"].toInt();
+        for (const auto& vertex : info["vertices"].toList())
+            frame.vertices.push_back(vertex.toPoint());
+        for (const auto& vertex : info["verticesUV"].toList())
+            frame.verticesUV.push_back(vertex.toPoint());
+        for (const auto& index : info["triangles"].toList())
+            frame.triangles.push_back(index.toInt());
+        result.push_back(frame);
+    }
+    return result;
+}
+
+// cocos2d-x polygon sprite frame keys: vertices in source image space, texture
+// coordinates in atlas pixels relative to the final crop.
+auto Generator::_addPolygon(QVariantMap& frameInfo, const _Data& data) const->void {
+    const QRect frameRect = frameInfo["frame"].toRect();
+    const bool rotated = frameInfo["rotated"].toBool();
+    const auto& cropRect = data.cropRect;
+
+    QVariantList vertices;
+    QVariantList verticesUV;
+    for (const auto& vertex : data.outline) {
+        vertices << QPoint(vertex.x() + cropRect.x() + _padding, vertex.y() + cropRect.y() + _padding);
+        verticesUV << (rotated
+            ? QPoint(frameRect.x() + cropRect.height() - vertex.y(), frameRect.y() + vertex.x())
+            : QPoint(frameRect.x() + vertex.x(), frameRect.y() + vertex.y()));
+    }
+
+    QVariantList triangles;
+    for (auto index : PolygonTrim::triangulate(data.outline))
+        triangles << index;
+
+    frameInfo["vertices"] = vertices;
+    frameInfo["verticesUV"] = verticesUV;
+    frameInfo["triangles"] = triangles;
+}
+
+auto Generator::_reportStats(const QString& finalImagePath, int attempts, const _Layout& layout, const rbp::MaxRectsStats& stats) const->void {
+    // one write, so the reports of concurrently packed variants don't interleave
+    QString report;
+    QTextStream out(&report);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(1);
+    out << finalImagePath << " - " << attempts << " size search iterations, "
+        << layout.crop.width() << "x" << layout.crop.height() << " texture, "
+        << 100.0 * _occupancy(layout.placements, layout.crop) << "% occupancy\n";
+#ifdef RBP_STATS
+    out << "\tinserts: " << stats.inserts << " (" << stats.failedInserts << " failed), "
+        << stats.ScoreEvaluationsPerInsert() << " score evaluations per insert\n";
+    out << "\tfree list: peak " << stats.freeListPeak << ", average " << stats.AverageFreeListSize() << "\n";
+    out.setRealNumberPrecision(4);
+    out << "\tscore: " << stats.scoreEvaluations << " evaluations, " << stats.scoreSeconds << " s\n";
+    out << "\tsplit: " << stats.splitCalls << " calls, " << stats.splitProduced << " rectangles produced, " << stats.splitSeconds << " s\n";
+    out << "\tprune: " << stats.pruneComparisons << " comparisons, " << stats.pruneRemovals << " removals, " << stats.pruneSeconds << " s\n";
+#else
+    Q_UNUSED(stats);
+    out << "\tpacker counters need a build with CONFIG+=packstats\n";
+#endif
+    out.flush();
+    fprintf(stdout, "%s", qPrintable(report));
+}
+
+auto Generator::_reportLayout(const QString& finalImagePath, const _Layout& layout) const->void {
+    QString report;
+    QTextStream out(&report);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(1);
+    out << finalImagePath << " - dry run: " << layout.crop.width() << "x" << layout.crop.height() << " texture, "
+        << 100.0 * _occupancy(layout.placements, layout.crop) << "% occupancy, "
+        << layout.frames.size() << " frames in " << layout.placements.size() << " packed rectangles\n";
+    for (auto it = layout.frames.begin(); it != layout.frames.end(); ++it) {
+        const auto frame = it.value().toMap();
+        out << "\t" << it.key() << " " << frame["frame"].toString() << (frame["rotated"].toBool() ? " rotated" : "") << "\n";
+    }
+    out.flush();
+    fprintf(stdout, "%s", qPrintable(report));
+}
+
+auto Generator::_occupancy(const std::vector<_Placement>& placements, const QRect& crop)->double {
+    qint64 used = 0;
+    for (const auto& placement : placements)
+        used += qint64(placement.rect.width()) * placement.rect.height();
+    return crop.isEmpty() ? 0.0 : double(used) / (qint64(crop.width()) * crop.height());
+}
+
+auto Generator::_releaseSprites(const ImageData& imageData) const->void {
+    TRACE_SCOPE("release sprites");
+    for (const auto& data : imageData) {
+        if (!data.second.duplicated && !data.second.spriteOrDuplicateFrameName.isEmpty())
+            _sprites->remove(data.second.spriteOrDuplicateFrameName);
+    }
+}
+
+auto Generator::_orient(const QImage& image, int transform)->QImage {
+    QImage result = transform & kAliasMirror ? image.mirrored(true, false) : image;
+    if (transform & kAliasQuarterTurns)
+        result = result.transformed(QTransform().rotate(90 * (transform & kAliasQuarterTurns)));
+    return result;
+}
+
+auto Generator::_imageHash(const QImage& image)->quint64 {
+    // FNV-1a over the size and the ARGB32 pixel values
+    quint64 hash = 14695981039346656037ULL;
+    const auto mix = [&hash](quint64 value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+    mix(image.width());
+    mix(image.height());
+    for (int y = 0; y < image.height(); ++y) {
+        const auto line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); ++x)
+            mix(line[x]);
+    }
+    return hash;
+}
+
+auto Generator::_contentHash(const QImage& image, bool transforms)->quint64 {
+    const QImage argb = image.convertToFormat(QImage::Format_ARGB32);
+    if (!transforms)
+        return _imageHash(argb);
+
+    // the smallest hash over all eight orientations is the same for every copy
+    quint64 result = _imageHash(argb);
+    for (int transform = 1; transform < kAliasTransforms; ++transform)
+        result = std::min(result, _imageHash(_orient(argb, transform)));
+    return result;
+}
+
+auto Generator::_checkDuplicate(const QImage& image, quint64 hash, const HashedFrames& frames, const SpriteLoader& load, bool transforms, QString& out, int& transform)->bool {
+    const QImage argb = image.convertToFormat(QImage::Format_ARGB32);
+    const auto candidates = frames.equal_range(hash);
+    for (auto it = candidates.first; it != candidates.second; ++it) {
+        const QImage other = load(it->second.second).convertToFormat(QImage::Format_ARGB32);
+        for (int t = 0; t < (transforms ? kAliasTransforms : 1); ++t) {
+            const QSize orientedSize = t & 1 ? other.size().transposed() : other.size();
+            if (orientedSize == argb.size() && _orient(other, t) == argb) {
+                out = it->second.first;
+                transform = t;
+                return true;
             }
         }
     }
     return false;
 }
 
-auto Generator::_adjustSortedPaths(std::vector<QString>& paths, ImageData& imageData)->void {
-    for (auto frameNameIt = paths.begin(); frameNameIt != paths.end();) {
-        const auto idIt = imageData.find(*frameNameIt);
-        if (idIt == imageData.end() || !idIt->second.duplicated || idIt->second.adjusted) {
-            ++frameNameIt;
+// Metadata for an alias drawn from its canonical frame: mirror horizontally first,
+// then rotate clockwise. A mirror plus a half turn is written as a vertical flip.
+auto Generator::_addAliasTransform(QVariantMap& frameInfo, int transform)->void {
+    const bool mirrored = transform & kAliasMirror;
+    const int quarterTurns = transform & kAliasQuarterTurns;
+    const bool flipY = mirrored && quarterTurns == 2;
+    frameInfo["flipX"] = mirrored && !flipY;
+    frameInfo["flipY"] = flipY;
+    frameInfo["rotation"] = flipY ? 0 : 90 * quarterTurns;
+}
+
+auto Generator::_composite(const std::vector<_Placement>& placements, const QRect& area, std::map<size_t, QImage>& carried) const->QImage {
+    Trace::Scope scope("composite");
+    scope.arg("rows", area.height());
+    QImage canvas(area.size(), ImageConvert::kCanvasFormat);
+    canvas.fill(Qt::transparent);
+
+    // sprites crossing the bottom edge of a strip are kept decoded for the next one
+    std::map<size_t, QImage> carry;
+    QPainter painter(&canvas);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (size_t n = 0; n < placements.size(); ++n) {
+        const auto& placement = placements[n];
+        if (!placement.rect.intersects(area))
             continue;
-        }
 
-        auto notDuplicateIt = std::find(paths.begin(), paths.end(), idIt->second.pathOrDuplicateFrameName);
-        if (notDuplicateIt == paths.end())
-            throw std::exception();
+        QImage image;
+        const auto carriedIt = carried.find(n);
+        if (carriedIt != carried.end()) {
+            image = carriedIt->second;
+        } else {
+            image = _sprites->image(placement.sprite);
+            if (placement.rotated)
+                image = rotate90(image);
+        }
+        painter.drawImage(placement.rect.topLeft() - area.topLeft(), image);
 
-        const auto tmp = *frameNameIt;
-        paths.erase(frameNameIt);
-        paths.insert(notDuplicateIt + 1, tmp);
-        idIt->second.adjusted = true;
+        if (placement.rect.bottom() > area.bottom())
+            carry[n] = image;
     }
+    painter.end();
+
+    carried.swap(carry);
+    return canvas;
 }
 
-auto Generator::_saveResults(const QImage& image, const QVariantMap& frames, const QString& finalImagePath, const QString& plistPath) const->bool {
-    QImageWriter writer(finalImagePath);
-    writer.setFormat("png");
+auto Generator::_saveImage(const std::vector<_Placement>& placements, const QRect& crop, const QString& finalImagePath, QImage::Format format) const->bool {
+    if (_compression != BlockEncoder::NONE)
+        return _saveCompressed(placements, crop, finalImagePath);
 
-    if (writer.write(image)) {
-        fprintf(stdout, "%s\n", qPrintable(finalImagePath + " - success"));
+    std::map<size_t, QImage> carried;
+    const int rows = _stripHeight > 0 ? _stripHeight : crop.height();
 
-        QFileInfo info(finalImagePath);
-        QFile plistFile(plistPath.isEmpty() ? info.dir().path() + QDir::separator() + info.baseName() + ".plist" : plistPath);
-        if (plistFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&plistFile);
+    // the palette needs every pixel, so indexed textures are composited twice:
+    // once into the quantizer's histogram and once into the writer
+    ColorQuantizer quantizer;
+    if (format == QImage::Format_Indexed8) {
+        TRACE_SCOPE("quantize");
+        for (int y = 0; y < crop.height(); y += rows) {
+            const QRect strip(crop.x(), crop.y() + y, crop.width(), std::min(rows, crop.height() - y));
+            quantizer.addStrip(_composite(placements, strip, carried));
+        }
+        quantizer.buildPalette();
+        carried.clear();
 
-            QVariantMap meta;
-            meta["format"] = 2;
-            meta["realTextureFileName"] = meta["textureFileName"] = info.baseName() + '.' + (_suffix.isEmpty() ? info.completeSuffix() : _suffix);
-            meta["size"] = QString("{%1,%2}").arg(QString::number(image.size().width()), QString::number(image.size().height()));
+        if (quantizer.error() > _maxQuantizeError) {
+            fprintf(stderr, "%s\n", qPrintable(QString("%1 - palette error %2 is above %3, written as rgba8888")
+                .arg(finalImagePath, QString::number(quantizer.error(), 'f', 2), QString::number(_maxQuantizeError))));
+            return _saveImage(placements, crop, finalImagePath, QImage::Format_RGBA8888);
+        }
+        quantizer.setDither(_dither);
+    } else if (rows >= crop.height()) {
+        const QImage canvas = _composite(placements, crop, carried);
+        TRACE_SCOPE("encode");
+        OutputFile file(finalImagePath, _writeBuffer);
+        if (!file.open())
+            return false;
+        QImageWriter writer(file.device(), "png");
+        return writer.write(ImageConvert::convert(canvas, format)) && file.commit();
+    }
 
-            QVariantMap root;
-            root["frames"] = frames;
-            root["metadata"] = meta;
-            out << PListSerializer::toPList(root);
-            plistFile.close();
+    OutputFile file(finalImagePath, _writeBuffer);
+    if (!file.open())
+        return false;
 
-            return true;
-        }
+    std::unique_ptr<PngStripWriter> writer(format == QImage::Format_Indexed8
+        ? new PngStripWriter(file.device(), crop.size(), &quantizer)
+        : new PngStripWriter(file.device(), crop.size(), format));
+    for (int y = 0; y < crop.height(); y += rows) {
+        const QRect strip(crop.x(), crop.y() + y, crop.width(), std::min(rows, crop.height() - y));
+        const QImage canvas = _composite(placements, strip, carried);
+        TRACE_SCOPE("encode");
+        if (!writer->writeStrip(canvas))
+            return false;
     }
-    return false;
+    TRACE_SCOPE("encode");
+    return writer->finish() && file.commit();
+}
+
+auto Generator::_saveCompressed(const std::vector<_Placement>& placements, const QRect& crop, const QString& finalImagePath) const->bool {
+    std::map<size_t, QImage> carried;
+    const int rows = _stripHeight > 0 ? (_stripHeight + kBlockSize - 1) / kBlockSize * kBlockSize : crop.height();
+
+    QByteArray blocks;
+    for (int y = 0; y < crop.height(); y += rows) {
+        const QRect strip(crop.x(), crop.y() + y, crop.width(), std::min(rows, crop.height() - y));
+        const QImage canvas = _composite(placements, strip, carried);
+        TRACE_SCOPE("encode");
+        blocks.append(BlockEncoder::encode(canvas, _compression, _blocks.get()));
+    }
+
+    CompressedTextureWriter::Container container;
+    OutputFile file(finalImagePath, _writeBuffer);
+    if (!CompressedTextureWriter::containerForPath(finalImagePath, container) || !file.open())
+        return false;
+    TRACE_SCOPE("encode");
+    return CompressedTextureWriter::write(file.device(), container, _compression, crop.size(), blocks) && file.commit();
+}
+
+auto Generator::_quantize(const QImage& canvas) const->QImage {
+    TRACE_SCOPE("quantize");
+    ColorQuantizer quantizer;
+    quantizer.setDither(_dither);
+    const QImage result = quantizer.quantize(canvas);
+    if (quantizer.error() <= _maxQuantizeError)
+        return result;
+
+    fprintf(stderr, "%s\n", qPrintable(QString("palette error %1 is above %2, kept as rgba8888")
+        .arg(QString::number(quantizer.error(), 'f', 2), QString::number(_maxQuantizeError))));
+    return ImageConvert::convert(canvas, QImage::Format_RGBA8888);
+}
+
+// The data file is serialized while the texture encodes, and renamed into
+// place only after the texture, so it never names a texture that failed.
+auto Generator::_saveResults(const _Layout& layout, const QString& finalImagePath, const QString& plistPath) const->bool {
+    QFuture<QByteArray> plist = QtConcurrent::run([this, &layout, finalImagePath]() {
+        return _serializePlist(layout, finalImagePath);
+    });
+    const bool saved = _saveImage(layout.placements, layout.crop, finalImagePath, _outputFormat);
+    const QByteArray data = plist.result();
+    if (!saved)
+        return false;
+    fprintf(stdout, "%s\n", qPrintable(finalImagePath + " - success"));
+
+    TRACE_SCOPE("plist write");
+    OutputFile plistFile(_plistPath(finalImagePath, plistPath), _writeBuffer);
+    return plistFile.open(QIODevice::WriteOnly | QIODevice::Text)
+        && plistFile.device()->write(data) == data.size()
+        && plistFile.commit();
+}
+
+auto Generator::_serializePlist(const _Layout& layout, const QString& finalImagePath) const->QByteArray {
+    TRACE_SCOPE("plist");
+    QFileInfo info(finalImagePath);
+    QVariantMap meta;
+    meta["format"] = 2;
+    meta["realTextureFileName"] = meta["textureFileName"] = info.baseName() + '.' + (_suffix.isEmpty() ? info.completeSuffix() : _suffix);
+    meta["size"] = QString("{%1,%2}").arg(QString::number(layout.crop.width()), QString::number(layout.crop.height()));
+
+    QVariantMap root;
+    root["frames"] = layout.frames;
+    root["metadata"] = meta;
+    if (!layout.animations.empty())
+        root["animations"] = _formatAnimations(layout.animations);
+    return PListSerializer::toPList(root).toUtf8();
 }
 
 auto Generator::_fitSize(const QSize& size, bool& optimal) const->QSize {
@@ -334,66 +1253,402 @@ auto Generator::_fitSize(const QSize& size, bool& optimal) const->QSize {
         if (size.width() * size.height() <= (result.width() * result.height()) / 2)
             optimal = false;
     }
+
+    const int alignment = _alignment();
+    result.setWidth((result.width() + alignment - 1) / alignment * alignment);
+    result.setHeight((result.height() + alignment - 1) / alignment * alignment);
     return result;
 }
 
+// Sprites of block compressed textures start on block boundaries and occupy
+// whole blocks, so no block mixes two of them.
+auto Generator::_alignment() const->int {
+    return _compression != BlockEncoder::NONE ? kBlockSize : 1;
+}
+
 auto Generator::_readFileList() const->std::shared_ptr<std::set<QString>> {
-    auto result = std::make_shared<std::set<QString>>();
-    QDirIterator it(_inputImageDirPath, QStringList() << "*.*", QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        result->insert(it.next());
+    TRACE_SCOPE("scan");
+    FileScanner scanner(_inputImageDirPath);
+    scanner.setIncludePatterns(_includePatterns);
+    scanner.setExcludePatterns(_excludePatterns);
+
+    int skipped = 0;
+    const auto result = scanner.scan(skipped);
+    if (skipped > 0)
+        fprintf(stderr, "%s%d%s\n", "Skipped ", skipped, " files that are not supported images.");
+    return result;
+}
+
+auto Generator::_readSources() const->std::vector<_Source> {
+    std::vector<_Source> result;
+    if (!_images.empty()) {
+        for (const auto& image : _images) {
+            _Source source;
+            source.name = image.first;
+            source.image = image.second;
+            result.push_back(source);
+        }
+        return result;
+    }
+    if (ArchiveReader::isArchive(_inputImageDirPath))
+        return _readArchive();
+
+    const QDir dir(_inputImageDirPath);
+    for (const auto& file : *_readFileList()) {
+        _Source source;
+        source.name = dir.relativeFilePath(file);
+        source.file = file;
+        result.push_back(source);
     }
     return result;
 }
 
-auto Generator::_processImages() const->std::shared_ptr<ImageData> {
-    auto result = std::make_shared<ImageData>();
-
-    const auto files = _readFileList();
-    for (auto file : *files) {
-        QImage image(file);
-        if (_scale < 1.0f)
-            image = image.scaledToWidth(_scale * image.width(), Qt::SmoothTransformation);
-
-        const QSize beforeTrimSize = image.size();
-        QRect cropRect(QPoint(0, 0), beforeTrimSize);
-        if (_trim != TrimMode::NONE)
-            image = ImageTrim::createImage(image, _trim == TrimMode::MAX_ALPHA, cropRect);
-
-        QTemporaryFile uniqueFile;
-        uniqueFile.setAutoRemove(false);
-        if (uniqueFile.open()) {
-            QImageWriter writer(uniqueFile.fileName());
-            writer.setFormat("png");
-            if (writer.write(image)) {
-                _Data data;
-                data.beforeCropSize = beforeTrimSize;
-                data.cropRect = cropRect;
-                data.pathOrDuplicateFrameName = uniqueFile.fileName();
-                result->insert(std::make_pair(QDir(_inputImageDirPath).relativeFilePath(file), data));
-            }
+auto Generator::_readArchive() const->std::vector<_Source> {
+    TRACE_SCOPE("scan");
+    std::vector<_Source> result;
+    const auto archive = std::make_shared<ArchiveReader>(_inputImageDirPath);
+    if (!archive->open()) {
+        fprintf(stderr, "%s\n", qPrintable("Can't read the archive " + _inputImageDirPath));
+        return result;
+    }
+
+    FileScanner filter(QString());
+    filter.setIncludePatterns(_includePatterns);
+    filter.setExcludePatterns(_excludePatterns);
+
+    // members are decoded in archive order, so reads move forward through the file
+    int skipped = 0;
+    const auto& entries = archive->entries();
+    for (size_t n = 0; n < entries.size(); ++n) {
+        if (!filter.accepts(entries[n].name))
+            continue;
+        if (!FileScanner::isSupportedImage(archive->read(entries[n], FileScanner::kSniffSize), entries[n].name)) {
+            ++skipped;
+            continue;
+        }
+
+        _Source source;
+        source.name = entries[n].name;
+        source.archive = archive;
+        source.entry = n;
+        result.push_back(source);
+    }
+    if (skipped > 0)
+        fprintf(stderr, "%s%d%s\n", "Skipped ", skipped, " files that are not supported images.");
+    return result;
+}
+
+auto Generator::_readImage(const _Source& source)->QImage {
+    if (source.archive)
+        return QImage::fromData(source.archive->read(source.archive->entries()[source.entry]));
+    return source.file.isEmpty() ? source.image : QImage(source.file);
+}
+
+auto Generator::_variantPath(const QString& path, size_t variant) const->QString {
+    const float smallest = *std::min_element(_scales.begin(), _scales.end());
+    const QFileInfo info(path);
+    return info.dir().path() + QDir::separator() + info.baseName()
+        + QString("@%1x").arg(qRound(_scales[variant] / smallest))
+        + (info.completeSuffix().isEmpty() ? QString() : '.' + info.completeSuffix());
+}
+
+auto Generator::_pagePath(const QString& path, int page)->QString {
+    const QFileInfo info(path);
+    return info.dir().path() + QDir::separator() + info.baseName() + QString("-%1").arg(page)
+        + (info.completeSuffix().isEmpty() ? QString() : '.' + info.completeSuffix());
+}
+
+auto Generator::_plistPath(const QString& finalImagePath, const QString& plistPath)->QString {
+    const QFileInfo info(finalImagePath);
+    return plistPath.isEmpty() ? info.dir().path() + QDir::separator() + info.baseName() + ".plist" : plistPath;
+}
+
+auto Generator::_outputPaths(const QString& finalImagePath, const QString& plistPath) const->QStringList {
+    if (_scales.size() == 1)
+        return QStringList() << finalImagePath << _plistPath(finalImagePath, plistPath);
+
+    QStringList result;
+    for (size_t n = 0; n < _scales.size(); ++n) {
+        const auto variantImagePath = _variantPath(finalImagePath, n);
+        result << variantImagePath << _plistPath(variantImagePath, plistPath.isEmpty() ? plistPath : _variantPath(plistPath, n));
+    }
+    return result;
+}
+
+// Hashes what the outputs are made from: every option that changes them, the
+// output paths and the name, size and modification time of every source.
+auto Generator::_fingerprint(const std::vector<_Source>& sources, const QStringList& outputs) const->QByteArray {
+    QString options;
+    QTextStream out(&options);
+    out << "version " << kFingerprintVersion << "\nscales";
+    for (auto scale : _scales)
+        out << ' ' << QString::number(scale, 'g', 9);
+    out << "\nfilter " << int(_scaleFilter)
+        << "\nmax size " << _maxSize.width() << 'x' << _maxSize.height()
+        << "\npadding " << _padding << "\nmargin " << _margin
+        << "\ntrim " << int(_trim) << "\npolygon " << _polygonVertices
+        << "\nalias transforms " << _aliasTransforms
+        << "\nsquare " << _square << "\npower of 2 " << _isPowerOf2
+        << "\nformat " << int(_outputFormat) << "\ndither " << _dither << "\nmax error " << _maxQuantizeError
+        << "\ncompression " << int(_compression)
+        << "\nsuffix " << _suffix
+        << "\nstrip height " << _stripHeight << "\noptimize " << _optimizeSeconds
+        << "\ngroup animations " << _groupAnimations
+        << "\ninclude " << _includePatterns.join('\t') << "\nexclude " << _excludePatterns.join('\t')
+        << "\noutputs " << outputs.join('\t') << '\n';
+    out.flush();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(options.toUtf8());
+    const QFileInfo archive(_inputImageDirPath);
+    for (const auto& source : sources) {
+        const QFileInfo info = source.archive ? archive : QFileInfo(source.file);
+        const qint64 size = source.archive ? source.archive->entries()[source.entry].size : info.size();
+        hash.addData(QString("%1\t%2\t%3\n").arg(source.name).arg(size).arg(info.lastModified().toMSecsSinceEpoch()).toUtf8());
+    }
+    return hash.result().toHex();
+}
+
+// Up to date when the recorded fingerprint matches and every recorded output
+// still has the size and modification time it was written with.
+auto Generator::_isUpToDate(const QString& fingerprintPath, const QByteArray& fingerprint)->bool {
+    QFile file(fingerprintPath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    if (file.readLine().trimmed() != fingerprint)
+        return false;
+
+    while (!file.atEnd()) {
+        const QStringList fields = QString::fromUtf8(file.readLine()).trimmed().split('\t');
+        if (fields.size() != 3)
+            return false;
+        const QFileInfo info(fields[0]);
+        if (!info.isFile() || QString::number(info.size()) != fields[1] || QString::number(info.lastModified().toMSecsSinceEpoch()) != fields[2])
+            return false;
+    }
+    return true;
+}
+
+auto Generator::_saveFingerprint(const QString& fingerprintPath, const QByteArray& fingerprint, const QStringList& outputs)->bool {
+    QSaveFile file(fingerprintPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+
+    QTextStream out(&file);
+    out << fingerprint << '\n';
+    for (const auto& output : outputs) {
+        const QFileInfo info(output);
+        out << output << '\t' << info.size() << '\t' << info.lastModified().toMSecsSinceEpoch() << '\n';
+    }
+    out.flush();
+    return file.commit();
+}
+
+auto Generator::_scaleImage(const QImage& image, const QRect& imageRect, const QSize& imageSize, const QSize& scaledSize, QRect& window) const->QImage {
+    const QImage source = image.convertToFormat(QImage::Format_ARGB32);
+
+    // Fully transparent pixels add nothing to the filtered result, so trimming them
+    // away before scaling leaves the crop found after scaling unchanged.
+    QImage visible = source;
+    QRect sourceRect = imageRect;
+    if (_trim != TrimMode::NONE && source.hasAlphaChannel()) {
+        const QRect visibleRect = ImageTrim::getBoundingBox(source, true);
+        if (visibleRect.isValid() && visibleRect.size() != source.size()) {
+            visible = source.copy(visibleRect);
+            sourceRect = visibleRect.translated(imageRect.topLeft());
         }
     }
 
-    if (result->size() < files->size()) {
-        fprintf(stderr, "%s\n", "Found an invalid image or the scale coefficient has been chosen too small.");
-        result->clear();
+    return ImageScale::scale(visible, sourceRect, imageSize, scaledSize, _scaleFilter, window);
+}
+
+// Everything that changes the crop rectangle or hash of a variant.
+auto Generator::_trimCacheSettings(size_t variant) const->QString {
+    QStringList scales;
+    for (auto scale : _scales)
+        scales << QString::number(scale);
+    return QString("trim=%1 scale=%2 scales=%3 filter=%4 transforms=%5").arg(
+                QString::number(int(_trim)),
+                QString::number(_scales[variant]),
+                scales.join(','),
+                QString::number(int(_scaleFilter)),
+                QString::number(int(_aliasTransforms)));
+}
+
+// Fills every variant of a file from its header and the trim cache alone. Fails
+// when a variant needs the decoded pixels to be trimmed.
+auto Generator::_probeImage(const _Source& source, const std::vector<size_t>& cascade, const TrimCache& cache, std::vector<std::shared_ptr<ImageData>>& result) const->bool {
+    TRACE_SCOPE("probe");
+    QSize size = source.image.size();
+    if (!source.file.isEmpty()) {
+        size = QImageReader(source.file).size();
+    } else if (source.archive) {
+        QByteArray bytes = source.archive->read(source.archive->entries()[source.entry]);
+        QBuffer buffer(&bytes);
+        size = QImageReader(&buffer).size();
     }
+    if (!size.isValid())
+        return false;
 
-    std::map<QString, QString> framePathData;
-    for (auto& item : *result) {
-        QImage image(item.second.pathOrDuplicateFrameName);
-        QString duplicateFrameName;
-        const QString itemPath = item.second.pathOrDuplicateFrameName;
-        if (_checkDuplicate(image, framePathData, duplicateFrameName)) {
-            QFile file(itemPath);
-            file.remove();
-            item.second.pathOrDuplicateFrameName = duplicateFrameName;
-            item.second.duplicated = true;
+    std::vector<_Data> probed(_scales.size());
+    for (auto variant : cascade) {
+        auto& data = probed[variant];
+        data.beforeCropSize = _scales[variant] < 1.0f
+            ? ImageScale::scaledSizeToWidth(size, _scales[variant] * size.width())
+            : size;
+
+        TrimCache::Entry entry;
+        if (!source.file.isEmpty() && cache.find(source.file, _trimCacheSettings(variant), entry) && entry.beforeCropSize == data.beforeCropSize) {
+            data.cropRect = entry.cropRect;
+            data.hash = entry.hash;
+        } else if (_trim == TrimMode::NONE) {
+            data.cropRect = QRect(QPoint(0, 0), data.beforeCropSize);
         } else {
-            framePathData.insert(std::make_pair(item.first, itemPath));
+            return false;
+        }
+    }
+
+    for (size_t n = 0; n < probed.size(); ++n)
+        result[n]->insert(std::make_pair(source.name, probed[n]));
+    return true;
+}
+
+auto Generator::_processImages(const std::vector<_Source>& sources, bool dryRun) const->std::vector<std::shared_ptr<ImageData>> {
+    TRACE_SCOPE("process images");
+    std::vector<std::shared_ptr<ImageData>> result;
+    for (size_t n = 0; n < _scales.size(); ++n)
+        result.push_back(std::make_shared<ImageData>());
+
+    // Each source is decoded once and the variants are produced largest first,
+    // every one scaled from the untrimmed pixels of the previous one.
+    std::vector<size_t> cascade(_scales.size());
+    std::iota(cascade.begin(), cascade.end(), 0);
+    std::stable_sort(cascade.begin(), cascade.end(), [this](size_t a, size_t b) {
+        return _scales[a] > _scales[b];
+    });
+
+    // images handed over in memory never touch the trim cache
+    const bool cached = !_trimCachePath.isEmpty() && _images.empty();
+    TrimCache cache(_trimCachePath);
+    if (cached)
+        cache.load();
+
+    for (const auto& source : sources) {
+        // a dry run only decodes the images it can't lay out from headers and cache
+        if (dryRun && _probeImage(source, cascade, cache, result))
+            continue;
+
+        Trace::Scope decodeScope("decode");
+        decodeScope.arg("file", source.name);
+        const QImage decoded = _readImage(source);
+        decodeScope.end();
+
+        QImage previous = decoded;
+        QSize previousSize = decoded.size();
+        QRect previousWindow(QPoint(0, 0), previousSize);
+
+        for (auto variant : cascade) {
+            QImage image = previous;
+            QSize beforeTrimSize = previousSize;
+            QRect window = previousWindow;
+            if (_scales[variant] < 1.0f) {
+                beforeTrimSize = ImageScale::scaledSizeToWidth(decoded.size(), _scales[variant] * decoded.width());
+                if (beforeTrimSize != previousSize) {
+                    TRACE_SCOPE("scale");
+                    image = _scaleImage(previous, previousWindow, previousSize, beforeTrimSize, window);
+                }
+            }
+            previous = image;
+            previousSize = beforeTrimSize;
+            previousWindow = window;
+
+            QRect cropRect(QPoint(0, 0), image.size());
+            if (_trim != TrimMode::NONE) {
+                TRACE_SCOPE("trim");
+                image = ImageTrim::createImage(image, _trim == TrimMode::MAX_ALPHA, cropRect);
+            }
+            cropRect.translate(window.topLeft());
+
+            if (image.isNull())
+                continue;
+
+            _Data data;
+            data.beforeCropSize = beforeTrimSize;
+            data.cropRect = cropRect;
+            {
+                TRACE_SCOPE("hash");
+                data.hash = _contentHash(image, _aliasTransforms);
+            }
+
+            if (cached && !source.file.isEmpty()) {
+                TrimCache::Entry entry;
+                entry.beforeCropSize = beforeTrimSize;
+                entry.cropRect = cropRect;
+                entry.hash = data.hash;
+                cache.insert(source.file, _trimCacheSettings(variant), entry);
+            }
+
+            if (dryRun) {
+                result[variant]->insert(std::make_pair(source.name, data));
+                continue;
+            }
+
+            if (_polygonVertices > 0) {
+                TRACE_SCOPE("outline");
+                data.outline = PolygonTrim::createOutline(image, _polygonVertices);
+            }
+
+            // The layout needs every crop rect and hash, so each source is decoded
+            // here once; sprites over the budget go to the scratch file and are
+            // read back, not decoded again, when compositing reaches them.
+            TRACE_SCOPE("store sprite");
+            data.spriteOrDuplicateFrameName = _sprites->insert(image);
+            result[variant]->insert(std::make_pair(source.name, data));
         }
     }
 
+    for (auto& variant : result) {
+        if (variant->size() < sources.size()) {
+            fprintf(stderr, "%s\n", "Found an invalid image or the scale coefficient has been chosen too small.");
+            _releaseSprites(*variant);
+            variant->clear();
+        }
+
+        // only frames sharing a content hash are ever decoded and compared
+        TRACE_SCOPE("dedup");
+        HashedFrames hashedFrames;
+        const SpriteLoader load = [this](const QString& sprite) { return _sprites->image(sprite); };
+        for (auto& item : *variant) {
+            if (dryRun) {
+                // no pixels to compare: an equal hash counts as equal content, 0 is unknown
+                const auto hashed = item.second.hash ? hashedFrames.find(item.second.hash) : hashedFrames.end();
+                if (hashed != hashedFrames.end()) {
+                    item.second.spriteOrDuplicateFrameName = hashed->second.first;
+                    item.second.duplicated = true;
+                } else if (item.second.hash) {
+                    hashedFrames.insert(std::make_pair(item.second.hash, std::make_pair(item.first, QString())));
+                }
+                continue;
+            }
+
+            QString duplicateFrameName;
+            int transform = 0;
+            const QString sprite = item.second.spriteOrDuplicateFrameName;
+            if (hashedFrames.count(item.second.hash) &&
+                _checkDuplicate(load(sprite), item.second.hash, hashedFrames, load, _aliasTransforms, duplicateFrameName, transform))
+            {
+                _sprites->remove(sprite);
+                item.second.spriteOrDuplicateFrameName = duplicateFrameName;
+                item.second.duplicated = true;
+                item.second.aliasTransform = transform;
+            } else {
+                hashedFrames.insert(std::make_pair(item.second.hash, std::make_pair(item.first, sprite)));
+            }
+        }
+    }
+
+    if (cached && !cache.save())
+        fprintf(stderr, "%s\n", qPrintable("Can't write the trim cache " + _trimCachePath));
+
     return result;
 }
@@ -17,9 +17,24 @@ Suite 330, Boston, MA 02111-1307 USA */
 #ifndef GENERATOR_H
 #define GENERATOR_H
 
+#include "imageTools/ImageScale.h"
+#include "imageTools/BlockEncoder.h"
+#include "ScenePartitioner.h"
+
 #include <QImage>
+#include <QStringList>
+#include <QVariantMap>
+#include <functional>
 #include <memory>
+#include <map>
 #include <set>
+#include <vector>
+
+namespace rbp { struct MaxRectsStats; }
+class TrimCache;
+class SpriteCache;
+class ArchiveReader;
+class BlockCache;
 
 class Generator {
 public:
@@ -29,53 +44,246 @@ public:
         MAX_ALPHA
     };
 
-    Generator(const QString& inputImageDirPath);
+    // A frame of an atlas built in memory, in atlas pixels. The fields mirror the
+    // plist frame keys; vertices, verticesUV and triangles are only filled for
+    // polygon frames, flipX, flipY and rotation only for transformed aliases.
+    struct Frame {
+        Frame() : rotated(false), flipX(false), flipY(false), rotation(0) {}
+        QString name;
+        QRect   rect;
+        bool    rotated;
+        QPoint  offset;
+        QRect   sourceColorRect;
+        QSize   sourceSize;
+        bool    flipX;
+        bool    flipY;
+        int     rotation;
+        std::vector<QPoint> vertices;
+        std::vector<QPoint> verticesUV;
+        std::vector<int>    triangles;
+    };
+
+    // The frames of an animation, by frame number, and the atlas region they cover.
+    struct Animation {
+        QString     name;
+        QRect       rect;
+        QStringList frames;
+    };
 
-    auto setScale(float scale)->void { _scale = scale; }
+    // One atlas per scale (and page, with setScenes), a null image when its
+    // frames don't fit the max size.
+    struct Atlas {
+        Atlas() : scale(1.0f), page(0) {}
+        float   scale;
+        int     page;
+        QImage  image;
+        std::vector<Frame> frames;
+        std::vector<Animation> animations;
+    };
+
+    Generator(const QString& inputImageDirPath = QString());
+
+    auto setScale(float scale)->void { _scales = { scale }; }
+    // One sheet per factor, named @Nx by its ratio to the smallest one. False,
+    // leaving the scales as they were, unless the factors are positive and
+    // their ratios distinct whole numbers.
+    auto setScales(const std::vector<float>& scales)->bool;
+    auto setScaleFilter(ImageScale::Filter filter)->void { _scaleFilter = filter; }
     auto setMaxSize(const QSize& size)->void { _maxSize = size; }
     auto setPadding(int padding)->void { _padding = padding; }
     auto setMargin(int margin)->void { _margin = margin; }
     auto setTrimMode(TrimMode mode)->void { _trim = mode; }
+    auto setPolygonVertices(int maxVertices)->void { _polygonVertices = maxVertices; }
+    auto setAliasTransforms(bool enabled)->void { _aliasTransforms = enabled; }
     auto setIsSquare(bool square)->void { _square = square; }
     auto setIsPowerOf2(bool isPow2)->void { _isPowerOf2 = isPow2; }
+    // Format_Indexed8 quantizes the texture to a 256 color palette and falls back
+    // to rgba8888 when the quantization error is above setMaxQuantizeError.
     auto setOutputFormat(QImage::Format format)->void { _outputFormat = format; }
+    auto setDither(bool dither)->void { _dither = dither; }
+    auto setMaxQuantizeError(double error)->void { _maxQuantizeError = error; }
+    // generateTo writes the texture block compressed into a KTX (or PVR, for a .pvr
+    // path) instead of a png, with every sprite on its own 4x4 blocks and texture
+    // sides that are multiples of 4. generate() still returns images.
+    auto setCompression(BlockEncoder::Format format)->void { _compression = format; }
+    // File keeping the compressed blocks of the last build, so the blocks of
+    // unchanged sprites are copied instead of encoded again.
+    auto setBlockCachePath(const QString& path)->void { _blockCachePath = path; }
     auto setTextureSuffixInData(const QString& suffix)->void { _suffix = suffix; }
+    auto setStripHeight(int rows)->void { _stripHeight = rows; }
+    auto setPrintStats(bool print)->void { _printStats = print; }
+    auto setIncludePatterns(const QStringList& patterns)->void { _includePatterns = patterns; }
+    auto setExcludePatterns(const QStringList& patterns)->void { _excludePatterns = patterns; }
+    auto setDryRun(bool dryRun)->void { _dryRun = dryRun; }
+    auto setTrimCachePath(const QString& path)->void { _trimCachePath = path; }
+    auto setMemoryBudget(qint64 bytes)->void { _memoryBudget = bytes; }
+    // Outputs always go to a temporary file renamed into place when complete.
+    // A write buffer of that many bytes also hands the writing to a thread of
+    // its own, so encoding doesn't wait on slow (network) storage.
+    auto setWriteBuffer(qint64 bytes)->void { _writeBuffer = bytes; }
+    // generateTo leaves the outputs alone when the sources, options and outputs
+    // are those of the build recorded in <sheet>.fingerprint.
+    auto setSkipUnchanged(bool skip)->void { _skipUnchanged = skip; }
+    // After the greedy pass, spends up to that many seconds per texture on all
+    // cores looking for an order and rotation of the sprites that fits a smaller one.
+    auto setOptimizeTime(double seconds)->void { _optimizeSeconds = seconds; }
+    // Packs the frames of each animation (see ImageSorter::animationName) one after
+    // another, each next to those already placed, and lists the animations with
+    // their regions. Turns setOptimizeTime off, which would scatter them again.
+    auto setGroupAnimations(bool group)->void { _groupAnimations = group; }
+    // Splits the sprites into pages of the max size, <sheet>-0, <sheet>-1 and so
+    // on, so that each scene touches as few pages as it can, weighted by how
+    // often it is shown. Builds with scenes are never skipped as unchanged.
+    auto setScenes(const std::vector<ScenePartitioner::Scene>& scenes)->void { _scenes = scenes; }
+
+    // Images added here replace the input directory. A name is the frame name,
+    // the buffer form takes tightly packed RGBA8888 rows unless bytesPerLine is given.
+    auto addImage(const QString& name, const QImage& image)->void;
+    auto addImage(const QString& name, const uchar* rgba, int width, int height, int bytesPerLine = 0)->void;
 
     auto generateTo(const QString& finalImagePath, const QString& plistPath="")->bool;
+    // Packs the added images without touching the filesystem: no scratch spill,
+    // no trim cache and no dry run, the atlases are returned instead of saved.
+    // setCompression only aligns the layout to 4x4 blocks here, the images are
+    // returned uncompressed for the caller to hand to BlockEncoder::encode.
+    auto generate(std::vector<Atlas>& atlases)->bool;
 
 protected:
     struct _Data {
-        _Data() : duplicated(false), adjusted(false) {}
+        _Data() : duplicated(false), hash(0), aliasTransform(0) {}
         QSize   beforeCropSize;
         QRect   cropRect;
-        QString pathOrDuplicateFrameName;
+        QString spriteOrDuplicateFrameName;
         bool    duplicated;
-        bool    adjusted;
+        std::vector<QPoint> outline;
+        quint64 hash;
+        int     aliasTransform;
     };
     typedef std::map<QString, _Data> ImageData;
+    typedef std::multimap<quint64, std::pair<QString, QString>> HashedFrames;
+    typedef std::function<QImage(const QString&)> SpriteLoader;
+
+    struct _Placement {
+        QString sprite;
+        QRect   rect;
+        bool    rotated;
+    };
+
+    // The frames of a variant as parallel arrays in ImageData order, so the
+    // packing attempts run on indices without name lookups or QVariants.
+    struct _FrameTable {
+        std::vector<const ImageData::value_type*> entries;
+        std::vector<QSize>  packSizes;      // crop size plus padding and margin
+        std::vector<int>    duplicateOf;    // index of the original, -1 unless duplicated
+        std::vector<QRect>  frameRects;     // unrotated frame rect of the last attempt
+        std::vector<bool>   rotated;
+    };
+
+    struct _Layout {
+        std::vector<_Placement> placements;
+        QRect       crop;
+        QVariantMap frames;
+        std::vector<Animation> animations;
+    };
+
+    // One input image: a file, an archive member or an image added in memory.
+    struct _Source {
+        _Source() : entry(0) {}
+        QString name;
+        QString file;
+        QImage  image;
+        std::shared_ptr<ArchiveReader> archive;
+        size_t  entry;
+    };
 
     static auto _roundToPowerOf2(int value)->int;
     static auto _floorToPowerOf2(int value)->int;
-    static auto _adjustFrames(QVariantMap& frames, const std::function<void(QRect&)>& cb)->void;
-    static auto _removeTempFiles(const ImageData& paths)->void;
-    static auto _checkDuplicate(const QImage& image, const std::map<QString, QString> paths, QString& out)->bool;
-    static auto _adjustSortedPaths(std::vector<QString>& paths, ImageData& imageData)->void;
-    auto _saveResults(const QImage& image, const QVariantMap& frames, const QString& finalImagePath, const QString& plistPath) const->bool;
+    static auto _formatRect(const QRect& rect)->QString;
+    static auto _formatFrames(QVariantMap& frames)->void;
+    static auto _formatAnimations(const std::vector<Animation>& animations)->QVariantMap;
+    static auto _atlasFrames(const QVariantMap& frames)->std::vector<Frame>;
+    static auto _orient(const QImage& image, int transform)->QImage;
+    static auto _imageHash(const QImage& image)->quint64;
+    static auto _contentHash(const QImage& image, bool transforms)->quint64;
+    static auto _checkDuplicate(const QImage& image, quint64 hash, const HashedFrames& frames, const SpriteLoader& load, bool transforms, QString& out, int& transform)->bool;
+    static auto _addAliasTransform(QVariantMap& frameInfo, int transform)->void;
+    static auto _occupancy(const std::vector<_Placement>& placements, const QRect& crop)->double;
+    auto _releaseSprites(const ImageData& imageData) const->void;
+    auto _composite(const std::vector<_Placement>& placements, const QRect& area, std::map<size_t, QImage>& carried) const->QImage;
+    auto _saveImage(const std::vector<_Placement>& placements, const QRect& crop, const QString& finalImagePath, QImage::Format format) const->bool;
+    auto _quantize(const QImage& canvas) const->QImage;
+    auto _saveCompressed(const std::vector<_Placement>& placements, const QRect& crop, const QString& finalImagePath) const->bool;
+    auto _alignment() const->int;
+    auto _saveResults(const _Layout& layout, const QString& finalImagePath, const QString& plistPath) const->bool;
+    auto _serializePlist(const _Layout& layout, const QString& finalImagePath) const->QByteArray;
+    auto _addPolygon(QVariantMap& frameInfo, const _Data& data) const->void;
+    auto _reportLayout(const QString& finalImagePath, const _Layout& layout) const->void;
+    auto _reportStats(const QString& finalImagePath, int attempts, const _Layout& layout, const rbp::MaxRectsStats& stats) const->void;
     auto _fitSize(const QSize& size, bool& optimal) const->QSize;
     auto _readFileList() const->std::shared_ptr<std::set<QString>>;
-    auto _processImages() const->std::shared_ptr<ImageData>;
+    auto _readSources() const->std::vector<_Source>;
+    auto _readArchive() const->std::vector<_Source>;
+    static auto _readImage(const _Source& source)->QImage;
+    auto _makeFrameTable(const ImageData& imageData) const->_FrameTable;
+    static auto _findAnimations(const _FrameTable& table, std::vector<int>& animations)->QStringList;
+    static auto _animationRegions(const _FrameTable& table, const std::vector<int>& animations, const QStringList& names, const QRect& crop)->std::vector<Animation>;
+    auto _frameInfo(const _Data& data, const QRect& frameRect, bool rotated) const->QVariantMap;
+    auto _compactLayout(_FrameTable& table, const std::vector<int>& packOrder, QRect& finalCrop) const->void;
+    auto _optimizeTargets(const QSize& size, qint64 minArea) const->std::vector<QSize>;
+    auto _optimizeLayout(_FrameTable& table, const std::vector<int>& packOrder, QRect& finalCrop) const->void;
+    auto _layoutVariant(const ImageData& imageData, const QString& finalImagePath, _Layout& layout, bool reportTooLarge = true, bool optimize = true) const->bool;
+    auto _generateVariant(std::shared_ptr<ImageData> imageData, const QString& finalImagePath, const QString& plistPath) const->bool;
+    auto _writeLayout(_Layout& layout, const ImageData& imageData, const QString& finalImagePath, const QString& plistPath) const->bool;
+    auto _pageUnits(const std::vector<std::shared_ptr<ImageData>>& variants, std::map<QString, int>& unitOf) const->int;
+    auto _layoutPages(const std::vector<std::shared_ptr<ImageData>>& variants, const QString& finalImagePath,
+                      std::vector<std::vector<std::shared_ptr<ImageData>>>& pages, std::vector<std::vector<_Layout>>& layouts) const->bool;
+    auto _reportPages(const QString& finalImagePath, double cost, const std::vector<std::vector<int>>& unitScenes, const std::vector<int>& unitPages, int pageCount) const->void;
+    auto _generatePages(const std::vector<std::shared_ptr<ImageData>>& variants, const QString& finalImagePath, const QString& plistPath) const->bool;
+    auto _variantPath(const QString& path, size_t variant) const->QString;
+    static auto _pagePath(const QString& path, int page)->QString;
+    auto _outputPaths(const QString& finalImagePath, const QString& plistPath) const->QStringList;
+    auto _fingerprint(const std::vector<_Source>& sources, const QStringList& outputs) const->QByteArray;
+    static auto _plistPath(const QString& finalImagePath, const QString& plistPath)->QString;
+    static auto _isUpToDate(const QString& fingerprintPath, const QByteArray& fingerprint)->bool;
+    static auto _saveFingerprint(const QString& fingerprintPath, const QByteArray& fingerprint, const QStringList& outputs)->bool;
+    auto _scaleImage(const QImage& image, const QRect& imageRect, const QSize& imageSize, const QSize& scaledSize, QRect& window) const->QImage;
+    auto _trimCacheSettings(size_t variant) const->QString;
+    auto _probeImage(const _Source& source, const std::vector<size_t>& cascade, const TrimCache& cache, std::vector<std::shared_ptr<ImageData>>& result) const->bool;
+    auto _processImages(const std::vector<_Source>& sources, bool dryRun) const->std::vector<std::shared_ptr<ImageData>>;
 
-    float           _scale = 1.0f;
+    std::vector<float> _scales = { 1.0f };
+    ImageScale::Filter _scaleFilter = ImageScale::BILINEAR;
     QSize           _maxSize = { 0, 0 };
     int             _padding = 0;
     int             _margin = 1;
     TrimMode        _trim = MAX_ALPHA;
+    int             _polygonVertices = 0;
+    bool            _aliasTransforms = false;
     bool            _square = false;
     bool            _isPowerOf2 = false;
     QImage::Format  _outputFormat = QImage::Format_RGBA8888;
+    bool            _dither = false;
+    double          _maxQuantizeError = 4.0;
+    BlockEncoder::Format _compression = BlockEncoder::NONE;
+    QString         _blockCachePath;
+    std::shared_ptr<BlockCache> _blocks;
     QString         _suffix;
+    int             _stripHeight = 0;
+    bool            _printStats = false;
+    QStringList     _includePatterns;
+    QStringList     _excludePatterns;
+    bool            _dryRun = false;
+    QString         _trimCachePath;
+    qint64          _memoryBudget = qint64(1) << 30;
+    qint64          _writeBuffer = 0;
+    bool            _skipUnchanged = false;
+    double          _optimizeSeconds = 0.0;
+    bool            _groupAnimations = false;
+    std::vector<ScenePartitioner::Scene> _scenes;
+    std::shared_ptr<SpriteCache> _sprites;
 
     QString         _inputImageDirPath;
+    std::map<QString, QImage> _images;
 };
 
 #endif // GENERATOR_H
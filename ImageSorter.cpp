@@ -16,54 +16,91 @@ Suite 330, Boston, MA 02111-1307 USA */
 
 #include "ImageSorter.h"
 
-using namespace std::placeholders;
-typedef ImageSorter _IS;
+#include <map>
 
 ImageSorter::ImageSorter(const FrameSizes& files)
 : _files(files) {
 }
 
-auto ImageSorter::sort(const SortMode mode)->std::shared_ptr<std::vector<QString>> {
-    std::sort(_files.begin(), _files.end(), _sMultiSorters[mode]);
-    auto result = std::make_shared<std::vector<QString>>();
-    std::transform(_files.begin(), _files.end(), std::back_inserter(*result), [](const Info& info) {
-        return info.first;
-    });
-    return result;
+auto ImageSorter::sort(const SortMode mode) const->Order {
+    switch (mode) {
+    case HEIGHT: return sort<HEIGHT>();
+    case WIDTH: return sort<WIDTH>();
+    case AREA: return sort<AREA>();
+    case MAXSIDE: return sort<MAXSIDE>();
+    }
+    return sort<MAXSIDE>();
 }
 
-decltype(ImageSorter::_sMultiSorters) ImageSorter::_sMultiSorters = {
-    { _IS::SortMode::HEIGHT, std::bind(_IS::_msort, _1, _2, _IS::FuncList({_IS::_sortHeight, _IS::_sortWidth}))},
-    { _IS::SortMode::WIDTH, std::bind(_IS::_msort, _1, _2, _IS::FuncList({_IS::_sortWidth, _IS::_sortHeight}))},
-    { _IS::SortMode::AREA, std::bind(_IS::_msort, _1, _2, _IS::FuncList({_IS::_sortArea, _IS::_sortHeight, _IS::_sortWidth}))},
-    { _IS::SortMode::MAXSIDE, std::bind(_IS::_msort, _1, _2, _IS::FuncList({_IS::_sortMax, _IS::_sortMin, _IS::_sortHeight, _IS::_sortWidth}))}
-};
-
-bool ImageSorter::_msort(const Info& a, const Info& b, FuncList criteria) {
-    for (size_t n = 0; n < criteria.size(); ++n) {
-        const int diff = criteria[n](a, b);
-        if (diff != 0)
-            return diff < 0;
+auto ImageSorter::group(const Order& order, const std::vector<int>& animations) const->Order {
+    std::map<int, std::vector<std::pair<int, size_t>>> members;
+    for (auto index : order) {
+        if (animations[index] < 0)
+            continue;
+        int number;
+        animationName(_files[index].first, number);
+        members[animations[index]].push_back(std::make_pair(number, index));
     }
-    return 0;
-}
 
-int ImageSorter::_sortWidth(const Info& a, const Info& b) {
-    return b.second.width() - a.second.width();
-}
+    Order result;
+    result.reserve(order.size());
+    for (auto index : order) {
+        if (animations[index] < 0) {
+            result.push_back(index);
+            continue;
+        }
+        const auto animation = members.find(animations[index]);
+        if (animation == members.end())
+            continue;
 
-int ImageSorter::_sortHeight(const Info& a, const Info& b) {
-    return b.second.height() - a.second.height();
+        auto& frames = animation->second;
+        std::stable_sort(frames.begin(), frames.end(), [](const std::pair<int, size_t>& a, const std::pair<int, size_t>& b) {
+            return a.first < b.first;
+        });
+        for (const auto& frame : frames)
+            result.push_back(frame.second);
+        members.erase(animation);
+    }
+    return result;
 }
 
-int ImageSorter::_sortArea(const Info& a, const Info& b) {
-    return b.second.width() * b.second.height() - a.second.width() * a.second.height();
-}
+auto ImageSorter::animationName(const QString& frameName, int& frameNumber)->QString {
+    const int slash = frameName.lastIndexOf('/');
+    QString name = frameName.mid(slash + 1);
+    const int dot = name.lastIndexOf('.');
+    if (dot > 0)
+        name.truncate(dot);
+
+    int digits = name.size();
+    while (digits > 0 && name.at(digits - 1).isDigit())
+        --digits;
+    frameNumber = name.mid(digits).toInt();
 
-int ImageSorter::_sortMax(const Info& a, const Info& b) {
-    return std::max(b.second.width(), b.second.height()) - std::max(a.second.width(), a.second.height());
+    QString prefix = name.left(digits);
+    while (!prefix.isEmpty() && QString("_-. ").contains(prefix.at(prefix.size() - 1)))
+        prefix.chop(1);
+    if (digits < name.size() && !prefix.isEmpty())
+        return frameName.left(slash + 1) + prefix;
+    return slash > 0 ? frameName.left(slash) : QString();
 }
 
-int ImageSorter::_sortMin(const Info& a, const Info& b) {
-    return std::min(b.second.width(), b.second.height()) - std::min(a.second.width(), a.second.height());
+// Stable, a byte per pass, skipping the bytes every key shares.
+void ImageSorter::_radixSort(std::vector<_Keyed>& keyed) {
+    if (keyed.empty())
+        return;
+
+    std::vector<_Keyed> buffer(keyed.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t offsets[257] = { 0 };
+        for (const auto& item : keyed)
+            ++offsets[((item.first >> shift) & 0xff) + 1];
+        if (offsets[((keyed.front().first >> shift) & 0xff) + 1] == keyed.size())
+            continue;
+
+        for (int n = 0; n < 256; ++n)
+            offsets[n + 1] += offsets[n];
+        for (const auto& item : keyed)
+            buffer[offsets[(item.first >> shift) & 0xff]++] = item;
+        keyed.swap(buffer);
+    }
 }
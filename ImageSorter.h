@@ -20,14 +20,17 @@ Suite 330, Boston, MA 02111-1307 USA */
 #include <QString>
 #include <QSize>
 #include <vector>
-#include <map>
-#include <functional>
-#include <memory>
+#include <algorithm>
 
+// Orders frames largest first. Every mode packs its criteria into one 64-bit
+// key per frame (each criterion inverted so that ascending keys mean descending
+// sizes), then sorts (key, index) pairs: std::sort for short lists, an LSD
+// radix sort for long ones. Equal keys keep their input order.
 class ImageSorter {
 public:
     typedef std::pair<QString, QSize> Info;
     typedef std::vector<Info> FrameSizes;
+    typedef std::vector<size_t> Order;
 
     enum SortMode {
         HEIGHT,
@@ -36,22 +39,81 @@ public:
         MAXSIDE
     };
 
+    // The sorter keeps a reference to files, which has to outlive it.
     ImageSorter(const FrameSizes& files);
 
-    auto sort(const SortMode mode = SortMode::MAXSIDE)->std::shared_ptr<std::vector<QString>>;
+    // Indices into files in packing order.
+    auto sort(const SortMode mode = SortMode::MAXSIDE) const->Order;
+    template <SortMode Mode> auto sort() const->Order;
+
+    // The given order, except that all frames of an animation follow the first
+    // of them the order reaches, by frame number. animations[n] is the
+    // animation of file n, -1 for none.
+    auto group(const Order& order, const std::vector<int>& animations) const->Order;
+
+    // Frames of one animation share the name before a frame number
+    // ("walk/left_003.png" belongs to "walk/left"), or else their directory.
+    // Empty for a top level name without a number.
+    static auto animationName(const QString& frameName, int& frameNumber)->QString;
 
 protected:
-    static std::map<SortMode, std::function<bool(const Info&, const Info&)>> _sMultiSorters;
-    typedef std::vector<std::function<int(const Info&, const Info&)>> FuncList;
+    typedef std::pair<quint64, quint32> _Keyed;
 
-    static bool _msort(const Info& a, const Info& b, FuncList criteria);
-    static int _sortWidth(const Info& a, const Info& b);
-    static int _sortHeight(const Info& a, const Info& b);
-    static int _sortArea(const Info& a, const Info& b);
-    static int _sortMax(const Info& a, const Info& b);
-    static int _sortMin(const Info& a, const Info& b);
+    template <SortMode Mode> static quint64 _key(const QSize& size);
+    static quint64 _descending(int value, int bits);
+    static void _radixSort(std::vector<_Keyed>& keyed);
 
-    FrameSizes  _files;
+    const FrameSizes& _files;
 };
 
+template <ImageSorter::SortMode Mode>
+auto ImageSorter::sort() const->Order {
+    const size_t kRadixThreshold = 256;
+
+    std::vector<_Keyed> keyed;
+    keyed.reserve(_files.size());
+    for (size_t n = 0; n < _files.size(); ++n)
+        keyed.push_back(_Keyed(_key<Mode>(_files[n].second), quint32(n)));
+
+    if (keyed.size() < kRadixThreshold)
+        std::sort(keyed.begin(), keyed.end());
+    else
+        _radixSort(keyed);
+
+    Order result;
+    result.reserve(keyed.size());
+    for (const auto& item : keyed)
+        result.push_back(item.second);
+    return result;
+}
+
+inline quint64 ImageSorter::_descending(int value, int bits) {
+    const quint64 mask = (quint64(1) << bits) - 1;
+    return mask - std::min(mask, quint64(std::max(0, value)));
+}
+
+template <>
+inline quint64 ImageSorter::_key<ImageSorter::HEIGHT>(const QSize& size) {
+    return _descending(size.height(), 16) << 48 | _descending(size.width(), 16) << 32;
+}
+
+template <>
+inline quint64 ImageSorter::_key<ImageSorter::WIDTH>(const QSize& size) {
+    return _descending(size.width(), 16) << 48 | _descending(size.height(), 16) << 32;
+}
+
+template <>
+inline quint64 ImageSorter::_key<ImageSorter::AREA>(const QSize& size) {
+    const quint64 area = quint64(std::max(0, size.width())) * quint64(std::max(0, size.height()));
+    return (quint64(0xffffffff) - std::min(area, quint64(0xffffffff))) << 32
+        | _descending(size.height(), 16) << 16 | _descending(size.width(), 16);
+}
+
+template <>
+inline quint64 ImageSorter::_key<ImageSorter::MAXSIDE>(const QSize& size) {
+    return _descending(std::max(size.width(), size.height()), 16) << 48
+        | _descending(std::min(size.width(), size.height()), 16) << 32
+        | _descending(size.height(), 16) << 16 | _descending(size.width(), 16);
+}
+
 #endif // IMAGESORTER_H
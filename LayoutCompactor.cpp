@@ -0,0 +1,268 @@
+/* LayoutCompactor.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#include "LayoutCompactor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+// Buckets span about this many average rectangles a side.
+const double kCellRects = 2.0;
+const int kMaxGravityPasses = 32;
+const int kMaxEdgePulls = 64;
+
+inline bool intersects(const rbp::Rect& a, const rbp::Rect& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+}
+
+LayoutCompactor::LayoutCompactor(const std::vector<rbp::Rect>& rects, bool allowFlip)
+: _rects(rects)
+, _flipped(rects.size(), false)
+, _allowFlip(allowFlip)
+, _cell(1)
+, _columns(1)
+, _rows(1) {
+}
+
+auto LayoutCompactor::compact()->QSize {
+    if (_rects.empty())
+        return QSize();
+
+    // rectangles only ever move inside the starting bounds, so the grid covers them once
+    const QSize size = _size();
+    double area = 0.0;
+    for (const auto& rect : _rects)
+        area += double(rect.width) * rect.height;
+    _cell = std::max(1, int(kCellRects * std::sqrt(area / _rects.size())));
+    _columns = (size.width() + _cell - 1) / _cell;
+    _rows = (size.height() + _cell - 1) / _cell;
+    _grid.assign(size_t(_columns) * _rows, std::vector<int>());
+    for (int n = 0; n < int(_rects.size()); ++n)
+        _insert(n);
+
+    _gravity();
+    for (int pull = 0; pull < kMaxEdgePulls; ++pull) {
+        const bool right = _pullEdge(true);
+        const bool bottom = _pullEdge(false);
+        if (!right && !bottom)
+            break;
+        _gravity();
+    }
+    return _size();
+}
+
+auto LayoutCompactor::_cellRange(const rbp::Rect& rect, int& column0, int& row0, int& column1, int& row1) const->void {
+    column0 = std::min(_columns - 1, rect.x / _cell);
+    row0 = std::min(_rows - 1, rect.y / _cell);
+    column1 = std::min(_columns - 1, (rect.x + rect.width - 1) / _cell);
+    row1 = std::min(_rows - 1, (rect.y + rect.height - 1) / _cell);
+}
+
+auto LayoutCompactor::_insert(int index)->void {
+    int column0, row0, column1, row1;
+    _cellRange(_rects[index], column0, row0, column1, row1);
+    for (int row = row0; row <= row1; ++row) {
+        for (int column = column0; column <= column1; ++column)
+            _grid[row * _columns + column].push_back(index);
+    }
+}
+
+auto LayoutCompactor::_erase(int index)->void {
+    int column0, row0, column1, row1;
+    _cellRange(_rects[index], column0, row0, column1, row1);
+    for (int row = row0; row <= row1; ++row) {
+        for (int column = column0; column <= column1; ++column) {
+            auto& bucket = _grid[row * _columns + column];
+            bucket.erase(std::find(bucket.begin(), bucket.end(), index));
+        }
+    }
+}
+
+auto LayoutCompactor::_overlaps(const rbp::Rect& rect) const->bool {
+    int column0, row0, column1, row1;
+    _cellRange(rect, column0, row0, column1, row1);
+    for (int row = row0; row <= row1; ++row) {
+        for (int column = column0; column <= column1; ++column) {
+            for (auto other : _grid[row * _columns + column]) {
+                if (intersects(rect, _rects[other]))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Moves a rectangle left (or up) against the nearest rectangle in its way. The
+// buckets are scanned outwards from it and the scan stops at the first bucket
+// column (or row) that the nearest edge found so far reaches, since everything
+// further away ends before that bucket.
+auto LayoutCompactor::_slide(int index, bool left)->bool {
+    auto rect = _rects[index];
+    const int position = left ? rect.x : rect.y;
+    if (position == 0)
+        return false;
+
+    int column0, row0, column1, row1;
+    _cellRange(rect, column0, row0, column1, row1);
+    const int across0 = left ? row0 : column0;
+    const int across1 = left ? row1 : column1;
+
+    int stop = 0;
+    for (int along = (position - 1) / _cell; along >= 0; --along) {
+        for (int across = across0; across <= across1; ++across) {
+            const auto& bucket = left ? _grid[across * _columns + along] : _grid[along * _columns + across];
+            for (auto other : bucket) {
+                const auto& o = _rects[other];
+                if (left && o.x + o.width <= rect.x && o.y < rect.y + rect.height && rect.y < o.y + o.height)
+                    stop = std::max(stop, o.x + o.width);
+                if (!left && o.y + o.height <= rect.y && o.x < rect.x + rect.width && rect.x < o.x + o.width)
+                    stop = std::max(stop, o.y + o.height);
+            }
+        }
+        if (stop >= along * _cell)
+            break;
+    }
+    if (stop == position)
+        return false;
+
+    _erase(index);
+    (left ? _rects[index].x : _rects[index].y) = stop;
+    _insert(index);
+    return true;
+}
+
+auto LayoutCompactor::_gravity()->void {
+    std::vector<int> order(_rects.size());
+    std::iota(order.begin(), order.end(), 0);
+    for (int pass = 0; pass < kMaxGravityPasses; ++pass) {
+        // the ones nearest the corner settle first and make room for the others
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return _rects[a].x + _rects[a].y < _rects[b].x + _rects[b].y;
+        });
+        bool moved = false;
+        for (auto index : order) {
+            moved = _slide(index, true) || moved;
+            moved = _slide(index, false) || moved;
+        }
+        if (!moved)
+            break;
+    }
+}
+
+// Moves every rectangle touching the right (or bottom) edge inside the edge of
+// the others, or none of them.
+auto LayoutCompactor::_pullEdge(bool right)->bool {
+    const QSize size = _size();
+    const int edge = right ? size.width() : size.height();
+    std::vector<int> outliers;
+    int inner = 0;
+    for (int n = 0; n < int(_rects.size()); ++n) {
+        const auto& rect = _rects[n];
+        const int end = right ? rect.x + rect.width : rect.y + rect.height;
+        if (end == edge)
+            outliers.push_back(n);
+        else
+            inner = std::max(inner, end);
+    }
+    if (inner == 0)
+        return false;
+
+    std::sort(outliers.begin(), outliers.end(), [this](int a, int b) {
+        return qint64(_rects[a].width) * _rects[a].height > qint64(_rects[b].width) * _rects[b].height;
+    });
+    std::vector<rbp::Rect> before;
+    std::vector<bool> flippedBefore;
+    for (auto index : outliers) {
+        before.push_back(_rects[index]);
+        flippedBefore.push_back(_flipped[index]);
+        _erase(index);
+    }
+
+    // candidate positions: the origin and the top right and bottom left corners
+    // of the others, lowest then leftmost first
+    const QSize bounds = right ? QSize(inner, size.height()) : QSize(size.width(), inner);
+    std::vector<std::pair<int, int>> corners(1, std::make_pair(0, 0));
+    for (const auto& rect : _rects) {
+        if (rect.y < bounds.height() && rect.x + rect.width < bounds.width())
+            corners.push_back(std::make_pair(rect.y, rect.x + rect.width));
+        if (rect.y + rect.height < bounds.height() && rect.x < bounds.width())
+            corners.push_back(std::make_pair(rect.y + rect.height, rect.x));
+    }
+    std::sort(corners.begin(), corners.end());
+    corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+
+    size_t placed = 0;
+    while (placed < outliers.size() && _findSpot(outliers[placed], bounds, corners))
+        _insert(outliers[placed++]);
+    if (placed == outliers.size())
+        return true;
+
+    for (size_t n = 0; n < placed; ++n)
+        _erase(outliers[n]);
+    for (size_t n = 0; n < outliers.size(); ++n) {
+        _rects[outliers[n]] = before[n];
+        _flipped[outliers[n]] = flippedBefore[n];
+        _insert(outliers[n]);
+    }
+    return false;
+}
+
+// The first of the (y, x) sorted corners where the rectangle fits within
+// bounds, in either orientation when allowed. Corners that another rectangle
+// covers stay covered, so they are dropped for the following calls.
+auto LayoutCompactor::_findSpot(int index, const QSize& bounds, std::vector<std::pair<int, int>>& corners)->bool {
+    const auto original = _rects[index];
+    const int orientations = _allowFlip && original.width != original.height ? 2 : 1;
+    size_t kept = 0;
+    for (size_t n = 0; n < corners.size(); ++n) {
+        const auto corner = corners[n];
+        const rbp::Rect point = { corner.second, corner.first, 1, 1 };
+        if (_overlaps(point))
+            continue;
+        corners[kept++] = corner;
+
+        for (int flip = 0; flip < orientations; ++flip) {
+            const int width = flip ? original.height : original.width;
+            const int height = flip ? original.width : original.height;
+            const rbp::Rect candidate = { corner.second, corner.first, width, height };
+            if (candidate.x + width > bounds.width() || candidate.y + height > bounds.height() || _overlaps(candidate))
+                continue;
+
+            _flipped[index] = _flipped[index] != (flip == 1);
+            _rects[index] = candidate;
+            corners.erase(std::copy(corners.begin() + n + 1, corners.end(), corners.begin() + kept), corners.end());
+            return true;
+        }
+    }
+    corners.resize(kept);
+    return false;
+}
+
+auto LayoutCompactor::_size() const->QSize {
+    int width = 0;
+    int height = 0;
+    for (const auto& rect : _rects) {
+        width = std::max(width, rect.x + rect.width);
+        height = std::max(height, rect.y + rect.height);
+    }
+    return QSize(width, height);
+}
@@ -0,0 +1,65 @@
+/* LayoutCompactor.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#ifndef LAYOUTCOMPACTOR_H
+#define LAYOUTCOMPACTOR_H
+
+#include "binPack/Rect.h"
+
+#include <QSize>
+#include <utility>
+#include <vector>
+
+// Shrinks a packed layout. Every rectangle slides left and up as far as it can
+// without overlapping another, then the rectangles along the right or bottom
+// edge move into gaps inside the rest whenever all of them fit there, which
+// pulls that edge in, and the rectangles slide again. Overlaps are found with a
+// uniform grid of buckets, so a slide or a test only looks at its neighbours.
+class LayoutCompactor {
+public:
+    // rects are disjoint, with the sides of rotated ones already swapped. Sides
+    // and positions sharing a common alignment keep it.
+    LayoutCompactor(const std::vector<rbp::Rect>& rects, bool allowFlip);
+
+    // The size of the compacted layout, which is never larger than before.
+    auto compact()->QSize;
+
+    auto rects() const->const std::vector<rbp::Rect>& { return _rects; }
+    // Rectangles whose sides compact() swapped.
+    auto flipped() const->const std::vector<bool>& { return _flipped; }
+
+protected:
+    auto _cellRange(const rbp::Rect& rect, int& column0, int& row0, int& column1, int& row1) const->void;
+    auto _insert(int index)->void;
+    auto _erase(int index)->void;
+    auto _overlaps(const rbp::Rect& rect) const->bool;
+    auto _slide(int index, bool left)->bool;
+    auto _gravity()->void;
+    auto _pullEdge(bool right)->bool;
+    auto _findSpot(int index, const QSize& bounds, std::vector<std::pair<int, int>>& corners)->bool;
+    auto _size() const->QSize;
+
+    std::vector<rbp::Rect>          _rects;
+    std::vector<bool>               _flipped;
+    bool                            _allowFlip;
+    int                             _cell;
+    int                             _columns;
+    int                             _rows;
+    std::vector<std::vector<int>>   _grid;
+};
+
+#endif // LAYOUTCOMPACTOR_H
@@ -0,0 +1,127 @@
+/* OutputFile.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#include "OutputFile.h"
+
+#include <QtConcurrent>
+
+#include <algorithm>
+
+// Small writes (png rows, plist lines) are merged into chunks of about this size.
+const qint64 kChunkSize = 1 << 20;
+
+OutputFile::OutputFile(const QString& path, qint64 writeBuffer)
+: _file(path)
+, _writeBuffer(writeBuffer) {
+}
+
+OutputFile::~OutputFile() {
+    // the writer thread stops before the file it writes to goes away
+    _buffer.reset();
+}
+
+auto OutputFile::open(QIODevice::OpenMode mode)->bool {
+    if (_writeBuffer <= 0)
+        return _file.open(mode);
+
+    // text mode line endings are converted once, by the outer device
+    if (!_file.open(QIODevice::WriteOnly))
+        return false;
+    _buffer.reset(new _WriteBehind(&_file, _writeBuffer));
+    return _buffer->open(mode | QIODevice::Unbuffered);
+}
+
+auto OutputFile::device()->QIODevice* {
+    return _buffer ? static_cast<QIODevice*>(_buffer.get()) : &_file;
+}
+
+auto OutputFile::commit()->bool {
+    if (_buffer && !_buffer->finish()) {
+        _file.cancelWriting();
+        return false;
+    }
+    return _file.commit();
+}
+
+OutputFile::_WriteBehind::_WriteBehind(QIODevice* target, qint64 capacity)
+: _target(target)
+, _capacity(std::max(capacity, kChunkSize))
+, _queued(0)
+, _finishing(false)
+, _failed(false) {
+    _pool.setMaxThreadCount(1);
+    _writer = QtConcurrent::run(&_pool, [this]() { _drain(); });
+}
+
+OutputFile::_WriteBehind::~_WriteBehind() {
+    finish();
+}
+
+auto OutputFile::_WriteBehind::finish()->bool {
+    {
+        QMutexLocker lock(&_mutex);
+        _finishing = true;
+        _changed.wakeAll();
+    }
+    _writer.waitForFinished();
+    return !_failed;
+}
+
+qint64 OutputFile::_WriteBehind::readData(char*, qint64) {
+    return -1;
+}
+
+qint64 OutputFile::_WriteBehind::writeData(const char* data, qint64 size) {
+    QMutexLocker lock(&_mutex);
+    while (!_failed && _queued > 0 && _queued + size > _capacity)
+        _changed.wait(&_mutex);
+    if (_failed || _finishing)
+        return -1;
+
+    // the writer has taken the chunks it works on out of the queue, so the last one can grow
+    if (_chunks.empty() || _chunks.back().size() + size > kChunkSize)
+        _chunks.push_back(QByteArray());
+    _chunks.back().append(data, int(size));
+    _queued += size;
+    _changed.wakeAll();
+    return size;
+}
+
+auto OutputFile::_WriteBehind::_drain()->void {
+    QMutexLocker lock(&_mutex);
+    for (;;) {
+        while (_chunks.empty() && !_finishing)
+            _changed.wait(&_mutex);
+        if (_chunks.empty())
+            return;
+
+        const QByteArray chunk = _chunks.front();
+        _chunks.pop_front();
+        lock.unlock();
+        const bool written = _target->write(chunk) == chunk.size();
+        lock.relock();
+
+        _queued -= chunk.size();
+        _failed = _failed || !written;
+        _changed.wakeAll();
+        if (_failed) {
+            _chunks.clear();
+            _queued = 0;
+            return;
+        }
+    }
+}
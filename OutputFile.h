@@ -0,0 +1,80 @@
+/* OutputFile.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <QFuture>
+#include <QIODevice>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <deque>
+#include <memory>
+
+// An output written to a temporary file next to its path and renamed over it
+// by commit(), so readers never see a partial file and a failed build leaves
+// the previous one in place. With a write buffer the bytes are queued and a
+// thread of its own writes them out in large chunks, so the encoder doesn't
+// wait on slow (network) storage; writes block only once the queue is full.
+class OutputFile {
+public:
+    OutputFile(const QString& path, qint64 writeBuffer = 0);
+    ~OutputFile();
+
+    auto open(QIODevice::OpenMode mode = QIODevice::WriteOnly)->bool;
+    // Where to write, once open.
+    auto device()->QIODevice*;
+    // Waits for the queued bytes and renames the file into place. Without a
+    // commit the temporary file is removed.
+    auto commit()->bool;
+
+protected:
+    // Sequential device queuing what is written to it for a writer thread.
+    class _WriteBehind : public QIODevice {
+    public:
+        _WriteBehind(QIODevice* target, qint64 capacity);
+        ~_WriteBehind();
+
+        bool isSequential() const { return true; }
+        // Waits until the queue is written out, false when the target failed.
+        auto finish()->bool;
+
+    protected:
+        qint64 readData(char* data, qint64 maxSize);
+        qint64 writeData(const char* data, qint64 size);
+        auto _drain()->void;
+
+        QIODevice*              _target;
+        qint64                  _capacity;
+        std::deque<QByteArray>  _chunks;
+        qint64                  _queued;
+        bool                    _finishing;
+        bool                    _failed;
+        QMutex                  _mutex;
+        QWaitCondition          _changed;
+        QThreadPool             _pool;
+        QFuture<void>           _writer;
+    };
+
+    QSaveFile                       _file;
+    qint64                          _writeBuffer;
+    std::unique_ptr<_WriteBehind>   _buffer;
+};
+
+#endif // OUTPUTFILE_H
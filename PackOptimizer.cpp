@@ -0,0 +1,157 @@
+/* PackOptimizer.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "PackOptimizer.h"
+#include "binPack/MaxRectsBinPack.h"
+
+#include <QDateTime>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <cmath>
+#include <random>
+
+namespace {
+
+// On every target the temperature starts at this share of the average rectangle
+// area, so a move that leaves about one more rectangle out is still taken fairly
+// often, and cools geometrically to kCooling of that over kMovesPerTarget moves.
+const double kStartTemperature = 0.5;
+const double kCooling = 0.001;
+const int kMovesPerTarget = 20000;
+
+}
+
+PackOptimizer::PackOptimizer(const std::vector<QSize>& sizes, const std::vector<int>& order, const std::vector<bool>& rotated, int alignment)
+: _sizes(sizes)
+, _alignment(alignment)
+, _solved(-1) {
+    _start.order = order;
+    _start.rotated = rotated;
+}
+
+auto PackOptimizer::optimize(const std::vector<QSize>& targets, double seconds, int threads)->Result {
+    if (targets.empty() || _sizes.empty())
+        return Result();
+
+    _solved = -1;
+    _best = _start;
+    _result = Result();
+
+    // a pool of its own: the variants calling this already run on the global one
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(1, threads));
+    const qint64 deadline = QDateTime::currentMSecsSinceEpoch() + qint64(seconds * 1000.0);
+    std::vector<QFuture<void>> chains;
+    for (int n = 0; n < pool.maxThreadCount(); ++n) {
+        chains.push_back(QtConcurrent::run(&pool, [this, &targets, deadline, n]() {
+            _run(targets, deadline, quint32(n) * 2654435761u + 1u);
+        }));
+    }
+    for (auto& chain : chains)
+        chain.waitForFinished();
+    return _result;
+}
+
+auto PackOptimizer::_run(const std::vector<QSize>& targets, qint64 deadline, quint32 seed)->void {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    double averageArea = 0.0;
+    for (const auto& size : _sizes)
+        averageArea += double(size.width()) * size.height();
+    averageArea /= _sizes.size();
+
+    int target = -1;
+    _State state;
+    qint64 cost = 0;
+    int moves = 0;
+    while (QDateTime::currentMSecsSinceEpoch() < deadline) {
+        const int solved = _solved;
+        if (target <= solved) {
+            target = solved + 1;
+            if (target >= int(targets.size()))
+                return;
+            QMutexLocker lock(&_mutex);
+            state = _best;
+            lock.unlock();
+            cost = _pack(state, targets[target], nullptr);
+            moves = 0;
+        }
+
+        const double temperature = kStartTemperature * averageArea * std::pow(kCooling, std::min(1.0, double(moves++) / kMovesPerTarget));
+        _State candidate = state;
+        _mutate(candidate, random());
+        const qint64 candidateCost = _pack(candidate, targets[target], nullptr);
+        if (candidateCost <= cost || uniform(random) < std::exp((cost - candidateCost) / temperature)) {
+            state.order.swap(candidate.order);
+            state.rotated.swap(candidate.rotated);
+            cost = candidateCost;
+        }
+
+        if (cost == 0) {
+            QMutexLocker lock(&_mutex);
+            if (_solved < target) {
+                _best = state;
+                _result.target = target;
+                _pack(state, targets[target], &_result.rects);
+                _solved = target;
+            }
+        }
+    }
+}
+
+// Area that doesn't fit the target when packed in the order and orientations of the state.
+auto PackOptimizer::_pack(const _State& state, const QSize& target, std::vector<rbp::Rect>* rects) const->qint64 {
+    rbp::MaxRectsBinPack bin(target.width(), target.height(), false);
+    bin.SetAlignment(_alignment);
+    if (rects)
+        rects->assign(_sizes.size(), rbp::Rect());
+
+    qint64 unplaced = 0;
+    for (auto index : state.order) {
+        const auto& size = _sizes[index];
+        const int width = state.rotated[index] ? size.height() : size.width();
+        const int height = state.rotated[index] ? size.width() : size.height();
+        const auto rect = bin.Insert(width, height, rbp::MaxRectsBinPack::RectBestLongSideFit);
+        if (rect.height <= 0)
+            unplaced += qint64(width) * height;
+        else if (rects)
+            (*rects)[index] = rect;
+    }
+    return unplaced;
+}
+
+// Swaps two rectangles in the order, moves one elsewhere, or turns one.
+auto PackOptimizer::_mutate(_State& state, quint32 random) const->void {
+    const int count = int(state.order.size());
+    const int a = int((random >> 2) % count);
+    const int b = int((random >> 16) % count);
+    switch (random & 3) {
+    case 0:
+        std::swap(state.order[a], state.order[b]);
+        break;
+    case 1: {
+        const int moved = state.order[a];
+        state.order.erase(state.order.begin() + a);
+        state.order.insert(state.order.begin() + b, moved);
+        break;
+    }
+    default:
+        state.rotated[state.order[a]] = !state.rotated[state.order[a]];
+        break;
+    }
+}
@@ -0,0 +1,70 @@
+/* PackOptimizer.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#ifndef PACKOPTIMIZER_H
+#define PACKOPTIMIZER_H
+
+#include "binPack/Rect.h"
+
+#include <QMutex>
+#include <QSize>
+#include <atomic>
+#include <vector>
+
+// Searches insertion order and per-rectangle rotation for a packing into a
+// smaller bin than the greedy pass managed. Every thread runs its own simulated
+// annealing chain over (order, rotation) on top of MaxRectsBinPack, minimizing
+// the area left unplaced in the current target bin. Whenever a chain places
+// everything, all chains move on to the next, smaller target starting from that
+// solution. The search stops when the time is up or the targets run out.
+class PackOptimizer {
+public:
+    struct Result {
+        Result() : target(-1) {}
+        int                     target;     // index of the smallest target solved, -1 for none
+        std::vector<rbp::Rect>  rects;      // per size, width and height swapped when rotated
+    };
+
+    // The chains start from the greedy insertion order and the orientations the
+    // greedy pass picked, which reproduce its layout. alignment is handed to
+    // MaxRectsBinPack::SetAlignment.
+    PackOptimizer(const std::vector<QSize>& sizes, const std::vector<int>& order, const std::vector<bool>& rotated, int alignment = 1);
+
+    // targets are tried in order, each should be smaller than the one before.
+    auto optimize(const std::vector<QSize>& targets, double seconds, int threads)->Result;
+
+protected:
+    struct _State {
+        std::vector<int>    order;
+        std::vector<bool>   rotated;
+    };
+
+    auto _run(const std::vector<QSize>& targets, qint64 deadline, quint32 seed)->void;
+    auto _pack(const _State& state, const QSize& target, std::vector<rbp::Rect>* rects) const->qint64;
+    auto _mutate(_State& state, quint32 random) const->void;
+
+    std::vector<QSize>  _sizes;
+    int                 _alignment;
+    _State              _start;
+
+    QMutex              _mutex;
+    std::atomic<int>    _solved;
+    _State              _best;
+    Result              _result;
+};
+
+#endif // PACKOPTIMIZER_H
@@ -0,0 +1,180 @@
+/* ScenePartitioner.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#include "ScenePartitioner.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <numeric>
+
+const int kMaxRefinePasses = 16;
+
+auto ScenePartitioner::readManifest(const QString& path, std::vector<Scene>& scenes, QString& error)->bool {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = file.errorString();
+        return false;
+    }
+
+    QJsonParseError parseError;
+    const auto document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (document.isNull()) {
+        error = parseError.errorString();
+        return false;
+    }
+
+    scenes.clear();
+    for (const auto& value : document.object()["scenes"].toArray()) {
+        const auto object = value.toObject();
+        Scene scene;
+        scene.name = object["name"].toString();
+        scene.weight = object["weight"].toDouble(1.0);
+        for (const auto& sprite : object["sprites"].toArray())
+            scene.sprites << sprite.toString();
+        if (scene.name.isEmpty() || scene.weight <= 0.0 || scene.sprites.isEmpty()) {
+            error = QString("scene %1 needs a name, a positive weight and sprites").arg(scenes.size());
+            return false;
+        }
+        scenes.push_back(scene);
+    }
+    if (scenes.empty()) {
+        error = "no scenes";
+        return false;
+    }
+    return true;
+}
+
+ScenePartitioner::ScenePartitioner(const std::vector<qint64>& areas, const std::vector<std::vector<int>>& scenes, const std::vector<double>& weights)
+: _areas(areas)
+, _scenes(scenes)
+, _weights(weights) {
+}
+
+auto ScenePartitioner::partition(qint64 capacity) const->std::vector<int> {
+    std::vector<double> sceneWeight(_areas.size(), 0.0);
+    for (size_t n = 0; n < _areas.size(); ++n) {
+        for (auto scene : _scenes[n])
+            sceneWeight[n] += _weights[scene];
+    }
+
+    // sprites of the same scenes next to each other, the heaviest scenes and largest sprites first
+    std::vector<size_t> order(_areas.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (sceneWeight[a] != sceneWeight[b])
+            return sceneWeight[a] > sceneWeight[b];
+        if (_scenes[a] != _scenes[b])
+            return _scenes[a] < _scenes[b];
+        return _areas[a] > _areas[b];
+    });
+
+    std::vector<int> result(_areas.size(), -1);
+    std::vector<qint64> free;
+    std::vector<std::vector<int>> counts;   // sprites of every scene on every page
+    const auto place = [&](size_t sprite, int page, int step) {
+        result[sprite] = step > 0 ? page : -1;
+        free[page] -= step * _areas[sprite];
+        for (auto scene : _scenes[sprite])
+            counts[page][scene] += step;
+    };
+
+    for (auto sprite : order) {
+        int best = -1;
+        double bestAdded = 0.0;
+        for (int page = 0; page < int(free.size()); ++page) {
+            if (free[page] < _areas[sprite])
+                continue;
+            const double added = _added(counts[page], sprite);
+            if (best < 0 || added < bestAdded || (added == bestAdded && free[page] < free[best])) {
+                best = page;
+                bestAdded = added;
+            }
+        }
+        if (best < 0) {
+            best = int(free.size());
+            free.push_back(capacity);
+            counts.push_back(std::vector<int>(_weights.size(), 0));
+        }
+        place(sprite, best, 1);
+    }
+
+    for (int pass = 0; pass < kMaxRefinePasses; ++pass) {
+        bool improved = false;
+        for (auto sprite : order) {
+            const int from = result[sprite];
+            place(sprite, from, -1);
+            const double saved = _added(counts[from], sprite);
+
+            int best = from;
+            double bestDelta = 0.0;
+            for (int page = 0; page < int(free.size()); ++page) {
+                if (page == from || free[page] < _areas[sprite])
+                    continue;
+                const double delta = _added(counts[page], sprite) - saved;
+                if (delta < bestDelta) {
+                    best = page;
+                    bestDelta = delta;
+                }
+            }
+            place(sprite, best, 1);
+            improved = improved || best != from;
+        }
+        if (!improved)
+            break;
+    }
+
+    // pages emptied by the moves are dropped
+    std::vector<int> renumbered(free.size(), -1);
+    int pages = 0;
+    for (auto& page : result) {
+        if (renumbered[page] < 0)
+            renumbered[page] = pages++;
+        page = renumbered[page];
+    }
+    return result;
+}
+
+auto ScenePartitioner::cost(const std::vector<int>& pages) const->double {
+    std::vector<std::vector<bool>> touched(_weights.size());
+    double result = 0.0;
+    for (size_t n = 0; n < pages.size(); ++n) {
+        for (auto scene : _scenes[n]) {
+            auto& sceneTouched = touched[scene];
+            if (int(sceneTouched.size()) <= pages[n])
+                sceneTouched.resize(pages[n] + 1, false);
+            if (!sceneTouched[pages[n]]) {
+                sceneTouched[pages[n]] = true;
+                result += _weights[scene];
+            }
+        }
+    }
+    return result;
+}
+
+// Weight of the scenes of the sprite that have no sprite on the page yet.
+auto ScenePartitioner::_added(const std::vector<int>& counts, size_t sprite) const->double {
+    double result = 0.0;
+    for (auto scene : _scenes[sprite]) {
+        if (counts[scene] == 0)
+            result += _weights[scene];
+    }
+    return result;
+}
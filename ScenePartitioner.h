@@ -0,0 +1,61 @@
+/* ScenePartitioner.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+
+#ifndef SCENEPARTITIONER_H
+#define SCENEPARTITIONER_H
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+// Splits sprites into pages of a given capacity so that the scenes bind as few
+// pages as they can, counting every page a scene touches once per its weight.
+// Sprites sharing the heaviest scenes are placed first, each on the page where
+// it adds the least weight of newly touched scenes (the fullest one on ties),
+// then single sprites move between pages while that lowers the cost.
+class ScenePartitioner {
+public:
+    struct Scene {
+        Scene() : weight(1.0) {}
+        QString     name;
+        double      weight;     // how often the scene is shown
+        QStringList sprites;    // frame names or globs, matched like --include patterns
+    };
+
+    // A json file { "scenes": [ { "name": "menu", "weight": 10, "sprites": [ "ui/*" ] } ] }.
+    static auto readManifest(const QString& path, std::vector<Scene>& scenes, QString& error)->bool;
+
+    // areas[n] is the bin area sprite n takes, scenes[n] the indices of the scenes
+    // using it and weights[s] the weight of scene s.
+    ScenePartitioner(const std::vector<qint64>& areas, const std::vector<std::vector<int>>& scenes, const std::vector<double>& weights);
+
+    // The page of every sprite, pages numbered from 0. No page holds more than
+    // capacity unless a single sprite is larger, which gets a page of its own.
+    auto partition(qint64 capacity) const->std::vector<int>;
+
+    // Sum over the scenes of the weight times the pages the scene touches.
+    auto cost(const std::vector<int>& pages) const->double;
+
+protected:
+    auto _added(const std::vector<int>& counts, size_t sprite) const->double;
+
+    std::vector<qint64>             _areas;
+    std::vector<std::vector<int>>   _scenes;
+    std::vector<double>             _weights;
+};
+
+#endif // SCENEPARTITIONER_H
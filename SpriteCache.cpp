@@ -0,0 +1,168 @@
+/* SpriteCache.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "SpriteCache.h"
+
+#include <algorithm>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+SpriteCache::SpriteCache(qint64 budget)
+: _budget(budget)
+, _resident(0)
+, _peak(0)
+, _spilled(0)
+, _nextKey(0) {
+}
+
+auto SpriteCache::insert(const QImage& image)->QString {
+    QMutexLocker lock(&_mutex);
+    const QString key = QString("sprite:%1").arg(_nextKey++);
+
+    _Entry& entry = _entries[key];
+    entry.size = image.size();
+    entry.format = image.format();
+    entry.colorTable = image.colorTable();
+    entry.bytes = qint64(image.bytesPerLine()) * image.height();
+    entry.image = image;
+    _makeResident(entry, key);
+    _evict();
+    return key;
+}
+
+auto SpriteCache::image(const QString& key)->QImage {
+    QMutexLocker lock(&_mutex);
+    const auto it = _entries.find(key);
+    if (it == _entries.end())
+        return QImage();
+
+    _Entry& entry = it->second;
+    if (entry.resident) {
+        _recent.splice(_recent.begin(), _recent, entry.recent);
+    } else {
+        entry.image = _load(entry);
+        if (entry.image.isNull())
+            return QImage();
+        _makeResident(entry, key);
+    }
+
+    // the caller's copy shares the pixels, so evicting this entry won't free them under it
+    const QImage result = entry.image;
+    _evict();
+    return result;
+}
+
+auto SpriteCache::remove(const QString& key)->void {
+    QMutexLocker lock(&_mutex);
+    const auto it = _entries.find(key);
+    if (it == _entries.end())
+        return;
+
+    if (it->second.resident) {
+        _resident -= it->second.bytes;
+        _recent.erase(it->second.recent);
+    }
+    _entries.erase(it);
+}
+
+auto SpriteCache::peakResidentBytes() const->qint64 {
+    QMutexLocker lock(&_mutex);
+    return _peak;
+}
+
+auto SpriteCache::spilledBytes() const->qint64 {
+    QMutexLocker lock(&_mutex);
+    return _spilled;
+}
+
+auto SpriteCache::processPeakBytes()->qint64 {
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return qint64(counters.PeakWorkingSetSize);
+    return 0;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(Q_OS_MAC)
+    return qint64(usage.ru_maxrss);
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+auto SpriteCache::_makeResident(_Entry& entry, const QString& key)->void {
+    entry.resident = true;
+    entry.recent = _recent.insert(_recent.begin(), key);
+    _resident += entry.bytes;
+    _peak = std::max(_peak, _resident);
+}
+
+auto SpriteCache::_evict()->void {
+    // the most recently used sprite always stays, even if it alone is over budget
+    while (_budget > 0 && _resident > _budget && _recent.size() > 1) {
+        _Entry& entry = _entries[_recent.back()];
+        if (entry.offset < 0 && !_spill(entry))
+            return;
+
+        _recent.pop_back();
+        _resident -= entry.bytes;
+        entry.resident = false;
+        entry.image = QImage();
+    }
+}
+
+// Sprites never change once inserted, so each one is written at most once.
+auto SpriteCache::_spill(_Entry& entry)->bool {
+    if (!_scratch.isOpen() && !_scratch.open())
+        return false;
+
+    const qint64 offset = _scratch.size();
+    if (!_scratch.seek(offset))
+        return false;
+    for (int y = 0; y < entry.image.height(); ++y) {
+        const auto line = reinterpret_cast<const char*>(entry.image.constScanLine(y));
+        if (_scratch.write(line, entry.image.bytesPerLine()) != entry.image.bytesPerLine())
+            return false;
+    }
+
+    entry.offset = offset;
+    _spilled += entry.bytes;
+    return true;
+}
+
+auto SpriteCache::_load(const _Entry& entry)->QImage {
+    QImage image(entry.size, entry.format);
+    if (image.isNull() || !_scratch.seek(entry.offset))
+        return QImage();
+    image.setColorTable(entry.colorTable);
+
+    for (int y = 0; y < image.height(); ++y) {
+        auto line = reinterpret_cast<char*>(image.scanLine(y));
+        if (_scratch.read(line, image.bytesPerLine()) != image.bytesPerLine())
+            return QImage();
+    }
+    return image;
+}
@@ -0,0 +1,74 @@
+/* SpriteCache.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef SPRITECACHE_H
+#define SPRITECACHE_H
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QTemporaryFile>
+#include <list>
+#include <map>
+
+// Holds the processed sprite pixels of a run within a memory budget. When the
+// resident pixels exceed it, the least recently used sprites are written once,
+// uncompressed, to a scratch file and read back from there when asked for again.
+// A budget of 0 keeps everything in memory. Safe to use from several threads.
+class SpriteCache {
+public:
+    SpriteCache(qint64 budget);
+
+    auto insert(const QImage& image)->QString;
+    auto image(const QString& key)->QImage;
+    auto remove(const QString& key)->void;
+
+    auto peakResidentBytes() const->qint64;
+    auto spilledBytes() const->qint64;
+
+    // Peak resident set size of the whole process, 0 where it can't be queried.
+    static auto processPeakBytes()->qint64;
+
+protected:
+    struct _Entry {
+        _Entry() : offset(-1), resident(false) {}
+        QImage                          image;
+        QSize                           size;
+        QImage::Format                  format;
+        QVector<QRgb>                   colorTable;
+        qint64                          bytes;
+        qint64                          offset;
+        bool                            resident;
+        std::list<QString>::iterator    recent;
+    };
+
+    auto _makeResident(_Entry& entry, const QString& key)->void;
+    auto _evict()->void;
+    auto _spill(_Entry& entry)->bool;
+    auto _load(const _Entry& entry)->QImage;
+
+    qint64                      _budget;
+    qint64                      _resident;
+    qint64                      _peak;
+    qint64                      _spilled;
+    quint64                     _nextKey;
+    std::map<QString, _Entry>   _entries;
+    std::list<QString>          _recent;        // most recently used first
+    QTemporaryFile              _scratch;
+    mutable QMutex              _mutex;
+};
+
+#endif // SPRITECACHE_H
@@ -0,0 +1,144 @@
+/* Trace.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "Trace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+
+#include <map>
+#include <vector>
+
+std::atomic<bool> Trace::_enabled(false);
+
+namespace {
+
+struct Event {
+    const char* name;
+    qint64      begin;
+    qint64      end;
+    int         thread;
+    QVariantMap args;
+};
+
+struct State {
+    QString                 path;
+    QElapsedTimer           clock;
+    QMutex                  mutex;
+    std::vector<Event>      events;
+    std::map<Qt::HANDLE, int> threads;
+    std::vector<QString>    threadNames;
+};
+
+State& state() {
+    static State instance;
+    return instance;
+}
+
+}
+
+auto Trace::start(const QString& path)->void {
+    auto& trace = state();
+    QMutexLocker lock(&trace.mutex);
+    trace.path = path;
+    trace.events.clear();
+    trace.threads.clear();
+    trace.threadNames.clear();
+    trace.clock.start();
+    _enabled.store(true, std::memory_order_relaxed);
+}
+
+auto Trace::finish()->bool {
+    if (!isEnabled())
+        return true;
+    _enabled.store(false, std::memory_order_relaxed);
+
+    auto& trace = state();
+    QMutexLocker lock(&trace.mutex);
+
+    QJsonArray events;
+    for (size_t n = 0; n < trace.threadNames.size(); ++n) {
+        QJsonObject args;
+        args["name"] = trace.threadNames[n];
+        QJsonObject metadata;
+        metadata["name"] = "thread_name";
+        metadata["ph"] = "M";
+        metadata["pid"] = 1;
+        metadata["tid"] = int(n);
+        metadata["args"] = args;
+        events.append(metadata);
+    }
+
+    // complete events, timestamps and durations in microseconds
+    for (const auto& event : trace.events) {
+        QJsonObject object;
+        object["name"] = event.name;
+        object["cat"] = "spriteglue";
+        object["ph"] = "X";
+        object["pid"] = 1;
+        object["tid"] = event.thread;
+        object["ts"] = event.begin / 1000.0;
+        object["dur"] = (event.end - event.begin) / 1000.0;
+        if (!event.args.isEmpty())
+            object["args"] = QJsonObject::fromVariantMap(event.args);
+        events.append(object);
+    }
+    trace.events.clear();
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    QFile file(trace.path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    const auto json = QJsonDocument(root).toJson(QJsonDocument::Compact);
+    return file.write(json) == json.size();
+}
+
+auto Trace::_now()->qint64 {
+    return state().clock.nsecsElapsed();
+}
+
+auto Trace::_record(const char* name, qint64 begin, qint64 end, const QVariantMap& args)->void {
+    auto& trace = state();
+    QMutexLocker lock(&trace.mutex);
+    if (!isEnabled())
+        return;
+
+    const auto id = QThread::currentThreadId();
+    auto threadIt = trace.threads.find(id);
+    if (threadIt == trace.threads.end()) {
+        const bool main = QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread();
+        const int index = int(trace.threadNames.size());
+        trace.threadNames.push_back(main ? QString("main") : QString("worker %1").arg(index));
+        threadIt = trace.threads.insert(std::make_pair(id, index)).first;
+    }
+
+    Event event;
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    event.thread = threadIt->second;
+    event.args = args;
+    trace.events.push_back(event);
+}
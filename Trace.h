@@ -0,0 +1,72 @@
+/* Trace.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QVariantMap>
+#include <atomic>
+
+// Collects timed spans and writes them in the Chrome trace event format, which
+// chrome://tracing and ui.perfetto.dev open directly. Every thread gets its own
+// track. While no trace is started a span costs one relaxed atomic load.
+class Trace {
+public:
+    class Scope {
+    public:
+        explicit Scope(const char* name)
+        : _name(isEnabled() ? name : nullptr)
+        , _begin(_name ? _now() : 0) {}
+        ~Scope() { end(); }
+
+        // Closes the span before the end of the enclosing block.
+        auto end()->void {
+            if (_name)
+                _record(_name, _begin, _now(), _args);
+            _name = nullptr;
+        }
+
+        auto arg(const char* key, const QVariant& value)->void {
+            if (_name)
+                _args[key] = value;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* _name;
+        qint64      _begin;
+        QVariantMap _args;
+    };
+
+    static auto start(const QString& path)->void;
+    static auto finish()->bool;
+    static auto isEnabled()->bool { return _enabled.load(std::memory_order_relaxed); }
+
+protected:
+    static auto _now()->qint64;
+    static auto _record(const char* name, qint64 begin, qint64 end, const QVariantMap& args)->void;
+
+    static std::atomic<bool> _enabled;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(_traceScope, __LINE__)(name)
+
+#endif // TRACE_H
@@ -0,0 +1,94 @@
+/* TrimCache.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "TrimCache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSaveFile>
+
+const quint32 kTrimCacheMagic = 0x53475443; // "SGTC"
+const quint32 kTrimCacheVersion = 1;
+
+TrimCache::TrimCache(const QString& path)
+: _path(path)
+, _changed(false) {
+}
+
+auto TrimCache::load()->bool {
+    QFile file(_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != kTrimCacheMagic || version != kTrimCacheVersion)
+        return false;
+
+    for (quint32 n = 0; n < count && in.status() == QDataStream::Ok; ++n) {
+        QString key;
+        _Record record;
+        in >> key >> record.modified >> record.size >> record.entry.beforeCropSize >> record.entry.cropRect >> record.entry.hash;
+        _records[key] = record;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+auto TrimCache::save() const->bool {
+    if (!_changed)
+        return true;
+
+    QSaveFile file(_path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out << kTrimCacheMagic << kTrimCacheVersion << quint32(_records.size());
+    for (const auto& record : _records) {
+        out << record.first << record.second.modified << record.second.size
+            << record.second.entry.beforeCropSize << record.second.entry.cropRect << record.second.entry.hash;
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+auto TrimCache::find(const QString& file, const QString& settings, Entry& entry) const->bool {
+    const auto it = _records.find(_key(file, settings));
+    if (it == _records.end())
+        return false;
+
+    const QFileInfo info(file);
+    if (info.size() != it->second.size || info.lastModified().toMSecsSinceEpoch() != it->second.modified)
+        return false;
+
+    entry = it->second.entry;
+    return true;
+}
+
+auto TrimCache::insert(const QString& file, const QString& settings, const Entry& entry)->void {
+    const QFileInfo info(file);
+    _Record record;
+    record.modified = info.lastModified().toMSecsSinceEpoch();
+    record.size = info.size();
+    record.entry = entry;
+    _records[_key(file, settings)] = record;
+    _changed = true;
+}
+
+auto TrimCache::_key(const QString& file, const QString& settings)->QString {
+    return QFileInfo(file).absoluteFilePath() + '\n' + settings;
+}
@@ -0,0 +1,59 @@
+/* TrimCache.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef TRIMCACHE_H
+#define TRIMCACHE_H
+
+#include <QRect>
+#include <QString>
+#include <map>
+
+// Remembers the trim rectangle and content hash of every source image for a
+// given set of processing settings, so a later run can lay out the atlas from
+// the image headers alone. An entry is only used while the file keeps the
+// size and modification time it had when the entry was written.
+class TrimCache {
+public:
+    struct Entry {
+        Entry() : hash(0) {}
+        QSize   beforeCropSize;
+        QRect   cropRect;
+        quint64 hash;
+    };
+
+    TrimCache(const QString& path);
+
+    auto load()->bool;
+    auto save() const->bool;
+
+    auto find(const QString& file, const QString& settings, Entry& entry) const->bool;
+    auto insert(const QString& file, const QString& settings, const Entry& entry)->void;
+
+protected:
+    struct _Record {
+        qint64  modified;
+        qint64  size;
+        Entry   entry;
+    };
+
+    static auto _key(const QString& file, const QString& settings)->QString;
+
+    QString                     _path;
+    std::map<QString, _Record>  _records;
+    bool                        _changed;
+};
+
+#endif // TRIMCACHE_H
@@ -0,0 +1,122 @@
+/* SpriteSets.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "SpriteSets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+auto SpriteSets::distributions()->std::vector<Distribution> {
+    return { UNIFORM, LONG_TAIL, DUPLICATES, GLYPHS };
+}
+
+auto SpriteSets::name(Distribution distribution)->QString {
+    switch (distribution) {
+    case UNIFORM: return "uniform";
+    case LONG_TAIL: return "long-tail";
+    case DUPLICATES: return "duplicates";
+    case GLYPHS: return "glyphs";
+    }
+    return QString();
+}
+
+auto SpriteSets::fromName(const QString& name, Distribution& distribution)->bool {
+    for (auto candidate : distributions()) {
+        if (SpriteSets::name(candidate) == name) {
+            distribution = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+auto SpriteSets::create(Distribution distribution, int count, quint32 seed)->std::vector<Sprite> {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> uniformSide(16, 256);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> aspect(0.5f, 2.0f);
+    std::uniform_int_distribution<int> glyphWidth(4, 24);
+    std::uniform_int_distribution<int> glyphHeight(6, 32);
+
+    const auto next = [&]()->Sprite {
+        Sprite sprite;
+        sprite.seed = quint32(random());
+        switch (distribution) {
+        case UNIFORM:
+        case DUPLICATES:
+            sprite.size = QSize(uniformSide(random), uniformSide(random));
+            break;
+        case LONG_TAIL: {
+            // Pareto with shape 1.2: half of the sides stay under 14 px, a few reach 1024
+            const int side = std::min(1024, int(8.0f / std::pow(std::max(unit(random), 1e-6f), 1.0f / 1.2f)));
+            sprite.size = QSize(side, std::max(1, std::min(1024, int(side * aspect(random)))));
+            break;
+        }
+        case GLYPHS:
+            sprite.size = QSize(glyphWidth(random), glyphHeight(random));
+            break;
+        }
+        return sprite;
+    };
+
+    std::vector<Sprite> result;
+    result.reserve(count);
+    if (distribution == DUPLICATES) {
+        std::vector<Sprite> unique;
+        for (int n = 0; n < std::max(1, count / 10); ++n)
+            unique.push_back(next());
+        std::uniform_int_distribution<size_t> pick(0, unique.size() - 1);
+        for (int n = 0; n < count; ++n)
+            result.push_back(n < int(unique.size()) ? unique[n] : unique[pick(random)]);
+    } else {
+        for (int n = 0; n < count; ++n)
+            result.push_back(next());
+    }
+    return result;
+}
+
+auto SpriteSets::render(const Sprite& sprite)->QImage {
+    const int width = sprite.size.width();
+    const int height = sprite.size.height();
+    std::mt19937 random(sprite.seed);
+    std::uniform_real_distribution<float> inset(0.0f, 0.25f);
+
+    const float left = inset(random) * width;
+    const float right = width - inset(random) * width;
+    const float top = inset(random) * height;
+    const float bottom = height - inset(random) * height;
+    const float cx = (left + right) / 2.0f;
+    const float cy = (top + bottom) / 2.0f;
+    const float rx = std::max(0.5f, (right - left) / 2.0f);
+    const float ry = std::max(0.5f, (bottom - top) / 2.0f);
+    const int red = random() & 0xff;
+    const int green = random() & 0xff;
+    const int blue = random() & 0xff;
+
+    QImage image(sprite.size, QImage::Format_ARGB32);
+    for (int y = 0; y < height; ++y) {
+        auto line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        const float dy = (y + 0.5f - cy) / ry;
+        for (int x = 0; x < width; ++x) {
+            const float dx = (x + 0.5f - cx) / rx;
+            const float d = dx * dx + dy * dy;
+            const int alpha = d >= 1.0f ? 0 : int(255.0f * std::min(1.0f, (1.0f - d) * 4.0f));
+            line[x] = alpha ? qRgba((red + x) & 0xff, (green + y) & 0xff, blue, alpha) : 0;
+        }
+    }
+    return image;
+}
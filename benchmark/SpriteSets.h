@@ -0,0 +1,51 @@
+/* SpriteSets.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef SPRITESETS_H
+#define SPRITESETS_H
+
+#include <QImage>
+#include <QString>
+#include <vector>
+
+// Deterministic synthetic sprite sets for the benchmark. Only sizes and seeds are
+// kept, pixels are rendered on demand so large sets stay cheap to hold.
+class SpriteSets {
+public:
+    enum Distribution {
+        UNIFORM,        // sides evenly spread over 16..256
+        LONG_TAIL,      // mostly small sprites with a few large ones (Pareto sides)
+        DUPLICATES,     // one sprite in ten is unique, the rest repeat them
+        GLYPHS          // tiny font-like sprites
+    };
+
+    struct Sprite {
+        QSize   size;
+        quint32 seed;
+    };
+
+    static auto distributions()->std::vector<Distribution>;
+    static auto name(Distribution distribution)->QString;
+    static auto fromName(const QString& name, Distribution& distribution)->bool;
+
+    static auto create(Distribution distribution, int count, quint32 seed)->std::vector<Sprite>;
+
+    // An ellipse with a soft edge and a random transparent border, so trimming,
+    // hashing and compression all have real work to do.
+    static auto render(const Sprite& sprite)->QImage;
+};
+
+#endif // SPRITESETS_H
@@ -0,0 +1,13 @@
+TARGET = spriteglue-benchmark
+CONFIG += console
+CONFIG += release
+
+TEMPLATE = app
+
+include(../spriteglue.pri)
+
+SOURCES += main.cpp \
+    SpriteSets.cpp
+
+HEADERS += \
+    SpriteSets.h
@@ -0,0 +1,509 @@
+/* main.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "Generator.h"
+#include "ImageSorter.h"
+#include "SpriteSets.h"
+#include "binPack/MaxRectsBinPack.h"
+#include "imageTools/ImageTrim.h"
+#include "imageTools/imagerotate.h"
+#include "plist/plistserializer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+
+const auto kOutputInfo = "file the results are written to, one json object per line (default: spriteglue-benchmark.jsonl)";
+const auto kBenchmarksInfo = "comma separated benchmarks to run (default: all, available: pack, trim, rotate, dedup, sort, plist, generate)";
+const auto kDistributionsInfo = "comma separated sprite distributions (default: all, available: uniform, long-tail, duplicates, glyphs)";
+const auto kCountsInfo = "comma separated sprite counts (default: 100,1000,10000)";
+const auto kRepeatInfo = "runs per measurement, the median and the minimum are reported (default: 3)";
+const auto kSeedInfo = "seed of the sprite generators (default: 1)";
+const auto kMaxSizeInfo = "max atlas side used by the generate benchmark (default: 16384)";
+const auto kWorkDirInfo = "directory for the temporary sprite files (default: system temp directory)";
+
+// Gives the benchmark access to the duplicate detection of Generator.
+class GeneratorProbe : public Generator {
+public:
+    GeneratorProbe() : Generator(QString()) {}
+
+    using Generator::HashedFrames;
+    using Generator::SpriteLoader;
+    using Generator::_contentHash;
+    using Generator::_checkDuplicate;
+};
+
+// One timed pass over a sprite set. Only the measured work goes into seconds,
+// rendering the synthetic sprites and other setup is left out.
+struct Run {
+    Run() : seconds(0.0) {}
+    double      seconds;
+    QJsonObject metrics;
+};
+
+class Stopwatch {
+public:
+    Stopwatch() : _total(0) {}
+    auto start()->void { _timer.start(); }
+    auto stop()->void { _total += _timer.nsecsElapsed(); }
+    auto seconds() const->double { return _total / 1e9; }
+
+private:
+    QElapsedTimer   _timer;
+    qint64          _total;
+};
+
+struct Options {
+    QFile*      output;
+    int         repeat;
+    QString     workDir;
+    QSize       maxSize;
+};
+
+static auto _printUsage()->void {
+    fprintf(stdout, "\n%s\n", qPrintable("spriteglue-benchmark"));
+    fprintf(stdout, "\n%s\n", qPrintable("optional:"));
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--output"), kOutputInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--benchmarks"), kBenchmarksInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--distributions"), kDistributionsInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--counts"), kCountsInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--repeat"), kRepeatInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--seed"), kSeedInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--max-size"), kMaxSizeInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--work-dir"), kWorkDirInfo);
+}
+
+static auto _writeLine(const Options& options, const QJsonObject& object)->void {
+    options.output->write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    options.output->write("\n");
+    options.output->flush();
+}
+
+static auto _measure(const Options& options, const QString& benchmark, const QString& variant,
+                     SpriteSets::Distribution distribution, int count, const std::function<Run()>& pass)->void {
+    std::vector<double> seconds;
+    Run run;
+    for (int n = 0; n < options.repeat; ++n) {
+        run = pass();
+        seconds.push_back(run.seconds);
+    }
+    std::sort(seconds.begin(), seconds.end());
+    const double median = seconds[seconds.size() / 2];
+
+    QJsonObject result;
+    result["benchmark"] = benchmark;
+    result["variant"] = variant;
+    result["distribution"] = SpriteSets::name(distribution);
+    result["count"] = count;
+    result["repeat"] = options.repeat;
+    result["min"] = seconds.front();
+    result["median"] = median;
+    result["max"] = seconds.back();
+    result["itemsPerSecond"] = median > 0.0 ? count / median : 0.0;
+    for (auto it = run.metrics.begin(); it != run.metrics.end(); ++it)
+        result[it.key()] = it.value();
+    _writeLine(options, result);
+
+    fprintf(stderr, "%-10s %-22s %-10s %7d  %10.6f s\n", qPrintable(benchmark), qPrintable(variant),
+            qPrintable(SpriteSets::name(distribution)), count, median);
+}
+
+static auto _benchPack(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    const std::pair<rbp::MaxRectsBinPack::FreeRectChoiceHeuristic, QString> heuristics[] = {
+        { rbp::MaxRectsBinPack::RectBestShortSideFit, "best-short-side-fit" },
+        { rbp::MaxRectsBinPack::RectBestLongSideFit, "best-long-side-fit" },
+        { rbp::MaxRectsBinPack::RectBestAreaFit, "best-area-fit" },
+        { rbp::MaxRectsBinPack::RectBottomLeftRule, "bottom-left" },
+        { rbp::MaxRectsBinPack::RectContactPointRule, "contact-point" }
+    };
+
+    // a square bin with a quarter of free space, as the generator ends up with
+    // after its size search; sprites get the default 1 px margin
+    qint64 area = 0;
+    int longest = 0;
+    for (const auto& sprite : sprites) {
+        area += qint64(sprite.size.width() + 1) * (sprite.size.height() + 1);
+        longest = std::max(longest, std::max(sprite.size.width(), sprite.size.height()) + 1);
+    }
+    const int side = std::max(longest, int(std::ceil(std::sqrt(area * 1.25))));
+
+    for (const auto& heuristic : heuristics) {
+        _measure(options, "pack", heuristic.second, distribution, int(sprites.size()), [&]()->Run {
+            rbp::MaxRectsBinPack bin(side, side);
+            int placed = 0;
+            Stopwatch watch;
+            watch.start();
+            for (const auto& sprite : sprites) {
+                if (bin.Insert(sprite.size.width() + 1, sprite.size.height() + 1, heuristic.first).height > 0)
+                    ++placed;
+            }
+            watch.stop();
+
+            Run run;
+            run.seconds = watch.seconds();
+            run.metrics["binSide"] = side;
+            run.metrics["placed"] = placed;
+            run.metrics["occupancy"] = bin.Occupancy();
+            return run;
+        });
+    }
+}
+
+static auto _benchTrim(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    for (bool maxAlpha : { true, false }) {
+        _measure(options, "trim", maxAlpha ? "max-alpha" : "all-alpha", distribution, int(sprites.size()), [&]()->Run {
+            qint64 pixels = 0;
+            qint64 trimmed = 0;
+            Stopwatch watch;
+            for (const auto& sprite : sprites) {
+                const QImage image = SpriteSets::render(sprite);
+                watch.start();
+                const QRect box = ImageTrim::getBoundingBox(image, maxAlpha);
+                watch.stop();
+                pixels += qint64(image.width()) * image.height();
+                trimmed += qint64(box.width()) * box.height();
+            }
+
+            Run run;
+            run.seconds = watch.seconds();
+            run.metrics["pixels"] = double(pixels);
+            run.metrics["keptPixels"] = double(trimmed);
+            return run;
+        });
+    }
+}
+
+static auto _benchRotate(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    const std::pair<std::function<QImage(const QImage&)>, QString> kernels[] = {
+        { [](const QImage& image) { return rotate90(image); }, "rotate90" },
+        { [](const QImage& image) { return rotate180(image); }, "rotate180" },
+        { [](const QImage& image) { return rotate270(image); }, "rotate270" }
+    };
+
+    for (const auto& kernel : kernels) {
+        _measure(options, "rotate", kernel.second, distribution, int(sprites.size()), [&]()->Run {
+            qint64 pixels = 0;
+            Stopwatch watch;
+            for (const auto& sprite : sprites) {
+                const QImage image = SpriteSets::render(sprite);
+                watch.start();
+                const QImage rotated = kernel.first(image);
+                watch.stop();
+                pixels += qint64(rotated.width()) * rotated.height();
+            }
+
+            Run run;
+            run.seconds = watch.seconds();
+            run.metrics["pixels"] = double(pixels);
+            return run;
+        });
+    }
+}
+
+// Mirrors the generator: every sprite is hashed, checked against the unique
+// frames seen so far, and written out as a temp file when it is new.
+static auto _benchDedup(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    for (bool transforms : { false, true }) {
+        _measure(options, "dedup", transforms ? "transforms" : "exact", distribution, int(sprites.size()), [&]()->Run {
+            QTemporaryDir dir(options.workDir + "/spriteglue-benchmark-XXXXXX");
+            GeneratorProbe::HashedFrames frames;
+            const GeneratorProbe::SpriteLoader load = [](const QString& path) { return QImage(path); };
+            int duplicates = 0;
+            Stopwatch watch;
+            for (size_t n = 0; n < sprites.size(); ++n) {
+                const QImage image = SpriteSets::render(sprites[n]);
+                const QString name = QString("sprite_%1.png").arg(n);
+                QString original;
+                int transform = 0;
+
+                watch.start();
+                const quint64 hash = GeneratorProbe::_contentHash(image, transforms);
+                const bool duplicated = GeneratorProbe::_checkDuplicate(image, hash, frames, load, transforms, original, transform);
+                watch.stop();
+
+                if (duplicated) {
+                    ++duplicates;
+                } else {
+                    const QString path = dir.path() + QDir::separator() + name;
+                    image.save(path);
+                    frames.insert(std::make_pair(hash, std::make_pair(name, path)));
+                }
+            }
+
+            Run run;
+            run.seconds = watch.seconds();
+            run.metrics["duplicates"] = duplicates;
+            return run;
+        });
+    }
+}
+
+static auto _benchSort(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    const std::pair<ImageSorter::SortMode, QString> modes[] = {
+        { ImageSorter::HEIGHT, "height" },
+        { ImageSorter::WIDTH, "width" },
+        { ImageSorter::AREA, "area" },
+        { ImageSorter::MAXSIDE, "max-side" }
+    };
+
+    ImageSorter::FrameSizes frameSizes;
+    for (size_t n = 0; n < sprites.size(); ++n)
+        frameSizes.push_back(std::make_pair(QString("sprite_%1.png").arg(n), sprites[n].size));
+
+    for (const auto& mode : modes) {
+        _measure(options, "sort", mode.second, distribution, int(sprites.size()), [&]()->Run {
+            ImageSorter sorter(frameSizes);
+            Stopwatch watch;
+            watch.start();
+            const auto sorted = sorter.sort(mode.first);
+            watch.stop();
+
+            Run run;
+            run.seconds = watch.seconds();
+            run.metrics["sorted"] = int(sorted.size());
+            return run;
+        });
+    }
+}
+
+// The same keys the generator writes for a packed frame.
+static auto _benchPlist(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    QVariantMap frames;
+    int x = 0;
+    for (size_t n = 0; n < sprites.size(); ++n) {
+        const QSize size = sprites[n].size;
+        QVariantMap frameInfo;
+        frameInfo["rotated"] = bool(n & 1);
+        frameInfo["frame"] = QString("{{%1,%2},{%3,%4}}").arg(QString::number(x), QString::number(0),
+                                                              QString::number(size.width()), QString::number(size.height()));
+        frameInfo["offset"] = "{0,0}";
+        frameInfo["sourceColorRect"] = QString("{{0,0},{%1,%2}}").arg(QString::number(size.width()), QString::number(size.height()));
+        frameInfo["sourceSize"] = QString("{%1,%2}").arg(QString::number(size.width()), QString::number(size.height()));
+        frames[QString("sprite_%1.png").arg(n)] = frameInfo;
+        x += size.width() + 1;
+    }
+
+    QVariantMap meta;
+    meta["format"] = 2;
+    meta["realTextureFileName"] = meta["textureFileName"] = "atlas.png";
+    meta["size"] = "{4096,4096}";
+
+    QVariantMap root;
+    root["frames"] = frames;
+    root["metadata"] = meta;
+
+    _measure(options, "plist", "toPList", distribution, int(sprites.size()), [&]()->Run {
+        Stopwatch watch;
+        watch.start();
+        const QString plist = PListSerializer::toPList(root);
+        watch.stop();
+
+        Run run;
+        run.seconds = watch.seconds();
+        run.metrics["bytes"] = plist.toUtf8().size();
+        return run;
+    });
+}
+
+static auto _benchGenerate(const Options& options, SpriteSets::Distribution distribution, const std::vector<SpriteSets::Sprite>& sprites)->void {
+    QTemporaryDir dir(options.workDir + "/spriteglue-benchmark-XXXXXX");
+    const QString sourceDir = dir.path() + QDir::separator() + "sprites";
+    const QString outputDir = dir.path() + QDir::separator() + "atlas";
+    QDir().mkpath(sourceDir);
+    QDir().mkpath(outputDir);
+    for (size_t n = 0; n < sprites.size(); ++n)
+        SpriteSets::render(sprites[n]).save(sourceDir + QDir::separator() + QString("sprite_%1.png").arg(n));
+
+    _measure(options, "generate", "generateTo", distribution, int(sprites.size()), [&]()->Run {
+        Generator generator(sourceDir);
+        generator.setMaxSize(options.maxSize);
+
+        Stopwatch watch;
+        watch.start();
+        const bool ok = generator.generateTo(outputDir + QDir::separator() + "atlas.png");
+        watch.stop();
+
+        Run run;
+        run.seconds = watch.seconds();
+        run.metrics["ok"] = ok;
+        run.metrics["bytes"] = double(QFileInfo(outputDir + QDir::separator() + "atlas.png").size());
+        return run;
+    });
+}
+
+static auto _parseCounts(const QString& value, std::vector<int>& counts)->bool {
+    counts.clear();
+    for (const auto& item : value.split(',')) {
+        if (item.trimmed().isEmpty())
+            continue;
+        bool ok = false;
+        counts.push_back(item.trimmed().toInt(&ok));
+        if (!ok || counts.back() <= 0)
+            return false;
+    }
+    return !counts.empty();
+}
+
+auto main(int argc, char *argv[])->int {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser cmd;
+    QCommandLineOption outputOption(QStringList() << "output", kOutputInfo, "output");
+    QCommandLineOption benchmarksOption(QStringList() << "benchmarks", kBenchmarksInfo, "benchmarks");
+    QCommandLineOption distributionsOption(QStringList() << "distributions", kDistributionsInfo, "distributions");
+    QCommandLineOption countsOption(QStringList() << "counts", kCountsInfo, "counts");
+    QCommandLineOption repeatOption(QStringList() << "repeat", kRepeatInfo, "repeat");
+    QCommandLineOption seedOption(QStringList() << "seed", kSeedInfo, "seed");
+    QCommandLineOption maxSizeOption(QStringList() << "max-size", kMaxSizeInfo, "size");
+    QCommandLineOption workDirOption(QStringList() << "work-dir", kWorkDirInfo, "path");
+    cmd.addOptions(QList<QCommandLineOption>() << outputOption << benchmarksOption << distributionsOption << countsOption
+                   << repeatOption << seedOption << maxSizeOption << workDirOption);
+    cmd.process(app.arguments());
+
+    const std::map<QString, std::function<void(const Options&, SpriteSets::Distribution, const std::vector<SpriteSets::Sprite>&)>> benchmarks = {
+        { "pack", _benchPack },
+        { "trim", _benchTrim },
+        { "rotate", _benchRotate },
+        { "dedup", _benchDedup },
+        { "sort", _benchSort },
+        { "plist", _benchPlist },
+        { "generate", _benchGenerate }
+    };
+    // run in pipeline order rather than by name
+    QStringList selected = QStringList() << "pack" << "trim" << "rotate" << "dedup" << "sort" << "plist" << "generate";
+    if (cmd.isSet(benchmarksOption)) {
+        selected.clear();
+        for (const auto& item : cmd.value(benchmarksOption).split(',')) {
+            const auto name = item.trimmed();
+            if (name.isEmpty())
+                continue;
+            if (!benchmarks.count(name)) {
+                fprintf(stderr, "%s\n", qPrintable("Unknown benchmark: " + name));
+                _printUsage();
+                return 1;
+            }
+            selected << name;
+        }
+    }
+
+    auto distributions = SpriteSets::distributions();
+    if (cmd.isSet(distributionsOption)) {
+        distributions.clear();
+        for (const auto& name : cmd.value(distributionsOption).split(',')) {
+            if (name.trimmed().isEmpty())
+                continue;
+            SpriteSets::Distribution distribution;
+            if (!SpriteSets::fromName(name.trimmed(), distribution)) {
+                fprintf(stderr, "%s\n", qPrintable("Unknown distribution: " + name));
+                _printUsage();
+                return 1;
+            }
+            distributions.push_back(distribution);
+        }
+    }
+
+    std::vector<int> counts = { 100, 1000, 10000 };
+    if (cmd.isSet(countsOption) && !_parseCounts(cmd.value(countsOption), counts)) {
+        fprintf(stderr, "%s\n", qPrintable("The value after --counts is not a list of positive numbers"));
+        _printUsage();
+        return 1;
+    }
+
+    int repeat = 3;
+    if (cmd.isSet(repeatOption)) {
+        bool ok = false;
+        repeat = cmd.value(repeatOption).toInt(&ok);
+        if (!ok || repeat < 1) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --repeat is not a positive number"));
+            _printUsage();
+            return 1;
+        }
+    }
+
+    quint32 seed = 1;
+    if (cmd.isSet(seedOption)) {
+        bool ok = false;
+        seed = cmd.value(seedOption).toUInt(&ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --seed is not a number value"));
+            _printUsage();
+            return 1;
+        }
+    }
+
+    int maxSize = 16384;
+    if (cmd.isSet(maxSizeOption)) {
+        bool ok = false;
+        maxSize = cmd.value(maxSizeOption).toInt(&ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --max-size is not a number value"));
+            _printUsage();
+            return 1;
+        }
+    }
+
+    QFile output(cmd.isSet(outputOption) ? cmd.value(outputOption) : QString("spriteglue-benchmark.jsonl"));
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        fprintf(stderr, "%s\n", qPrintable("Can't open " + output.fileName()));
+        return 1;
+    }
+
+    Options options;
+    options.output = &output;
+    options.repeat = repeat;
+    options.workDir = cmd.isSet(workDirOption) ? cmd.value(workDirOption) : QDir::tempPath();
+    options.maxSize = QSize(maxSize, maxSize);
+
+    // first line describes the build, so result files of different builds can be told apart
+    QJsonObject environment;
+    environment["benchmark"] = "environment";
+    environment["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    environment["qt"] = qVersion();
+    environment["abi"] = QSysInfo::buildAbi();
+    environment["cpu"] = QSysInfo::currentCpuArchitecture();
+    environment["os"] = QSysInfo::prettyProductName();
+    environment["threads"] = QThread::idealThreadCount();
+#ifdef QT_NO_DEBUG
+    environment["debug"] = false;
+#else
+    environment["debug"] = true;
+#endif
+    environment["seed"] = double(seed);
+    environment["repeat"] = repeat;
+    _writeLine(options, environment);
+
+    for (auto distribution : distributions) {
+        for (auto count : counts) {
+            const auto sprites = SpriteSets::create(distribution, count, seed);
+            for (const auto& name : selected)
+                benchmarks.at(name)(options, distribution, sprites);
+        }
+    }
+    return 0;
+}
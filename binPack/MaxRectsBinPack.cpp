@@ -4,6 +4,7 @@
     This work is released to Public Domain, do whatever you want with it.
 */
 
+#include <algorithm>
 #include <utility>
 #include <iostream>
 #include <limits>
@@ -14,25 +15,107 @@
 
 #include "MaxRectsBinPack.h"
 
+#ifdef RBP_STATS
+#include <chrono>
+
+namespace {
+
+/// Adds its own lifetime to a seconds counter.
+struct StatsTimer
+{
+    explicit StatsTimer(double &counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+    ~StatsTimer() { counter += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+    double &counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+}
+
+#define RBP_COUNT(counter, n) (stats.counter += (n))
+#define RBP_TIME(counter) StatsTimer counter##Timer(stats.counter)
+#define RBP_SAMPLE(beforePrune) SampleFreeList(beforePrune)
+#define RBP_RESET() (stats = MaxRectsStats())
+#else
+#define RBP_COUNT(counter, n) ((void)0)
+#define RBP_TIME(counter) ((void)0)
+#define RBP_SAMPLE(beforePrune) ((void)0)
+#define RBP_RESET() ((void)0)
+#endif
+
 namespace rbp {
 
 using namespace std;
 
+MaxRectsStats::MaxRectsStats()
+:inserts(0),
+failedInserts(0),
+scoreEvaluations(0),
+splitCalls(0),
+splitProduced(0),
+pruneComparisons(0),
+pruneRemovals(0),
+freeListPeak(0),
+freeListTotal(0),
+placements(0),
+scoreSeconds(0.0),
+splitSeconds(0.0),
+pruneSeconds(0.0)
+{
+}
+
+MaxRectsStats &MaxRectsStats::operator+=(const MaxRectsStats &other)
+{
+    inserts += other.inserts;
+    failedInserts += other.failedInserts;
+    scoreEvaluations += other.scoreEvaluations;
+    splitCalls += other.splitCalls;
+    splitProduced += other.splitProduced;
+    pruneComparisons += other.pruneComparisons;
+    pruneRemovals += other.pruneRemovals;
+    freeListPeak = max(freeListPeak, other.freeListPeak);
+    freeListTotal += other.freeListTotal;
+    placements += other.placements;
+    scoreSeconds += other.scoreSeconds;
+    splitSeconds += other.splitSeconds;
+    pruneSeconds += other.pruneSeconds;
+    return *this;
+}
+
+double MaxRectsStats::AverageFreeListSize() const
+{
+    return placements ? (double)freeListTotal / placements : 0.0;
+}
+
+double MaxRectsStats::ScoreEvaluationsPerInsert() const
+{
+    return inserts ? (double)scoreEvaluations / inserts : 0.0;
+}
+
 MaxRectsBinPack::MaxRectsBinPack()
 :binWidth(0),
-binHeight(0)
+binHeight(0),
+binAllowFlip(true),
+binAlignment(1)
+{
+}
+
+MaxRectsBinPack::MaxRectsBinPack(int width, int height, bool allowFlip)
+:binAlignment(1)
 {
+    Init(width, height, allowFlip);
 }
 
-MaxRectsBinPack::MaxRectsBinPack(int width, int height)
+void MaxRectsBinPack::SetAlignment(int alignment)
 {
-    Init(width, height);
+    binAlignment = std::max(1, alignment);
 }
 
-void MaxRectsBinPack::Init(int width, int height)
+void MaxRectsBinPack::Init(int width, int height, bool allowFlip)
 {
     binWidth = width;
     binHeight = height;
+    binAllowFlip = allowFlip;
 
     Rect n;
     n.x = 0;
@@ -41,49 +124,104 @@ void MaxRectsBinPack::Init(int width, int height)
     n.height = height;
 
     usedRectangles.clear();
+    RBP_RESET();
 
     freeRectangles.clear();
     freeRectangles.push_back(n);
 }
 
-Rect MaxRectsBinPack::Insert(int width, int height, FreeRectChoiceHeuristic method)
+Rect MaxRectsBinPack::Insert(int requestedWidth, int requestedHeight, FreeRectChoiceHeuristic method)
 {
+    RBP_COUNT(inserts, 1);
+
+    const int width = AlignUp(requestedWidth);
+    const int height = AlignUp(requestedHeight);
     Rect newNode;
     // Unused in this function. We don't need to know the score after finding the position.
     int score1 = std::numeric_limits<int>::max();
     int score2 = std::numeric_limits<int>::max();
-    switch(method)
     {
-        case RectBestShortSideFit: newNode = FindPositionForNewNodeBestShortSideFit(width, height, score1, score2); break;
-        case RectBottomLeftRule: newNode = FindPositionForNewNodeBottomLeft(width, height, score1, score2); break;
-        case RectContactPointRule: newNode = FindPositionForNewNodeContactPoint(width, height, score1); break;
-        case RectBestLongSideFit: newNode = FindPositionForNewNodeBestLongSideFit(width, height, score2, score1); break;
-        case RectBestAreaFit: newNode = FindPositionForNewNodeBestAreaFit(width, height, score1, score2); break;
+        RBP_TIME(scoreSeconds);
+        RBP_COUNT(scoreEvaluations, freeRectangles.size());
+        switch(method)
+        {
+            case RectBestShortSideFit: newNode = FindPositionForNewNodeBestShortSideFit(width, height, score1, score2); break;
+            case RectBottomLeftRule: newNode = FindPositionForNewNodeBottomLeft(width, height, score1, score2); break;
+            case RectContactPointRule: newNode = FindPositionForNewNodeContactPoint(width, height, score1); break;
+            case RectBestLongSideFit: newNode = FindPositionForNewNodeBestLongSideFit(width, height, score2, score1); break;
+            case RectBestAreaFit: newNode = FindPositionForNewNodeBestAreaFit(width, height, score1, score2); break;
+        }
     }
 
     if (newNode.height == 0)
+    {
+        RBP_COUNT(failedInserts, 1);
         return newNode;
+    }
 
-    size_t numRectanglesToProcess = freeRectangles.size();
-    for(size_t i = 0; i < numRectanglesToProcess; ++i)
     {
-        if (SplitFreeNode(freeRectangles[i], newNode))
+        RBP_TIME(splitSeconds);
+        size_t numRectanglesToProcess = freeRectangles.size();
+        for(size_t i = 0; i < numRectanglesToProcess; ++i)
         {
-            freeRectangles.erase(freeRectangles.begin() + i);
-            --i;
-            --numRectanglesToProcess;
+            if (SplitFreeNode(freeRectangles[i], newNode))
+            {
+                freeRectangles.erase(freeRectangles.begin() + i);
+                --i;
+                --numRectanglesToProcess;
+            }
         }
     }
 
+#ifdef RBP_STATS
+    const size_t beforePrune = freeRectangles.size();
+#endif
     PruneFreeList();
+    RBP_SAMPLE(beforePrune);
 
     usedRectangles.push_back(newNode);
+
+    // A flipped node has its sides swapped. Rounded up sides that are equal are never flipped,
+    // since the flipped position would have to score strictly better.
+    const bool flipped = newNode.width != width;
+    newNode.width = flipped ? requestedHeight : requestedWidth;
+    newNode.height = flipped ? requestedWidth : requestedHeight;
+    return newNode;
+}
+
+Rect MaxRectsBinPack::InsertNear(int requestedWidth, int requestedHeight, const Rect &anchor)
+{
+    RBP_COUNT(inserts, 1);
+
+    const int width = AlignUp(requestedWidth);
+    const int height = AlignUp(requestedHeight);
+    int distance;
+    int shortSideFit;
+    Rect newNode;
+    {
+        RBP_TIME(scoreSeconds);
+        RBP_COUNT(scoreEvaluations, freeRectangles.size());
+        newNode = FindPositionForNewNodeNear(width, height, anchor, distance, shortSideFit);
+    }
+
+    if (newNode.height == 0)
+    {
+        RBP_COUNT(failedInserts, 1);
+        return newNode;
+    }
+
+    PlaceRect(newNode);
+
+    const bool flipped = newNode.width != width;
+    newNode.width = flipped ? requestedHeight : requestedWidth;
+    newNode.height = flipped ? requestedWidth : requestedHeight;
     return newNode;
 }
 
 void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst, FreeRectChoiceHeuristic method)
 {
     dst.clear();
+    RBP_COUNT(inserts, rects.size());
 
     while(rects.size() > 0)
     {
@@ -96,7 +234,7 @@ void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &ds
         {
             int score1;
             int score2;
-            Rect newNode = ScoreRect(rects[i].width, rects[i].height, method, score1, score2);
+            Rect newNode = ScoreRect(AlignUp(rects[i].width), AlignUp(rects[i].height), method, score1, score2);
 
             if (score1 < bestScore1 || (score1 == bestScore1 && score2 < bestScore2))
             {
@@ -108,7 +246,10 @@ void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &ds
         }
 
         if (bestRectIndex == -1)
+        {
+            RBP_COUNT(failedInserts, rects.size());
             return;
+        }
 
         PlaceRect(bestNode);
         rects.erase(rects.begin() + bestRectIndex);
@@ -117,18 +258,25 @@ void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &ds
 
 void MaxRectsBinPack::PlaceRect(const Rect &node)
 {
-    size_t numRectanglesToProcess = freeRectangles.size();
-    for(size_t i = 0; i < numRectanglesToProcess; ++i)
     {
-        if (SplitFreeNode(freeRectangles[i], node))
+        RBP_TIME(splitSeconds);
+        size_t numRectanglesToProcess = freeRectangles.size();
+        for(size_t i = 0; i < numRectanglesToProcess; ++i)
         {
-            freeRectangles.erase(freeRectangles.begin() + i);
-            --i;
-            --numRectanglesToProcess;
+            if (SplitFreeNode(freeRectangles[i], node))
+            {
+                freeRectangles.erase(freeRectangles.begin() + i);
+                --i;
+                --numRectanglesToProcess;
+            }
         }
     }
 
+#ifdef RBP_STATS
+    const size_t beforePrune = freeRectangles.size();
+#endif
     PruneFreeList();
+    RBP_SAMPLE(beforePrune);
 
     usedRectangles.push_back(node);
     //		dst.push_back(bestNode); ///\todo Refactor so that this compiles.
@@ -136,6 +284,9 @@ void MaxRectsBinPack::PlaceRect(const Rect &node)
 
 Rect MaxRectsBinPack::ScoreRect(int width, int height, FreeRectChoiceHeuristic method, int &score1, int &score2) const
 {
+    RBP_TIME(scoreSeconds);
+    RBP_COUNT(scoreEvaluations, freeRectangles.size());
+
     Rect newNode;
     score1 = std::numeric_limits<int>::max();
     score2 = std::numeric_limits<int>::max();
@@ -160,6 +311,54 @@ Rect MaxRectsBinPack::ScoreRect(int width, int height, FreeRectChoiceHeuristic m
     return newNode;
 }
 
+bool MaxRectsBinPack::Remove(const Rect &rect)
+{
+    for(size_t i = 0; i < usedRectangles.size(); ++i)
+    {
+        const Rect &used = usedRectangles[i];
+        if (used.x == rect.x && used.y == rect.y && used.width == AlignUp(rect.width) && used.height == AlignUp(rect.height))
+        {
+            usedRectangles.erase(usedRectangles.begin() + i);
+            RebuildFreeList();
+            return true;
+        }
+    }
+    return false;
+}
+
+void MaxRectsBinPack::Defragment(int maxMoves, std::vector<RectMove> &moves)
+{
+    moves.clear();
+
+    // The rectangles whose bottom edge is lowest hold the bin extent, so they are tried first.
+    std::vector<Rect> candidates = usedRectangles;
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Rect &a, const Rect &b) {
+        return a.y + a.height > b.y + b.height || (a.y + a.height == b.y + b.height && a.x + a.width > b.x + b.width);
+    });
+
+    for(size_t i = 0; i < candidates.size() && (int)moves.size() < maxMoves; ++i)
+    {
+        const Rect from = candidates[i];
+        if (!Remove(from))
+            continue;
+
+        int bestY;
+        int bestX;
+        const Rect to = FindPositionForNewNodeBottomLeft(from.width, from.height, bestY, bestX);
+        const bool better = to.height > 0 &&
+            (bestY < from.y + from.height || (bestY == from.y + from.height && bestX < from.x));
+
+        if (better)
+        {
+            RectMove move;
+            move.from = from;
+            move.to = to;
+            moves.push_back(move);
+        }
+        PlaceRect(better ? to : from);
+    }
+}
+
 /// Computes the ratio of used surface area.
 float MaxRectsBinPack::Occupancy() const
 {
@@ -170,6 +369,15 @@ float MaxRectsBinPack::Occupancy() const
     return (float)usedSurfaceArea / (binWidth * binHeight);
 }
 
+#ifdef RBP_STATS
+void MaxRectsBinPack::SampleFreeList(size_t beforePrune)
+{
+    stats.freeListPeak = max(stats.freeListPeak, (unsigned long)beforePrune);
+    stats.freeListTotal += freeRectangles.size();
+    ++stats.placements;
+}
+#endif
+
 Rect MaxRectsBinPack::FindPositionForNewNodeBottomLeft(int width, int height, int &bestY, int &bestX) const
 {
     Rect bestNode;
@@ -194,7 +402,7 @@ Rect MaxRectsBinPack::FindPositionForNewNodeBottomLeft(int width, int height, in
                 bestX = freeRectangles[i].x;
             }
         }
-        if (freeRectangles[i].width >= height && freeRectangles[i].height >= width)
+        if (binAllowFlip && freeRectangles[i].width >= height && freeRectangles[i].height >= width)
         {
             int topSideY = freeRectangles[i].y + width;
             if (topSideY < bestY || (topSideY == bestY && freeRectangles[i].x < bestX))
@@ -241,7 +449,7 @@ Rect MaxRectsBinPack::FindPositionForNewNodeBestShortSideFit(int width, int heig
             }
         }
 
-        if (freeRectangles[i].width >= height && freeRectangles[i].height >= width)
+        if (binAllowFlip && freeRectangles[i].width >= height && freeRectangles[i].height >= width)
         {
             int flippedLeftoverHoriz = abs(freeRectangles[i].width - height);
             int flippedLeftoverVert = abs(freeRectangles[i].height - width);
@@ -292,7 +500,7 @@ Rect MaxRectsBinPack::FindPositionForNewNodeBestLongSideFit(int width, int heigh
             }
         }
 
-        if (freeRectangles[i].width >= height && freeRectangles[i].height >= width)
+        if (binAllowFlip && freeRectangles[i].width >= height && freeRectangles[i].height >= width)
         {
             int leftoverHoriz = abs(freeRectangles[i].width - height);
             int leftoverVert = abs(freeRectangles[i].height - width);
@@ -344,7 +552,7 @@ Rect MaxRectsBinPack::FindPositionForNewNodeBestAreaFit(int width, int height,
             }
         }
 
-        if (freeRectangles[i].width >= height && freeRectangles[i].height >= width)
+        if (binAllowFlip && freeRectangles[i].width >= height && freeRectangles[i].height >= width)
         {
             int leftoverHoriz = abs(freeRectangles[i].width - height);
             int leftoverVert = abs(freeRectangles[i].height - width);
@@ -364,6 +572,60 @@ Rect MaxRectsBinPack::FindPositionForNewNodeBestAreaFit(int width, int height,
     return bestNode;
 }
 
+/// Gap between two intervals, 0 if they overlap or touch.
+static int IntervalGap(int i1start, int i1end, int i2start, int i2end)
+{
+    return std::max(0, std::max(i1start - i2end, i2start - i1end));
+}
+
+Rect MaxRectsBinPack::FindPositionForNewNodeNear(int width, int height, const Rect &anchor,
+    int &bestDistance, int &bestShortSideFit) const
+{
+    Rect bestNode;
+    memset(&bestNode, 0, sizeof(Rect));
+
+    bestDistance = std::numeric_limits<int>::max();
+    bestShortSideFit = std::numeric_limits<int>::max();
+
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const Rect &freeRect = freeRectangles[i];
+        for(int flip = 0; flip < (binAllowFlip ? 2 : 1); ++flip)
+        {
+            const int w = flip ? height : width;
+            const int h = flip ? width : height;
+            if (freeRect.width < w || freeRect.height < h)
+                continue;
+
+            // Right/below and left/above of the anchor, clamped into the free rectangle.
+            const int right = AlignDown(freeRect.x + freeRect.width - w);
+            const int bottom = AlignDown(freeRect.y + freeRect.height - h);
+            const int xs[2] = { anchor.x + anchor.width, anchor.x - w };
+            const int ys[2] = { anchor.y + anchor.height, anchor.y - h };
+            const int shortSideFit = min(freeRect.width - w, freeRect.height - h);
+            for(int cx = 0; cx < 2; ++cx)
+                for(int cy = 0; cy < 2; ++cy)
+                {
+                    const int x = max(freeRect.x, min(right, AlignDown(xs[cx])));
+                    const int y = max(freeRect.y, min(bottom, AlignDown(ys[cy])));
+                    const int distance = IntervalGap(x, x + w, anchor.x, anchor.x + anchor.width)
+                        + IntervalGap(y, y + h, anchor.y, anchor.y + anchor.height);
+
+                    if (distance < bestDistance || (distance == bestDistance && shortSideFit < bestShortSideFit))
+                    {
+                        bestNode.x = x;
+                        bestNode.y = y;
+                        bestNode.width = w;
+                        bestNode.height = h;
+                        bestDistance = distance;
+                        bestShortSideFit = shortSideFit;
+                    }
+                }
+        }
+    }
+    return bestNode;
+}
+
 /// Returns 0 if the two intervals i1 and i2 are disjoint, or the length of their overlap otherwise.
 int CommonIntervalLength(int i1start, int i1end, int i2start, int i2end)
 {
@@ -413,7 +675,7 @@ Rect MaxRectsBinPack::FindPositionForNewNodeContactPoint(int width, int height,
                 bestContactScore = score;
             }
         }
-        if (freeRectangles[i].width >= height && freeRectangles[i].height >= width)
+        if (binAllowFlip && freeRectangles[i].width >= height && freeRectangles[i].height >= width)
         {
             int score = ContactPointScoreNode(freeRectangles[i].x, freeRectangles[i].y, height, width);
             if (score > bestContactScore)
@@ -431,6 +693,8 @@ Rect MaxRectsBinPack::FindPositionForNewNodeContactPoint(int width, int height,
 
 bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
 {
+    RBP_COUNT(splitCalls, 1);
+
     // Test with SAT if the rectangles even intersect.
     if (usedNode.x >= freeNode.x + freeNode.width || usedNode.x + usedNode.width <= freeNode.x ||
         usedNode.y >= freeNode.y + freeNode.height || usedNode.y + usedNode.height <= freeNode.y)
@@ -444,6 +708,7 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
             Rect newNode = freeNode;
             newNode.height = usedNode.y - newNode.y;
             freeRectangles.push_back(newNode);
+            RBP_COUNT(splitProduced, 1);
         }
 
         // New node at the bottom side of the used node.
@@ -453,6 +718,7 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
             newNode.y = usedNode.y + usedNode.height;
             newNode.height = freeNode.y + freeNode.height - (usedNode.y + usedNode.height);
             freeRectangles.push_back(newNode);
+            RBP_COUNT(splitProduced, 1);
         }
     }
 
@@ -464,6 +730,7 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
             Rect newNode = freeNode;
             newNode.width = usedNode.x - newNode.x;
             freeRectangles.push_back(newNode);
+            RBP_COUNT(splitProduced, 1);
         }
 
         // New node at the right side of the used node.
@@ -473,12 +740,41 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
             newNode.x = usedNode.x + usedNode.width;
             newNode.width = freeNode.x + freeNode.width - (usedNode.x + usedNode.width);
             freeRectangles.push_back(newNode);
+            RBP_COUNT(splitProduced, 1);
         }
     }
 
     return true;
 }
 
+void MaxRectsBinPack::RebuildFreeList()
+{
+    Rect bin;
+    bin.x = 0;
+    bin.y = 0;
+    bin.width = binWidth;
+    bin.height = binHeight;
+
+    freeRectangles.clear();
+    freeRectangles.push_back(bin);
+
+    // Splitting by every used rectangle yields the maximal free rectangles whatever the order.
+    for(size_t u = 0; u < usedRectangles.size(); ++u)
+    {
+        size_t numRectanglesToProcess = freeRectangles.size();
+        for(size_t i = 0; i < numRectanglesToProcess; ++i)
+        {
+            if (SplitFreeNode(freeRectangles[i], usedRectangles[u]))
+            {
+                freeRectangles.erase(freeRectangles.begin() + i);
+                --i;
+                --numRectanglesToProcess;
+            }
+        }
+        PruneFreeList();
+    }
+}
+
 void MaxRectsBinPack::PruneFreeList()
 {
     /*
@@ -500,18 +796,23 @@ void MaxRectsBinPack::PruneFreeList()
         }
     */
 
+    RBP_TIME(pruneSeconds);
+
     /// Go through each pair and remove any rectangle that is redundant.
     for(size_t i = 0; i < freeRectangles.size(); ++i)
         for(size_t j = i+1; j < freeRectangles.size(); ++j)
         {
+            RBP_COUNT(pruneComparisons, 1);
             if (IsContainedIn(freeRectangles[i], freeRectangles[j]))
             {
+                RBP_COUNT(pruneRemovals, 1);
                 freeRectangles.erase(freeRectangles.begin()+i);
                 --i;
                 break;
             }
             if (IsContainedIn(freeRectangles[j], freeRectangles[i]))
             {
+                RBP_COUNT(pruneRemovals, 1);
                 freeRectangles.erase(freeRectangles.begin()+j);
                 --j;
             }
@@ -13,6 +13,43 @@
 
 namespace rbp {
 
+/** Counters of the work done by a MaxRectsBinPack. They are only collected when the packer is
+    compiled with RBP_STATS defined; otherwise the hooks compile to nothing and every field stays zero. */
+struct MaxRectsStats
+{
+    MaxRectsStats();
+
+    /// Adds the counters of another bin, keeping the larger free list peak.
+    MaxRectsStats &operator+=(const MaxRectsStats &other);
+
+    /// Average number of free rectangles after each placement.
+    double AverageFreeListSize() const;
+
+    /// Average number of free rectangles scored per insert.
+    double ScoreEvaluationsPerInsert() const;
+
+    unsigned long inserts; ///< Rectangles the packer was asked to place.
+    unsigned long failedInserts; ///< Rectangles that did not fit.
+    unsigned long scoreEvaluations; ///< Free rectangles scored while looking for a position.
+    unsigned long splitCalls; ///< SplitFreeNode calls.
+    unsigned long splitProduced; ///< Free rectangles produced by the splits.
+    unsigned long pruneComparisons; ///< Containment tests made by PruneFreeList.
+    unsigned long pruneRemovals; ///< Redundant free rectangles removed by PruneFreeList.
+    unsigned long freeListPeak; ///< Largest free list, measured before pruning.
+    unsigned long freeListTotal; ///< Sum of the free list sizes after each placement.
+    unsigned long placements; ///< Placements summed into freeListTotal.
+    double scoreSeconds; ///< Time spent scoring positions.
+    double splitSeconds; ///< Time spent splitting free rectangles.
+    double pruneSeconds; ///< Time spent in PruneFreeList.
+};
+
+/// A rectangle moved by MaxRectsBinPack::Defragment. to may be rotated with respect to from.
+struct RectMove
+{
+    Rect from;
+    Rect to;
+};
+
 /** MaxRectsBinPack implements the MAXRECTS data structure and different bin packing algorithms that
     use this structure. */
 class MaxRectsBinPack
@@ -22,11 +59,18 @@ public:
     MaxRectsBinPack();
 
     /// Instantiates a bin of the given size.
-    MaxRectsBinPack(int width, int height);
+    /// @param allowFlip Whether rectangles may be placed turned by 90 degrees.
+    MaxRectsBinPack(int width, int height, bool allowFlip = true);
 
     /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
     /// you need to restart with a new bin.
-    void Init(int width, int height);
+    void Init(int width, int height, bool allowFlip = true);
+
+    /// Places rectangles only at multiples of alignment and makes each occupy its size rounded up
+    /// to a multiple of it, so no two rectangles share an alignment x alignment cell (e.g. 4 for
+    /// block compressed textures). Insert still returns the requested size; Remove takes it back,
+    /// while UsedRectangles and Defragment see the rounded up rectangles. Kept across Init.
+    void SetAlignment(int alignment);
 
     /// Specifies the different heuristic rules that can be used when deciding where to place a new rectangle.
     enum FreeRectChoiceHeuristic
@@ -47,16 +91,59 @@ public:
     /// Inserts a single rectangle into the bin, possibly rotated.
     Rect Insert(int width, int height, FreeRectChoiceHeuristic method);
 
+    /// Inserts a single rectangle, possibly rotated, as close as possible to anchor: in the free rectangle
+    /// leaving the smallest gap to it, ties broken by -BSSF. Used to keep related
+    /// rectangles (e.g. the frames of an animation) together.
+    Rect InsertNear(int width, int height, const Rect &anchor);
+
+    /// Frees a rectangle returned by an earlier Insert. The free list is re-derived from the
+    /// remaining used rectangles, so the space merges with any free space around it.
+    /// @return False if rect is not one of the used rectangles.
+    bool Remove(const Rect &rect);
+
+    /// Moves used rectangles, those reaching furthest down first, to the lowest (then leftmost)
+    /// position the -BL rule finds for them, as long as that is strictly better than where they are.
+    /// @param maxMoves The most rectangles to move.
+    /// @param moves [out] The moves made, in order.
+    void Defragment(int maxMoves, std::vector<RectMove> &moves);
+
     /// Computes the ratio of used surface area to the total bin area.
     float Occupancy() const;
 
+    /// The rectangles placed so far.
+    const std::vector<Rect> &UsedRectangles() const { return usedRectangles; }
+
+    /// Work done since the last Init. All zero unless compiled with RBP_STATS.
+#ifdef RBP_STATS
+    const MaxRectsStats &Stats() const { return stats; }
+#else
+    const MaxRectsStats &Stats() const { static const MaxRectsStats none; return none; }
+#endif
+
 private:
     int binWidth;
     int binHeight;
+    bool binAllowFlip;
+    int binAlignment;
 
     std::vector<Rect> usedRectangles;
     std::vector<Rect> freeRectangles;
 
+#ifdef RBP_STATS
+    mutable MaxRectsStats stats;
+#endif
+
+    /// Rounds a side up to a multiple of binAlignment.
+    int AlignUp(int side) const { return (side + binAlignment - 1) / binAlignment * binAlignment; }
+
+    /// Rounds a coordinate down to a multiple of binAlignment.
+    int AlignDown(int position) const { return (position >= 0 ? position : position - binAlignment + 1) / binAlignment * binAlignment; }
+
+#ifdef RBP_STATS
+    /// Records the free list size after a placement.
+    void SampleFreeList(size_t beforePrune);
+#endif
+
     /// Computes the placement score for placing the given rectangle with the given method.
     /// @param score1 [out] The primary placement score will be outputted here.
     /// @param score2 [out] The secondary placement score will be outputted here. This isu sed to break ties.
@@ -74,12 +161,16 @@ private:
     Rect FindPositionForNewNodeBestLongSideFit(int width, int height, int &bestShortSideFit, int &bestLongSideFit) const;
     Rect FindPositionForNewNodeBestAreaFit(int width, int height, int &bestAreaFit, int &bestShortSideFit) const;
     Rect FindPositionForNewNodeContactPoint(int width, int height, int &contactScore) const;
+    Rect FindPositionForNewNodeNear(int width, int height, const Rect &anchor, int &bestDistance, int &bestShortSideFit) const;
 
     /// @return True if the free node was split.
     bool SplitFreeNode(Rect freeNode, const Rect &usedNode);
 
     /// Goes through the free rectangle list and removes any redundant entries.
     void PruneFreeList();
+
+    /// Rebuilds the maximal free rectangles of the bin from the used rectangles.
+    void RebuildFreeList();
 };
 
 }
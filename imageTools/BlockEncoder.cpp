@@ -0,0 +1,585 @@
+/* BlockEncoder.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "BlockEncoder.h"
+#include "ImageConvert.h"
+#include "BlockCache.h"
+
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+// Block rows are spread over a pool of their own (the variants calling this
+// already run on the global one). Every block is unpremultiplied into 16 RGBA
+// pixels with the canvas row kernel and encoded on its own; the inner loops are
+// fixed-size integer loops over those pixels.
+
+namespace {
+
+const int kEtcModifiers[8][2] = {
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+const int kEacModifiers[16][8] = {
+    { -3, -6, -9, -15, 2, 5, 8, 14 },
+    { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5, -8, -13, 1, 4, 7, 12 },
+    { -2, -4, -6, -13, 1, 3, 5, 12 },
+    { -3, -6, -8, -12, 2, 5, 7, 11 },
+    { -3, -7, -9, -11, 2, 6, 8, 10 },
+    { -4, -7, -8, -11, 3, 6, 7, 10 },
+    { -3, -5, -8, -11, 2, 4, 7, 10 },
+    { -2, -6, -8, -10, 1, 5, 7, 9 },
+    { -2, -5, -8, -10, 1, 4, 7, 9 },
+    { -2, -4, -8, -10, 1, 3, 7, 9 },
+    { -2, -5, -7, -10, 1, 4, 6, 9 },
+    { -3, -4, -7, -10, 2, 3, 6, 9 },
+    { -1, -2, -3, -10, 0, 1, 2, 9 },
+    { -4, -6, -8, -9, 3, 5, 7, 8 },
+    { -3, -5, -7, -9, 2, 4, 6, 8 }
+};
+const int kEacZeroTable = 13;
+const int kEacZeroIndex = 4;
+
+inline int expand4(int v) { return v << 4 | v; }
+inline int expand5(int v) { return v << 3 | v >> 2; }
+inline int expand6(int v) { return v << 2 | v >> 4; }
+
+inline int clampByte(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+inline int to565(const int* rgb) {
+    return (rgb[0] * 31 + 127) / 255 << 11 | (rgb[1] * 63 + 127) / 255 << 5 | (rgb[2] * 31 + 127) / 255;
+}
+
+inline void from565(int color, int* rgb) {
+    rgb[0] = expand5(color >> 11);
+    rgb[1] = expand6((color >> 5) & 0x3f);
+    rgb[2] = expand5(color & 0x1f);
+}
+
+inline int distance(const uchar* pixel, const int* rgb) {
+    const int dr = pixel[0] - rgb[0];
+    const int dg = pixel[1] - rgb[1];
+    const int db = pixel[2] - rgb[2];
+    return dr * dr + dg * dg + db * db;
+}
+
+inline void writeBigEndian(quint64 value, uchar* out) {
+    for (int n = 0; n < 8; ++n)
+        out[n] = uchar(value >> (56 - n * 8));
+}
+
+}
+
+int BlockEncoder::blockBytes(Format format) {
+    switch (format) {
+    case BC1:
+    case ETC2_RGB: return 8;
+    case BC3:
+    case ETC2_RGBA: return 16;
+    case NONE: break;
+    }
+    return 0;
+}
+
+bool BlockEncoder::hasAlpha(Format format) {
+    return format == BC1 || format == BC3 || format == ETC2_RGBA;
+}
+
+QByteArray BlockEncoder::encode(const QImage& canvasStrip, Format format, BlockCache* cache) {
+    const QImage strip = canvasStrip.format() == ImageConvert::kCanvasFormat
+        ? canvasStrip
+        : canvasStrip.convertToFormat(ImageConvert::kCanvasFormat);
+
+    const int blocksWide = (strip.width() + 3) / 4;
+    const int blocksHigh = (strip.height() + 3) / 4;
+    const int bytes = blockBytes(format);
+    QByteArray result(blocksWide * blocksHigh * bytes, 0);
+    if (result.isEmpty())
+        return result;
+
+    uchar* data = reinterpret_cast<uchar*>(result.data());
+    std::vector<std::vector<BlockCache::Entry>> recorded(blocksHigh);
+    const auto encodeRow = [&](int by) {
+        BlockCache::Pixels pixels;
+        uchar* rgba = pixels.data();
+        for (int bx = 0; bx < blocksWide; ++bx) {
+            pixels.fill(0);
+            const int columns = std::min(4, strip.width() - bx * 4);
+            for (int y = 0; y < 4 && by * 4 + y < strip.height(); ++y) {
+                const auto src = reinterpret_cast<const QRgb*>(strip.constScanLine(by * 4 + y)) + bx * 4;
+                ImageConvert::convertRow(rgba + y * 16, src, columns, QImage::Format_RGBA8888);
+            }
+
+            uchar* out = data + (by * blocksWide + bx) * bytes;
+            if (!cache) {
+                encodeBlock(rgba, format, out);
+                continue;
+            }
+
+            BlockCache::Entry entry;
+            entry.key = BlockCache::key(rgba, format);
+            entry.pixels = pixels;
+            if (!cache->find(entry.key, pixels, entry.block)) {
+                entry.block.fill(0);
+                encodeBlock(rgba, format, entry.block.data());
+            }
+            std::copy(entry.block.begin(), entry.block.begin() + bytes, out);
+            recorded[by].push_back(entry);
+        }
+    };
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount()));
+    const int tasks = std::min(blocksHigh, pool.maxThreadCount());
+    std::vector<QFuture<void>> rows;
+    for (int task = 0; task < tasks; ++task) {
+        rows.push_back(QtConcurrent::run(&pool, [&encodeRow, task, tasks, blocksHigh]() {
+            for (int by = task; by < blocksHigh; by += tasks)
+                encodeRow(by);
+        }));
+    }
+    for (auto& row : rows)
+        row.waitForFinished();
+
+    if (cache) {
+        for (const auto& entries : recorded)
+            cache->insert(entries);
+    }
+    return result;
+}
+
+void BlockEncoder::encodeBlock(const uchar* rgba, Format format, uchar* out) {
+    switch (format) {
+    case BC1: _encodeColor(rgba, true, out); break;
+    case BC3: _encodeAlpha(rgba, out); _encodeColor(rgba, false, out + 8); break;
+    case ETC2_RGB: _encodeEtc(rgba, false, out); break;
+    case ETC2_RGBA: _encodeEacAlpha(rgba, out); _encodeEtc(rgba, true, out + 8); break;
+    case NONE: break;
+    }
+}
+
+// BC1 color block. The endpoints start at the pixels furthest apart along the
+// principal axis of the visible colors and get one least squares refinement.
+// With punchThrough, pixels below half alpha select the transparent index of
+// the three color mode; otherwise (BC3) only fully transparent ones are ignored.
+void BlockEncoder::_encodeColor(const uchar* rgba, bool punchThrough, uchar* out) {
+    bool ignored[16];
+    bool anyIgnored = false;
+    int count = 0;
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < 16; ++i) {
+        ignored[i] = rgba[i * 4 + 3] < (punchThrough ? 128 : 1);
+        anyIgnored = anyIgnored || ignored[i];
+        if (ignored[i])
+            continue;
+        ++count;
+        for (int c = 0; c < 3; ++c)
+            mean[c] += rgba[i * 4 + c];
+    }
+
+    const bool threeColor = punchThrough && anyIgnored;
+    if (!count) {
+        // equal endpoints select the three color mode, index 3 is transparent black
+        std::fill(out, out + 4, 0);
+        std::fill(out + 4, out + 8, punchThrough ? 0xff : 0);
+        return;
+    }
+    for (int c = 0; c < 3; ++c)
+        mean[c] /= count;
+
+    double covariance[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    for (int i = 0; i < 16; ++i) {
+        if (ignored[i])
+            continue;
+        const double r = rgba[i * 4] - mean[0];
+        const double g = rgba[i * 4 + 1] - mean[1];
+        const double b = rgba[i * 4 + 2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    double axis[3] = { 1.0, 1.0, 1.0 };
+    for (int iteration = 0; iteration < 4; ++iteration) {
+        const double x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        const double y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        const double z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        const double norm = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+        if (norm < 1e-9)
+            break;
+        axis[0] = x / norm;
+        axis[1] = y / norm;
+        axis[2] = z / norm;
+    }
+
+    int low = 0, high = 0;
+    double lowDot = DBL_MAX, highDot = -DBL_MAX;
+    for (int i = 0; i < 16; ++i) {
+        if (ignored[i])
+            continue;
+        const double dot = rgba[i * 4] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+        if (dot < lowDot) {
+            lowDot = dot;
+            low = i;
+        }
+        if (dot > highDot) {
+            highDot = dot;
+            high = i;
+        }
+    }
+
+    const int lowColor[3] = { rgba[low * 4], rgba[low * 4 + 1], rgba[low * 4 + 2] };
+    const int highColor[3] = { rgba[high * 4], rgba[high * 4 + 1], rgba[high * 4 + 2] };
+    uchar best[8];
+    int bestError = _colorBlock(rgba, ignored, threeColor, to565(highColor), to565(lowColor), best);
+
+    if (!threeColor && bestError > 0) {
+        // endpoints minimizing the squared error for the chosen indices
+        const quint32 indices = quint32(best[4]) | quint32(best[5]) << 8 | quint32(best[6]) << 16 | quint32(best[7]) << 24;
+        const double kWeights[4] = { 1.0, 0.0, 2.0 / 3.0, 1.0 / 3.0 };
+        double aa = 0.0, ab = 0.0, bb = 0.0;
+        double ax[3] = { 0.0, 0.0, 0.0 };
+        double bx[3] = { 0.0, 0.0, 0.0 };
+        for (int i = 0; i < 16; ++i) {
+            if (ignored[i])
+                continue;
+            const double a = kWeights[(indices >> (i * 2)) & 3];
+            const double b = 1.0 - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < 3; ++c) {
+                ax[c] += a * rgba[i * 4 + c];
+                bx[c] += b * rgba[i * 4 + c];
+            }
+        }
+
+        const double determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) > 1e-9) {
+            int endpoint0[3], endpoint1[3];
+            for (int c = 0; c < 3; ++c) {
+                endpoint0[c] = clampByte(int(std::lround((ax[c] * bb - bx[c] * ab) / determinant)));
+                endpoint1[c] = clampByte(int(std::lround((bx[c] * aa - ax[c] * ab) / determinant)));
+            }
+            uchar refined[8];
+            const int error = _colorBlock(rgba, ignored, threeColor, to565(endpoint0), to565(endpoint1), refined);
+            if (error < bestError) {
+                bestError = error;
+                std::copy(refined, refined + 8, best);
+            }
+        }
+    }
+    std::copy(best, best + 8, out);
+}
+
+// Orders the endpoints for the mode, picks the nearest palette entry for every
+// pixel and writes the block. Returns the squared error of the visible pixels.
+int BlockEncoder::_colorBlock(const uchar* rgba, const bool* ignored, bool threeColor, int color0, int color1, uchar* out) {
+    if (threeColor ? color0 > color1 : color0 < color1)
+        std::swap(color0, color1);
+
+    int palette[4][3];
+    from565(color0, palette[0]);
+    from565(color1, palette[1]);
+    const bool fourColor = color0 > color1;
+    for (int c = 0; c < 3; ++c) {
+        if (fourColor) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+
+    // index 3 of the three color mode is transparent
+    const int candidates = fourColor ? 4 : 3;
+    quint32 indices = 0;
+    int error = 0;
+    for (int i = 0; i < 16; ++i) {
+        int index = threeColor ? 3 : 0;
+        if (!ignored[i]) {
+            int bestDistance = INT_MAX;
+            for (int k = 0; k < candidates; ++k) {
+                const int d = distance(rgba + i * 4, palette[k]);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    index = k;
+                }
+            }
+            error += bestDistance;
+        }
+        indices |= quint32(index) << (i * 2);
+    }
+
+    out[0] = uchar(color0);
+    out[1] = uchar(color0 >> 8);
+    out[2] = uchar(color1);
+    out[3] = uchar(color1 >> 8);
+    for (int n = 0; n < 4; ++n)
+        out[4 + n] = uchar(indices >> (n * 8));
+    return error;
+}
+
+// BC3 alpha block: the eight value ramp over the whole alpha range, or the six
+// value ramp over the values strictly between 0 and 255 with both kept exact,
+// whichever is closer.
+void BlockEncoder::_encodeAlpha(const uchar* rgba, uchar* out) {
+    int low = 255, high = 0;
+    int innerLow = 255, innerHigh = 0;
+    for (int i = 0; i < 16; ++i) {
+        const int a = rgba[i * 4 + 3];
+        low = std::min(low, a);
+        high = std::max(high, a);
+        if (a != 0 && a != 255) {
+            innerLow = std::min(innerLow, a);
+            innerHigh = std::max(innerHigh, a);
+        }
+    }
+
+    int error = _alphaBlock(rgba, high, low, out);
+    if (error > 0) {
+        if (innerLow > innerHigh)
+            innerLow = innerHigh = 0;
+        uchar sixValues[8];
+        if (_alphaBlock(rgba, innerLow, innerHigh, sixValues) < error)
+            std::copy(sixValues, sixValues + 8, out);
+    }
+}
+
+int BlockEncoder::_alphaBlock(const uchar* rgba, int alpha0, int alpha1, uchar* out) {
+    int values[8] = { alpha0, alpha1, 0, 0, 0, 0, 0, 0 };
+    if (alpha0 > alpha1) {
+        for (int k = 1; k <= 6; ++k)
+            values[k + 1] = ((7 - k) * alpha0 + k * alpha1) / 7;
+    } else {
+        for (int k = 1; k <= 4; ++k)
+            values[k + 1] = ((5 - k) * alpha0 + k * alpha1) / 5;
+        values[7] = 255;
+    }
+
+    quint64 indices = 0;
+    int error = 0;
+    for (int i = 0; i < 16; ++i) {
+        const int a = rgba[i * 4 + 3];
+        int index = 0;
+        int bestDistance = INT_MAX;
+        for (int k = 0; k < 8; ++k) {
+            const int d = (a - values[k]) * (a - values[k]);
+            if (d < bestDistance) {
+                bestDistance = d;
+                index = k;
+            }
+        }
+        error += bestDistance;
+        indices |= quint64(index) << (i * 3);
+    }
+
+    out[0] = uchar(alpha0);
+    out[1] = uchar(alpha1);
+    for (int n = 0; n < 6; ++n)
+        out[2 + n] = uchar(indices >> (n * 8));
+    return error;
+}
+
+// ETC2 color block in the individual (444) or differential (555 + 333 delta)
+// mode, for both sub-block orientations, with the base colors at the sub-block
+// averages. The delta stays in range, so decoders never see the T, H or planar modes.
+void BlockEncoder::_encodeEtc(const uchar* rgba, bool skipTransparent, uchar* out) {
+    int weights[16];
+    for (int i = 0; i < 16; ++i)
+        weights[i] = skipTransparent && !rgba[i * 4 + 3] ? 0 : 1;
+
+    quint64 best = 0;
+    int bestError = INT_MAX;
+    for (int flip = 0; flip < 2; ++flip) {
+        double average[2][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+        int counts[2] = { 0, 0 };
+        for (int i = 0; i < 16; ++i) {
+            const int part = flip ? i / 4 >= 2 : i % 4 >= 2;
+            counts[part] += weights[i];
+            for (int c = 0; c < 3; ++c)
+                average[part][c] += weights[i] * rgba[i * 4 + c];
+        }
+        for (int part = 0; part < 2; ++part) {
+            for (int c = 0; c < 3 && counts[part]; ++c)
+                average[part][c] /= counts[part];
+        }
+        // a half without visible pixels takes the color of the other one
+        for (int part = 0; part < 2; ++part) {
+            for (int c = 0; c < 3 && !counts[part]; ++c)
+                average[part][c] = average[1 - part][c];
+        }
+
+        int q5[2][3], q4[2][3];
+        bool differential = true;
+        for (int part = 0; part < 2; ++part) {
+            for (int c = 0; c < 3; ++c) {
+                q5[part][c] = int(average[part][c] * 31.0 / 255.0 + 0.5);
+                q4[part][c] = int(average[part][c] * 15.0 / 255.0 + 0.5);
+            }
+        }
+        for (int c = 0; c < 3; ++c) {
+            const int delta = q5[1][c] - q5[0][c];
+            differential = differential && delta >= -4 && delta <= 3;
+        }
+
+        for (int mode = differential ? 0 : 1; mode < 2; ++mode) {
+            int base[2][3];
+            for (int part = 0; part < 2; ++part) {
+                for (int c = 0; c < 3; ++c)
+                    base[part][c] = mode == 0 ? expand5(q5[part][c]) : expand4(q4[part][c]);
+            }
+
+            int tables[2];
+            quint32 indices[2];
+            const int error = _etcSubBlock(rgba, weights, base[0], flip, 0, tables[0], indices[0])
+                            + _etcSubBlock(rgba, weights, base[1], flip, 1, tables[1], indices[1]);
+            if (error >= bestError)
+                continue;
+
+            bestError = error;
+            quint64 high = quint64(tables[0]) << 5 | quint64(tables[1]) << 2 | quint64(flip);
+            if (mode == 0) {
+                high |= 2;
+                for (int c = 0; c < 3; ++c) {
+                    const int shift = 27 - c * 8;
+                    high |= quint64(q5[0][c]) << shift | quint64((q5[1][c] - q5[0][c]) & 7) << (shift - 3);
+                }
+            } else {
+                for (int c = 0; c < 3; ++c) {
+                    const int shift = 28 - c * 8;
+                    high |= quint64(q4[0][c]) << shift | quint64(q4[1][c]) << (shift - 4);
+                }
+            }
+            best = high << 32 | indices[0] | indices[1];
+        }
+    }
+    writeBigEndian(best, out);
+}
+
+// Best of the eight modifier tables for one half of the block. Pixel indices are
+// stored column by column, most significant bits in the upper half.
+int BlockEncoder::_etcSubBlock(const uchar* rgba, const int* weights, const int* base, int flip, int part, int& table, quint32& indices) {
+    int bestError = INT_MAX;
+    table = 0;
+    indices = 0;
+    for (int t = 0; t < 8 && bestError > 0; ++t) {
+        int candidates[4][3];
+        for (int k = 0; k < 4; ++k) {
+            const int modifier = k & 2 ? -kEtcModifiers[t][k & 1] : kEtcModifiers[t][k & 1];
+            for (int c = 0; c < 3; ++c)
+                candidates[k][c] = clampByte(base[c] + modifier);
+        }
+
+        int error = 0;
+        quint32 bits = 0;
+        for (int i = 0; i < 16; ++i) {
+            const int x = i % 4;
+            const int y = i / 4;
+            if ((flip ? y >= 2 : x >= 2) != bool(part) || !weights[i])
+                continue;
+
+            int index = 0;
+            int bestDistance = INT_MAX;
+            for (int k = 0; k < 4; ++k) {
+                const int d = distance(rgba + i * 4, candidates[k]);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    index = k;
+                }
+            }
+            error += bestDistance;
+            const int j = x * 4 + y;
+            bits |= quint32(index >> 1) << (16 + j) | quint32(index & 1) << j;
+        }
+
+        if (error < bestError) {
+            bestError = error;
+            table = t;
+            indices = bits;
+        }
+    }
+    return bestError;
+}
+
+// EAC alpha: per table, the multiplier that just spans the alpha range and a
+// base around its middle, plus their neighbours.
+void BlockEncoder::_encodeEacAlpha(const uchar* rgba, uchar* out) {
+    int low = 255, high = 0;
+    for (int i = 0; i < 16; ++i) {
+        low = std::min(low, int(rgba[i * 4 + 3]));
+        high = std::max(high, int(rgba[i * 4 + 3]));
+    }
+
+    int bestBase = low, bestMultiplier = 1, bestTable = kEacZeroTable;
+    quint64 bestIndices = 0;
+    for (int i = 0; i < 16; ++i)
+        bestIndices |= quint64(kEacZeroIndex) << (45 - ((i % 4) * 4 + i / 4) * 3);
+
+    if (low != high) {
+        int bestError = INT_MAX;
+        for (int t = 0; t < 16 && bestError > 0; ++t) {
+            const int* modifiers = kEacModifiers[t];
+            const int tableLow = *std::min_element(modifiers, modifiers + 8);
+            const int tableHigh = *std::max_element(modifiers, modifiers + 8);
+            const int span = std::max(1, std::min(15, (high - low + tableHigh - tableLow - 1) / (tableHigh - tableLow)));
+
+            for (int multiplier = std::max(1, span - 1); multiplier <= span; ++multiplier) {
+                const int center = (low + high) / 2 - (tableLow + tableHigh) * multiplier / 2;
+                for (int base = clampByte(center - 1); base <= clampByte(center + 1); ++base) {
+                    int error = 0;
+                    quint64 indices = 0;
+                    for (int i = 0; i < 16; ++i) {
+                        const int a = rgba[i * 4 + 3];
+                        int index = 0;
+                        int bestDistance = INT_MAX;
+                        for (int k = 0; k < 8; ++k) {
+                            const int d = a - clampByte(base + modifiers[k] * multiplier);
+                            if (d * d < bestDistance) {
+                                bestDistance = d * d;
+                                index = k;
+                            }
+                        }
+                        error += bestDistance;
+                        indices |= quint64(index) << (45 - ((i % 4) * 4 + i / 4) * 3);
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        bestBase = base;
+                        bestMultiplier = multiplier;
+                        bestTable = t;
+                        bestIndices = indices;
+                    }
+                }
+            }
+        }
+    }
+
+    writeBigEndian(quint64(bestBase) << 56 | quint64(bestMultiplier) << 52 | quint64(bestTable) << 48 | bestIndices, out);
+}
@@ -0,0 +1,61 @@
+/* BlockEncoder.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef BLOCKENCODER_H
+#define BLOCKENCODER_H
+
+#include <QByteArray>
+#include <QImage>
+
+class BlockCache;
+
+// CPU encoders for the 4x4 block compressed formats GPUs sample directly.
+// They aim at build speed over the last bit of quality: endpoints come from the
+// principal axis (BC1) or the sub-block averages (ETC), refined once, and only
+// the ETC1 compatible individual and differential modes of ETC2 are used.
+class BlockEncoder {
+public:
+    enum Format {
+        NONE,
+        BC1,        // DXT1, transparent pixels use the 1-bit alpha mode
+        BC3,        // DXT5
+        ETC2_RGB,
+        ETC2_RGBA   // ETC2 color with EAC alpha
+    };
+
+    static int blockBytes(Format format);
+    static bool hasAlpha(Format format);
+
+    // Encodes a canvas strip (premultiplied ARGB32) to blocks in row-major order,
+    // one block row after another, on all cores. Sides that aren't multiples of 4
+    // are padded with transparent pixels. With a cache, blocks of earlier builds
+    // are copied instead of encoded, and every block of this one is recorded.
+    static QByteArray encode(const QImage& canvasStrip, Format format, BlockCache* cache = nullptr);
+
+    // 16 straight RGBA pixels, row by row.
+    static void encodeBlock(const uchar* rgba, Format format, uchar* out);
+
+protected:
+    static void _encodeColor(const uchar* rgba, bool punchThrough, uchar* out);
+    static int _colorBlock(const uchar* rgba, const bool* ignored, bool threeColor, int color0, int color1, uchar* out);
+    static void _encodeAlpha(const uchar* rgba, uchar* out);
+    static int _alphaBlock(const uchar* rgba, int alpha0, int alpha1, uchar* out);
+    static void _encodeEtc(const uchar* rgba, bool skipTransparent, uchar* out);
+    static int _etcSubBlock(const uchar* rgba, const int* weights, const int* base, int flip, int part, int& table, quint32& indices);
+    static void _encodeEacAlpha(const uchar* rgba, uchar* out);
+};
+
+#endif // BLOCKENCODER_H
@@ -0,0 +1,405 @@
+/* ColorQuantizer.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "ColorQuantizer.h"
+#include "ImageConvert.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// Palette entries are kept as separate a, r, g, b arrays so the nearest color
+// search is a plain loop over contiguous ints that the compiler vectorizes.
+
+namespace {
+
+const int kKeyBits = 5;
+const int kKeyCount = 1 << (kKeyBits * 4);
+const int kRefinePasses = 3;
+
+inline uint bucketKey(int a, int r, int g, int b) {
+    return uint(a >> 3) << 15 | uint(r >> 3) << 10 | uint(g >> 3) << 5 | uint(b >> 3);
+}
+
+inline uint bucketKey(uint p) {
+    return bucketKey(int(p >> 24), int((p >> 16) & 0xff), int((p >> 8) & 0xff), int(p & 0xff));
+}
+
+inline int bucketCenter(uint key, int channel) {
+    return int(((key >> (15 - channel * kKeyBits)) & 0x1f) << 3 | 4);
+}
+
+inline int clamp(int v, int high) {
+    return v < 0 ? 0 : (v > high ? high : v);
+}
+
+}
+
+ColorQuantizer::ColorQuantizer(int maxColors)
+: _maxColors(std::max(2, std::min(256, maxColors)))
+, _dither(false)
+, _bucketIndex(kKeyCount, -1)
+, _exceeded(false)
+, _pixels(0)
+, _colors(0)
+, _transparent(-1)
+, _error(0.0) {
+}
+
+void ColorQuantizer::addStrip(const QImage& canvasStrip) {
+    const QImage strip = canvasStrip.format() == ImageConvert::kCanvasFormat
+        ? canvasStrip
+        : canvasStrip.convertToFormat(ImageConvert::kCanvasFormat);
+
+    for (int y = 0; y < strip.height(); ++y) {
+        const auto row = reinterpret_cast<const QRgb*>(strip.constScanLine(y));
+        for (int x = 0; x < strip.width(); ++x) {
+            const uint p = row[x];
+            const int c[4] = { int(p >> 24), int((p >> 16) & 0xff), int((p >> 8) & 0xff), int(p & 0xff) };
+            const uint key = bucketKey(c[0], c[1], c[2], c[3]);
+            if (_bucketIndex[key] < 0) {
+                _bucketIndex[key] = int(_buckets.size());
+                _buckets.push_back(_Bucket());
+                _buckets.back().key = key;
+                _buckets.back().count = 0;
+                std::fill(_buckets.back().sum, _buckets.back().sum + 4, 0);
+                _buckets.back().sumSquares = 0;
+            }
+
+            auto& bucket = _buckets[_bucketIndex[key]];
+            ++bucket.count;
+            for (int ch = 0; ch < 4; ++ch) {
+                bucket.sum[ch] += c[ch];
+                bucket.sumSquares += c[ch] * c[ch];
+            }
+
+            // an exact palette as long as there are few enough distinct colors
+            if (!_exceeded && (x == 0 || p != row[x - 1]) && !_exact.contains(p)) {
+                if (_exact.size() < _maxColors)
+                    _exact.insert(p, _exact.size());
+                else
+                    _exceeded = true;
+            }
+        }
+    }
+    _pixels += quint64(strip.width()) * strip.height();
+}
+
+void ColorQuantizer::buildPalette() {
+    for (int ch = 0; ch < 4; ++ch)
+        _palette[ch].clear();
+    _cache.assign(kKeyCount, -1);
+    _errors[0].clear();
+    _errors[1].clear();
+    _colors = 0;
+    _transparent = -1;
+    _error = 0.0;
+
+    if (!_exceeded) {
+        _colors = std::max(1, _exact.size());
+        for (int ch = 0; ch < 4; ++ch)
+            _palette[ch].assign(_colors, 0);
+        for (auto it = _exact.constBegin(); it != _exact.constEnd(); ++it) {
+            const uint p = it.key();
+            _palette[0][it.value()] = int(p >> 24);
+            _palette[1][it.value()] = int((p >> 16) & 0xff);
+            _palette[2][it.value()] = int((p >> 8) & 0xff);
+            _palette[3][it.value()] = int(p & 0xff);
+        }
+        _transparent = _exact.value(0, _exact.isEmpty() ? 0 : -1);
+        return;
+    }
+
+    // the (nearly) transparent bucket gets an exact transparent entry of its own
+    std::vector<int> order;
+    for (size_t n = 0; n < _buckets.size(); ++n) {
+        if (_buckets[n].key == 0) {
+            _transparent = _colors++;
+            for (int ch = 0; ch < 4; ++ch)
+                _palette[ch].push_back(0);
+        } else {
+            order.push_back(int(n));
+        }
+    }
+
+    _medianCut(order, _maxColors - _colors);
+    _refine(order, kRefinePasses);
+
+    double squaredError = 0.0;
+    for (const auto& bucket : _buckets) {
+        const double count = double(bucket.count);
+        int index = _transparent;
+        if (bucket.key != 0) {
+            int mean[4];
+            for (int ch = 0; ch < 4; ++ch)
+                mean[ch] = int((bucket.sum[ch] + bucket.count / 2) / bucket.count);
+            index = _nearest(mean[0], mean[1], mean[2], mean[3]);
+        }
+        _cache[bucket.key] = short(index);
+
+        // sum of (p - c)^2 over the bucket, from its sums
+        squaredError += double(bucket.sumSquares);
+        for (int ch = 0; ch < 4; ++ch) {
+            const double c = _palette[ch][index];
+            squaredError += c * c * count - 2.0 * c * double(bucket.sum[ch]);
+        }
+    }
+    _error = _pixels ? std::sqrt(std::max(0.0, squaredError) / (4.0 * _pixels)) : 0.0;
+}
+
+QVector<QRgb> ColorQuantizer::colorTable() const {
+    QVector<QRgb> table;
+    table.reserve(_colors);
+    for (int n = 0; n < _colors; ++n) {
+        const int a = _palette[0][n];
+        if (!a) {
+            table.append(0);
+            continue;
+        }
+        table.append(qRgba(std::min(255, (_palette[1][n] * 255 + a / 2) / a),
+                           std::min(255, (_palette[2][n] * 255 + a / 2) / a),
+                           std::min(255, (_palette[3][n] * 255 + a / 2) / a), a));
+    }
+    return table;
+}
+
+void ColorQuantizer::mapRow(uchar* dst, const QRgb* src, int width) {
+    if (!_exceeded) {
+        for (int x = 0; x < width; ++x) {
+            if (x > 0 && src[x] == src[x - 1]) {
+                dst[x] = dst[x - 1];
+                continue;
+            }
+            const auto it = _exact.constFind(src[x]);
+            dst[x] = uchar(it != _exact.constEnd() ? it.value() : _lookup(bucketKey(src[x])));
+        }
+        return;
+    }
+
+    if (_dither) {
+        _ditherRow(dst, src, width);
+        return;
+    }
+
+    for (int x = 0; x < width; ++x)
+        dst[x] = uchar(_lookup(bucketKey(src[x])));
+}
+
+QImage ColorQuantizer::quantize(const QImage& canvas) {
+    const QImage source = canvas.format() == ImageConvert::kCanvasFormat
+        ? canvas
+        : canvas.convertToFormat(ImageConvert::kCanvasFormat);
+
+    addStrip(source);
+    buildPalette();
+
+    QImage result(source.size(), QImage::Format_Indexed8);
+    result.setColorTable(colorTable());
+    for (int y = 0; y < source.height(); ++y)
+        mapRow(result.scanLine(y), reinterpret_cast<const QRgb*>(source.constScanLine(y)), source.width());
+    return result;
+}
+
+// Splits the box with the largest squared error at the weighted median of its
+// widest channel until there are enough boxes; each box gives its mean color.
+void ColorQuantizer::_medianCut(std::vector<int>& order, int colors) {
+    if (order.empty())
+        return;
+
+    std::vector<_Box> boxes(1);
+    boxes[0].begin = 0;
+    boxes[0].end = order.size();
+    _measure(boxes[0], order);
+
+    while (int(boxes.size()) < colors) {
+        auto box = std::max_element(boxes.begin(), boxes.end(), [](const _Box& a, const _Box& b) {
+            return a.score < b.score;
+        });
+        if (box->score <= 0.0)
+            break;
+
+        const int ch = box->channel;
+        std::sort(order.begin() + box->begin, order.begin() + box->end, [this, ch](int a, int b) {
+            return double(_buckets[a].sum[ch]) / _buckets[a].count < double(_buckets[b].sum[ch]) / _buckets[b].count;
+        });
+
+        quint64 total = 0;
+        for (size_t n = box->begin; n < box->end; ++n)
+            total += _buckets[order[n]].count;
+        size_t split = box->begin + 1;
+        quint64 accumulated = 0;
+        for (size_t n = box->begin; n < box->end - 1; ++n) {
+            accumulated += _buckets[order[n]].count;
+            split = n + 1;
+            if (accumulated * 2 >= total)
+                break;
+        }
+
+        _Box upper;
+        upper.begin = split;
+        upper.end = box->end;
+        box->end = split;
+        _measure(*box, order);
+        _measure(upper, order);
+        boxes.push_back(upper);
+    }
+
+    for (const auto& box : boxes) {
+        quint64 count = 0;
+        quint64 sum[4] = { 0, 0, 0, 0 };
+        for (size_t n = box.begin; n < box.end; ++n) {
+            const auto& bucket = _buckets[order[n]];
+            count += bucket.count;
+            for (int ch = 0; ch < 4; ++ch)
+                sum[ch] += bucket.sum[ch];
+        }
+        for (int ch = 0; ch < 4; ++ch)
+            _palette[ch].push_back(int((sum[ch] + count / 2) / count));
+        ++_colors;
+    }
+}
+
+// k-means passes over the bucket means, starting from the median cut palette.
+// The transparent entry stays put.
+void ColorQuantizer::_refine(const std::vector<int>& order, int passes) {
+    for (int pass = 0; pass < passes; ++pass) {
+        std::vector<double> sums(_colors * 4, 0.0);
+        std::vector<double> counts(_colors, 0.0);
+        for (int n : order) {
+            const auto& bucket = _buckets[n];
+            int mean[4];
+            for (int ch = 0; ch < 4; ++ch)
+                mean[ch] = int((bucket.sum[ch] + bucket.count / 2) / bucket.count);
+            const int index = _nearest(mean[0], mean[1], mean[2], mean[3]);
+            counts[index] += double(bucket.count);
+            for (int ch = 0; ch < 4; ++ch)
+                sums[index * 4 + ch] += double(bucket.sum[ch]);
+        }
+
+        for (int index = 0; index < _colors; ++index) {
+            if (index == _transparent || counts[index] == 0.0)
+                continue;
+            for (int ch = 0; ch < 4; ++ch)
+                _palette[ch][index] = int(sums[index * 4 + ch] / counts[index] + 0.5);
+        }
+    }
+}
+
+// Sum of the per channel squared deviations of the bucket means in the box,
+// weighted by pixel count, and the channel contributing most of it.
+void ColorQuantizer::_measure(_Box& box, const std::vector<int>& order) const {
+    double count = 0.0;
+    double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    double squares[4] = { 0.0, 0.0, 0.0, 0.0 };
+    for (size_t n = box.begin; n < box.end; ++n) {
+        const auto& bucket = _buckets[order[n]];
+        const double c = double(bucket.count);
+        count += c;
+        for (int ch = 0; ch < 4; ++ch) {
+            const double mean = double(bucket.sum[ch]) / c;
+            sum[ch] += mean * c;
+            squares[ch] += mean * mean * c;
+        }
+    }
+
+    box.score = 0.0;
+    box.channel = 0;
+    double widest = -1.0;
+    for (int ch = 0; ch < 4; ++ch) {
+        const double deviation = squares[ch] - sum[ch] * sum[ch] / count;
+        box.score += deviation;
+        if (deviation > widest) {
+            widest = deviation;
+            box.channel = ch;
+        }
+    }
+    if (box.end - box.begin < 2)
+        box.score = 0.0;
+}
+
+int ColorQuantizer::_nearest(int a, int r, int g, int b) const {
+    const int* pa = _palette[0].data();
+    const int* pr = _palette[1].data();
+    const int* pg = _palette[2].data();
+    const int* pb = _palette[3].data();
+
+    int distances[256];
+    for (int n = 0; n < _colors; ++n) {
+        const int da = pa[n] - a;
+        const int dr = pr[n] - r;
+        const int dg = pg[n] - g;
+        const int db = pb[n] - b;
+        distances[n] = da * da + dr * dr + dg * dg + db * db;
+    }
+
+    int best = 0;
+    int bestDistance = INT_MAX;
+    for (int n = 0; n < _colors; ++n) {
+        if (distances[n] < bestDistance) {
+            bestDistance = distances[n];
+            best = n;
+        }
+    }
+    return best;
+}
+
+// Buckets the histogram saw map to the entry nearest their mean, which is what
+// error() measures; others are filled in on first use from the bucket center.
+int ColorQuantizer::_lookup(uint key) {
+    short& index = _cache[key];
+    if (index < 0)
+        index = short(_nearest(bucketCenter(key, 0), bucketCenter(key, 1), bucketCenter(key, 2), bucketCenter(key, 3)));
+    return index;
+}
+
+// Floyd-Steinberg in premultiplied space. Errors are kept in sixteenths in two
+// rows with a spare pixel on each side; transparent pixels neither take nor
+// pass on any error, so sprite edges don't bleed into the padding.
+void ColorQuantizer::_ditherRow(uchar* dst, const QRgb* src, int width) {
+    const size_t size = size_t(width + 2) * 4;
+    if (_errors[0].size() != size) {
+        _errors[0].assign(size, 0);
+        _errors[1].assign(size, 0);
+    }
+    int* current = _errors[0].data();
+    int* next = _errors[1].data();
+    std::fill(_errors[1].begin(), _errors[1].end(), 0);
+
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        if (!(p >> 24)) {
+            dst[x] = uchar(_transparent >= 0 ? _transparent : _lookup(0));
+            continue;
+        }
+
+        const int source[4] = { int(p >> 24), int((p >> 16) & 0xff), int((p >> 8) & 0xff), int(p & 0xff) };
+        int c[4];
+        c[0] = clamp(source[0] + current[(x + 1) * 4] / 16, 255);
+        for (int ch = 1; ch < 4; ++ch)
+            c[ch] = clamp(source[ch] + current[(x + 1) * 4 + ch] / 16, c[0]);
+
+        const int index = _lookup(bucketKey(c[0], c[1], c[2], c[3]));
+        dst[x] = uchar(index);
+        for (int ch = 0; ch < 4; ++ch) {
+            const int e = c[ch] - _palette[ch][index];
+            current[(x + 2) * 4 + ch] += e * 7;
+            next[x * 4 + ch] += e * 3;
+            next[(x + 1) * 4 + ch] += e * 5;
+            next[(x + 2) * 4 + ch] += e;
+        }
+    }
+    _errors[0].swap(_errors[1]);
+}
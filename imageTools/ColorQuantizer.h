@@ -0,0 +1,89 @@
+/* ColorQuantizer.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef COLORQUANTIZER_H
+#define COLORQUANTIZER_H
+
+#include <QImage>
+#include <QHash>
+#include <QVector>
+#include <vector>
+
+// Reduces a canvas (premultiplied ARGB32) to at most 256 colors. Pixels are
+// fed strip by strip into a histogram of 5 bits per channel, a median cut over
+// the histogram refined by a few k-means passes gives the palette, and rows are
+// then mapped strip by strip as well. Distances are taken between premultiplied
+// colors, so alpha weighs in and fully transparent pixels keep their own entry.
+class ColorQuantizer {
+public:
+    explicit ColorQuantizer(int maxColors = 256);
+
+    void setDither(bool dither) { _dither = dither; }
+
+    void addStrip(const QImage& canvasStrip);
+    void buildPalette();
+
+    // Straight alpha colors, as stored in png PLTE/tRNS chunks and Indexed8 images.
+    QVector<QRgb> colorTable() const;
+
+    // Root mean square error per channel, in 8-bit levels, of the undithered
+    // mapping of everything added so far. Known once the palette is built.
+    double error() const { return _error; }
+
+    // Maps a canvas row to palette indices. Dithering carries its error from one
+    // row to the next, so rows are expected in order from the top.
+    void mapRow(uchar* dst, const QRgb* src, int width);
+
+    // addStrip, buildPalette and mapRow over a whole canvas.
+    QImage quantize(const QImage& canvas);
+
+protected:
+    struct _Bucket {
+        uint    key;
+        quint64 count;
+        quint64 sum[4];
+        quint64 sumSquares;
+    };
+    struct _Box {
+        size_t begin;
+        size_t end;
+        double score;
+        int channel;
+    };
+
+    void _medianCut(std::vector<int>& order, int colors);
+    void _refine(const std::vector<int>& order, int passes);
+    void _measure(_Box& box, const std::vector<int>& order) const;
+    int _nearest(int a, int r, int g, int b) const;
+    int _lookup(uint key);
+    void _ditherRow(uchar* dst, const QRgb* src, int width);
+
+    int                     _maxColors;
+    bool                    _dither;
+    std::vector<int>        _bucketIndex;
+    std::vector<_Bucket>    _buckets;
+    QHash<QRgb, int>        _exact;
+    bool                    _exceeded;
+    quint64                 _pixels;
+    int                     _colors;
+    int                     _transparent;
+    std::vector<int>        _palette[4];
+    std::vector<short>      _cache;
+    std::vector<int>        _errors[2];
+    double                  _error;
+};
+
+#endif // COLORQUANTIZER_H
@@ -0,0 +1,102 @@
+/* CompressedTextureWriter.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "CompressedTextureWriter.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QIODevice>
+
+const uchar kKtxIdentifier[] = { 0xab, 'K', 'T', 'X', ' ', '1', '1', 0xbb, '\r', '\n', 0x1a, '\n' };
+const quint32 kKtxEndianness = 0x04030201;
+const quint32 kPvrVersion = 0x03525650;
+
+// OpenGL internal formats
+const quint32 kGlRgb = 0x1907;
+const quint32 kGlRgba = 0x1908;
+const quint32 kGlRgbaS3tcDxt1 = 0x83f1;
+const quint32 kGlRgbaS3tcDxt5 = 0x83f3;
+const quint32 kGlRgb8Etc2 = 0x9274;
+const quint32 kGlRgba8Etc2Eac = 0x9278;
+
+// PVR v3 compressed pixel formats
+const quint64 kPvrDxt1 = 7;
+const quint64 kPvrDxt5 = 11;
+const quint64 kPvrEtc2Rgb = 22;
+const quint64 kPvrEtc2Rgba = 23;
+
+bool CompressedTextureWriter::containerForPath(const QString& path, Container& container) {
+    const QString suffix = QFileInfo(path).suffix();
+    if (suffix.compare("pvr", Qt::CaseInsensitive) == 0)
+        container = PVR;
+    else if (suffix.compare("ktx", Qt::CaseInsensitive) == 0)
+        container = KTX;
+    else
+        return false;
+    return true;
+}
+
+bool CompressedTextureWriter::write(QIODevice* device, Container container, BlockEncoder::Format format, const QSize& size, const QByteArray& blocks) {
+    if (format == BlockEncoder::NONE)
+        return false;
+    return container == PVR ? _writePvr(device, format, size, blocks) : _writeKtx(device, format, size, blocks);
+}
+
+bool CompressedTextureWriter::_writeKtx(QIODevice* device, BlockEncoder::Format format, const QSize& size, const QByteArray& blocks) {
+    quint32 internalFormat = kGlRgbaS3tcDxt1;
+    switch (format) {
+    case BlockEncoder::BC3: internalFormat = kGlRgbaS3tcDxt5; break;
+    case BlockEncoder::ETC2_RGB: internalFormat = kGlRgb8Etc2; break;
+    case BlockEncoder::ETC2_RGBA: internalFormat = kGlRgba8Etc2Eac; break;
+    default: break;
+    }
+
+    if (device->write(reinterpret_cast<const char*>(kKtxIdentifier), sizeof(kKtxIdentifier)) != sizeof(kKtxIdentifier))
+        return false;
+
+    // written in the native byte order, which the endianness field announces
+    QDataStream out(device);
+    out.setByteOrder(QSysInfo::ByteOrder == QSysInfo::BigEndian ? QDataStream::BigEndian : QDataStream::LittleEndian);
+    out << kKtxEndianness
+        << quint32(0) << quint32(1) << quint32(0)   // glType, glTypeSize, glFormat: compressed
+        << internalFormat << (BlockEncoder::hasAlpha(format) ? kGlRgba : kGlRgb)
+        << quint32(size.width()) << quint32(size.height()) << quint32(0)
+        << quint32(0) << quint32(1) << quint32(1)   // array elements, faces, mipmap levels
+        << quint32(0)                               // key/value data
+        << quint32(blocks.size());
+    out.writeRawData(blocks.constData(), blocks.size());
+    return out.status() == QDataStream::Ok;
+}
+
+bool CompressedTextureWriter::_writePvr(QIODevice* device, BlockEncoder::Format format, const QSize& size, const QByteArray& blocks) {
+    quint64 pixelFormat = kPvrDxt1;
+    switch (format) {
+    case BlockEncoder::BC3: pixelFormat = kPvrDxt5; break;
+    case BlockEncoder::ETC2_RGB: pixelFormat = kPvrEtc2Rgb; break;
+    case BlockEncoder::ETC2_RGBA: pixelFormat = kPvrEtc2Rgba; break;
+    default: break;
+    }
+
+    QDataStream out(device);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << kPvrVersion << quint32(0) << pixelFormat
+        << quint32(0) << quint32(0)                 // linear color space, unsigned normalized bytes
+        << quint32(size.height()) << quint32(size.width()) << quint32(1)
+        << quint32(1) << quint32(1) << quint32(1)   // surfaces, faces, mipmap levels
+        << quint32(0);                              // metadata
+    out.writeRawData(blocks.constData(), blocks.size());
+    return out.status() == QDataStream::Ok;
+}
@@ -0,0 +1,43 @@
+/* CompressedTextureWriter.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef COMPRESSEDTEXTUREWRITER_H
+#define COMPRESSEDTEXTUREWRITER_H
+
+#include "BlockEncoder.h"
+
+#include <QByteArray>
+#include <QSize>
+#include <QString>
+
+class QIODevice;
+
+// Wraps the blocks of BlockEncoder in a single level KTX 1.1 or PVR v3 file.
+class CompressedTextureWriter {
+public:
+    enum Container { KTX, PVR };
+
+    // PVR for a .pvr path, KTX for a .ktx one, false for any other suffix.
+    static bool containerForPath(const QString& path, Container& container);
+
+    static bool write(QIODevice* device, Container container, BlockEncoder::Format format, const QSize& size, const QByteArray& blocks);
+
+protected:
+    static bool _writeKtx(QIODevice* device, BlockEncoder::Format format, const QSize& size, const QByteArray& blocks);
+    static bool _writePvr(QIODevice* device, BlockEncoder::Format format, const QSize& size, const QByteArray& blocks);
+};
+
+#endif // COMPRESSEDTEXTUREWRITER_H
@@ -0,0 +1,181 @@
+/* ImageConvert.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "ImageConvert.h"
+#include <QVector>
+
+// The kernels below are plain branch-free loops over whole rows so the compiler
+// can vectorize them; the canvas is always read as native-endian 0xAARRGGBB.
+
+namespace {
+
+struct UnpremultiplyTable {
+    UnpremultiplyTable() {
+        inv[0] = 0;
+        for (uint a = 1; a < 256; ++a)
+            inv[a] = (255 * 65536 + a / 2) / a;
+    }
+    uint inv[256];
+};
+
+inline const uint* unpremultiplyTable() {
+    static const UnpremultiplyTable table;
+    return table.inv;
+}
+
+inline uint unpremultiply(uint c, uint inv) {
+    const uint v = (c * inv + 0x8000) >> 16;
+    return v > 255 ? 255 : v;
+}
+
+}
+
+QImage ImageConvert::convert(const QImage& canvas, QImage::Format format) {
+    if (canvas.format() != kCanvasFormat)
+        return convert(canvas.convertToFormat(kCanvasFormat), format);
+
+    QImage result(canvas.size(), storedFormat(format));
+    if (result.format() == QImage::Format_Mono)
+        result.setColorTable(QVector<QRgb>() << qRgb(0, 0, 0) << qRgb(255, 255, 255));
+
+    const int width = canvas.width();
+    for (int y = 0; y < canvas.height(); ++y)
+        convertRow(result.scanLine(y), reinterpret_cast<const QRgb*>(canvas.constScanLine(y)), width, format);
+    return result;
+}
+
+void ImageConvert::convertRow(uchar* dst, const QRgb* src, int width, QImage::Format format) {
+    switch (format) {
+    case QImage::Format_RGBA8888_Premultiplied: _toRGBA8888Premultiplied(dst, src, width); break;
+    case QImage::Format_RGB888: _toRGB888(dst, src, width); break;
+    case QImage::Format_RGB666: _toRGB666(dst, src, width); break;
+    case QImage::Format_RGB555: _toRGB555(dst, src, width); break;
+    case QImage::Format_RGB444: _toRGB444(dst, src, width); break;
+    case QImage::Format_Alpha8: _toAlpha8(dst, src, width); break;
+    case QImage::Format_Grayscale8: _toGrayscale8(dst, src, width); break;
+    case QImage::Format_Mono: _toMono(dst, src, width); break;
+    default: _toRGBA8888(dst, src, width); break;
+    }
+}
+
+QImage::Format ImageConvert::storedFormat(QImage::Format format) {
+    switch (format) {
+    case QImage::Format_RGBA8888_Premultiplied:
+    case QImage::Format_Alpha8:
+    case QImage::Format_Grayscale8:
+    case QImage::Format_Mono:
+        return format;
+    case QImage::Format_RGB888:
+    case QImage::Format_RGB666:
+    case QImage::Format_RGB555:
+    case QImage::Format_RGB444:
+        return QImage::Format_RGB888;
+    default:
+        return QImage::Format_RGBA8888;
+    }
+}
+
+void ImageConvert::_toRGBA8888(uchar* dst, const QRgb* src, int width) {
+    const uint* inv = unpremultiplyTable();
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        const uint a = p >> 24;
+        dst[x * 4 + 0] = uchar(unpremultiply((p >> 16) & 0xff, inv[a]));
+        dst[x * 4 + 1] = uchar(unpremultiply((p >> 8) & 0xff, inv[a]));
+        dst[x * 4 + 2] = uchar(unpremultiply(p & 0xff, inv[a]));
+        dst[x * 4 + 3] = uchar(a);
+    }
+}
+
+void ImageConvert::_toRGBA8888Premultiplied(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        dst[x * 4 + 0] = uchar(p >> 16);
+        dst[x * 4 + 1] = uchar(p >> 8);
+        dst[x * 4 + 2] = uchar(p);
+        dst[x * 4 + 3] = uchar(p >> 24);
+    }
+}
+
+// Opaque formats keep the premultiplied values, i.e. sprites blended over black,
+// which is what painting straight into these formats used to produce.
+void ImageConvert::_toRGB888(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        dst[x * 3 + 0] = uchar(p >> 16);
+        dst[x * 3 + 1] = uchar(p >> 8);
+        dst[x * 3 + 2] = uchar(p);
+    }
+}
+
+void ImageConvert::_toRGB666(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        const uint r = (p >> 16) & 0xfc;
+        const uint g = (p >> 8) & 0xfc;
+        const uint b = p & 0xfc;
+        dst[x * 3 + 0] = uchar(r | (r >> 6));
+        dst[x * 3 + 1] = uchar(g | (g >> 6));
+        dst[x * 3 + 2] = uchar(b | (b >> 6));
+    }
+}
+
+void ImageConvert::_toRGB555(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        const uint r = (p >> 16) & 0xf8;
+        const uint g = (p >> 8) & 0xf8;
+        const uint b = p & 0xf8;
+        dst[x * 3 + 0] = uchar(r | (r >> 5));
+        dst[x * 3 + 1] = uchar(g | (g >> 5));
+        dst[x * 3 + 2] = uchar(b | (b >> 5));
+    }
+}
+
+void ImageConvert::_toRGB444(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        const uint r = (p >> 16) & 0xf0;
+        const uint g = (p >> 8) & 0xf0;
+        const uint b = p & 0xf0;
+        dst[x * 3 + 0] = uchar(r | (r >> 4));
+        dst[x * 3 + 1] = uchar(g | (g >> 4));
+        dst[x * 3 + 2] = uchar(b | (b >> 4));
+    }
+}
+
+void ImageConvert::_toAlpha8(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x)
+        dst[x] = uchar(src[x] >> 24);
+}
+
+void ImageConvert::_toGrayscale8(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        dst[x] = uchar((((p >> 16) & 0xff) * 11 + ((p >> 8) & 0xff) * 16 + (p & 0xff) * 5) >> 5);
+    }
+}
+
+// Threshold (not dithered) 1-bit output, most significant bit first.
+void ImageConvert::_toMono(uchar* dst, const QRgb* src, int width) {
+    for (int x = 0; x < (width + 7) / 8; ++x)
+        dst[x] = 0;
+    for (int x = 0; x < width; ++x) {
+        const uint p = src[x];
+        const uint gray = (((p >> 16) & 0xff) * 11 + ((p >> 8) & 0xff) * 16 + (p & 0xff) * 5) >> 5;
+        dst[x >> 3] |= uchar((gray >> 7) << (7 - (x & 7)));
+    }
+}
@@ -0,0 +1,49 @@
+/* ImageConvert.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef IMAGECONVERT_H
+#define IMAGECONVERT_H
+
+#include <QImage>
+
+// Sprites are composited into an ARGB32_Premultiplied canvas (the format QPainter
+// blends fastest) and converted to the requested output format once, row by row.
+class ImageConvert {
+public:
+    static const QImage::Format kCanvasFormat = QImage::Format_ARGB32_Premultiplied;
+
+    static QImage convert(const QImage& canvas, QImage::Format format);
+
+    // Converts a single canvas row. dst must hold a row of storedFormat(format).
+    static void convertRow(uchar* dst, const QRgb* src, int width, QImage::Format format);
+
+    // Reduced RGB formats are quantized and stored bit-replicated as RGB888,
+    // which is exactly what the png writer would expand them to anyway.
+    static QImage::Format storedFormat(QImage::Format format);
+
+protected:
+    static void _toRGBA8888(uchar* dst, const QRgb* src, int width);
+    static void _toRGBA8888Premultiplied(uchar* dst, const QRgb* src, int width);
+    static void _toRGB888(uchar* dst, const QRgb* src, int width);
+    static void _toRGB666(uchar* dst, const QRgb* src, int width);
+    static void _toRGB555(uchar* dst, const QRgb* src, int width);
+    static void _toRGB444(uchar* dst, const QRgb* src, int width);
+    static void _toAlpha8(uchar* dst, const QRgb* src, int width);
+    static void _toGrayscale8(uchar* dst, const QRgb* src, int width);
+    static void _toMono(uchar* dst, const QRgb* src, int width);
+};
+
+#endif // IMAGECONVERT_H
@@ -0,0 +1,248 @@
+/* ImageScale.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "ImageScale.h"
+#include <QPainter>
+
+#include <algorithm>
+#include <cmath>
+
+// Pixels are expanded to premultiplied linear-light float4 rows, filtered
+// horizontally then vertically with precomputed weight lists, and encoded
+// back to sRGB. Inner loops run over contiguous float rows so they vectorize.
+
+namespace {
+
+const int kLinearToSrgbSize = 16384;
+const float kPi = 3.14159265358979f;
+
+struct SrgbTables {
+    SrgbTables() {
+        for (int n = 0; n < 256; ++n) {
+            const float c = n / 255.0f;
+            toLinear[n] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int n = 0; n < kLinearToSrgbSize; ++n) {
+            const float l = n / float(kLinearToSrgbSize - 1);
+            const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            fromLinear[n] = uchar(std::min(255.0f, c * 255.0f + 0.5f));
+        }
+    }
+    float toLinear[256];
+    uchar fromLinear[kLinearToSrgbSize];
+};
+
+inline const SrgbTables& srgbTables() {
+    static const SrgbTables tables;
+    return tables;
+}
+
+inline float sinc(float x) {
+    if (x == 0.0f)
+        return 1.0f;
+    x *= kPi;
+    return std::sin(x) / x;
+}
+
+inline float clamp01(float v) {
+    return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+}
+
+QSize ImageScale::scaledSizeToWidth(const QSize& size, int width) {
+    if (width <= 0 || size.width() <= 0)
+        return QSize();
+    const qreal factor = qreal(width) / size.width();
+    return QSize(width, int(factor * size.height() + 0.9999));
+}
+
+QImage ImageScale::scale(const QImage& source, const QSize& targetSize, Filter filter) {
+    QRect targetRect;
+    const auto window = scale(source, QRect(QPoint(0, 0), source.size()), source.size(), targetSize, filter, targetRect);
+    if (window.isNull() || targetRect == QRect(QPoint(0, 0), targetSize))
+        return window;
+
+    QImage result(targetSize, QImage::Format_ARGB32);
+    result.fill(Qt::transparent);
+    QPainter painter(&result);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(targetRect.topLeft(), window);
+    painter.end();
+    return result;
+}
+
+QImage ImageScale::scale(const QImage& source, const QRect& sourceRect, const QSize& sourceSize,
+                         const QSize& targetSize, Filter filter, QRect& targetRect) {
+    targetRect = QRect();
+    if (source.isNull() || targetSize.isEmpty() || sourceSize.isEmpty() || source.size() != sourceRect.size())
+        return QImage();
+
+    const QImage argb = source.format() == QImage::Format_ARGB32 ? source : source.convertToFormat(QImage::Format_ARGB32);
+
+    int targetX, targetY;
+    const auto horizontal = _contributions(sourceSize.width(), sourceRect.x(), sourceRect.width(), targetSize.width(), filter, targetX);
+    const auto vertical = _contributions(sourceSize.height(), sourceRect.y(), sourceRect.height(), targetSize.height(), filter, targetY);
+    if (horizontal.empty() || vertical.empty())
+        return QImage();
+
+    const int srcW = sourceRect.width();
+    const int srcH = sourceRect.height();
+    const int dstW = int(horizontal.size());
+    const int dstH = int(vertical.size());
+    const auto& tables = srgbTables();
+
+    // horizontal pass, one source row at a time
+    std::vector<float> row(srcW * 4);
+    std::vector<float> columns(dstW * srcH * 4, 0.0f);
+    for (int y = 0; y < srcH; ++y) {
+        const auto line = reinterpret_cast<const QRgb*>(argb.constScanLine(y));
+        for (int x = 0; x < srcW; ++x) {
+            const float a = qAlpha(line[x]) / 255.0f;
+            row[x * 4 + 0] = tables.toLinear[qRed(line[x])] * a;
+            row[x * 4 + 1] = tables.toLinear[qGreen(line[x])] * a;
+            row[x * 4 + 2] = tables.toLinear[qBlue(line[x])] * a;
+            row[x * 4 + 3] = a;
+        }
+
+        float* out = &columns[y * dstW * 4];
+        for (int x = 0; x < dstW; ++x) {
+            const auto& c = horizontal[x];
+            const float* in = row.data() + c.first * 4;
+            float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (size_t n = 0; n < c.weights.size(); ++n) {
+                const float w = c.weights[n];
+                for (int k = 0; k < 4; ++k)
+                    acc[k] += in[n * 4 + k] * w;
+            }
+            for (int k = 0; k < 4; ++k)
+                out[x * 4 + k] = acc[k];
+        }
+    }
+
+    // vertical pass, whole rows at a time
+    QImage result(dstW, dstH, QImage::Format_ARGB32);
+    std::vector<float> acc(dstW * 4);
+    for (int y = 0; y < dstH; ++y) {
+        const auto& c = vertical[y];
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for (size_t n = 0; n < c.weights.size(); ++n) {
+            const float w = c.weights[n];
+            const float* in = columns.data() + (c.first + n) * dstW * 4;
+            for (int x = 0; x < dstW * 4; ++x)
+                acc[x] += in[x] * w;
+        }
+
+        auto line = reinterpret_cast<QRgb*>(result.scanLine(y));
+        for (int x = 0; x < dstW; ++x) {
+            const float a = clamp01(acc[x * 4 + 3]);
+            if (a <= 0.0f) {
+                line[x] = 0;
+                continue;
+            }
+            const float scale = (kLinearToSrgbSize - 1) / a;
+            const int r = int(std::min(a, std::max(0.0f, acc[x * 4 + 0])) * scale + 0.5f);
+            const int g = int(std::min(a, std::max(0.0f, acc[x * 4 + 1])) * scale + 0.5f);
+            const int b = int(std::min(a, std::max(0.0f, acc[x * 4 + 2])) * scale + 0.5f);
+            line[x] = qRgba(tables.fromLinear[r], tables.fromLinear[g], tables.fromLinear[b], int(a * 255.0f + 0.5f));
+        }
+    }
+
+    targetRect = QRect(targetX, targetY, dstW, dstH);
+    return result;
+}
+
+float ImageScale::_support(Filter filter) {
+    switch (filter) {
+    case BOX: return 0.5f;
+    case BILINEAR: return 1.0f;
+    case LANCZOS3: return 3.0f;
+    }
+    return 1.0f;
+}
+
+float ImageScale::_weight(Filter filter, float x) {
+    x = std::fabs(x);
+    switch (filter) {
+    case BOX: return x < 0.5f ? 1.0f : 0.0f;
+    case BILINEAR: return x < 1.0f ? 1.0f - x : 0.0f;
+    case LANCZOS3: return x < 3.0f ? sinc(x) * sinc(x / 3.0f) : 0.0f;
+    }
+    return 0.0f;
+}
+
+// Weights are normalized over the whole virtual source line so that a window
+// gives exactly the pixels a full-size scale would, then restricted to the
+// sourceCount pixels starting at sourceFirst (the only non-transparent ones).
+ImageScale::Contributions ImageScale::_contributions(int sourceLength, int sourceFirst, int sourceCount,
+                                                     int targetLength, Filter filter, int& targetFirst) {
+    const float scale = float(targetLength) / sourceLength;
+    const float stretch = std::max(1.0f, 1.0f / scale);
+    const float support = _support(filter) * stretch;
+    const int sourceEnd = sourceFirst + sourceCount;
+
+    const int from = std::max(0, int(std::floor((sourceFirst - support) * scale)) - 1);
+    const int to = std::min(targetLength, int(std::ceil((sourceEnd + support) * scale)) + 1);
+
+    Contributions result;
+    targetFirst = -1;
+    int lastUsed = -1;
+    for (int t = from; t < to; ++t) {
+        int left, right;
+        std::vector<float> weights;
+        if (filter == BOX) {
+            // exact area coverage of the target pixel footprint
+            const float begin = t / scale;
+            const float end = (t + 1) / scale;
+            left = std::max(0, int(std::floor(begin)));
+            right = std::min(sourceLength, int(std::ceil(end)));
+            for (int s = left; s < right; ++s)
+                weights.push_back(std::max(0.0f, std::min(s + 1.0f, end) - std::max(float(s), begin)));
+        } else {
+            const float center = (t + 0.5f) / scale;
+            left = std::max(0, int(std::floor(center - support)));
+            right = std::min(sourceLength, int(std::ceil(center + support)));
+            for (int s = left; s < right; ++s)
+                weights.push_back(_weight(filter, (s + 0.5f - center) / stretch));
+        }
+
+        float total = 0.0f;
+        for (auto w : weights)
+            total += w;
+
+        Contribution contribution;
+        contribution.first = std::max(left, sourceFirst) - sourceFirst;
+        bool reaches = false;
+        if (total != 0.0f) {
+            for (int s = std::max(left, sourceFirst); s < std::min(right, sourceEnd); ++s) {
+                const float w = weights[s - left] / total;
+                contribution.weights.push_back(w);
+                reaches = reaches || w != 0.0f;
+            }
+        }
+
+        if (targetFirst < 0 && !reaches)
+            continue;
+        if (targetFirst < 0)
+            targetFirst = t;
+        if (reaches)
+            lastUsed = t;
+        result.push_back(contribution);
+    }
+
+    result.resize(lastUsed - targetFirst + 1 > 0 && targetFirst >= 0 ? lastUsed - targetFirst + 1 : 0);
+    return result;
+}
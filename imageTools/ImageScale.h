@@ -0,0 +1,58 @@
+/* ImageScale.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef IMAGESCALE_H
+#define IMAGESCALE_H
+
+#include <QImage>
+#include <QRect>
+#include <vector>
+
+// Separable resampler working on premultiplied linear-light pixels.
+class ImageScale {
+public:
+    enum Filter {
+        BOX,
+        BILINEAR,
+        LANCZOS3
+    };
+
+    // Size QImage::scaledToWidth() would produce for the given width.
+    static QSize scaledSizeToWidth(const QSize& size, int width);
+
+    static QImage scale(const QImage& source, const QSize& targetSize, Filter filter);
+
+    // source holds the pixels of sourceRect inside a virtual image of sourceSize,
+    // everything outside of it being fully transparent. Only the target pixels that
+    // source can reach are computed: they are returned, and targetRect receives
+    // their place inside the virtual target image of targetSize.
+    static QImage scale(const QImage& source, const QRect& sourceRect, const QSize& sourceSize,
+                        const QSize& targetSize, Filter filter, QRect& targetRect);
+
+protected:
+    struct Contribution {
+        int                 first;
+        std::vector<float>  weights;
+    };
+    typedef std::vector<Contribution> Contributions;
+
+    static float _support(Filter filter);
+    static float _weight(Filter filter, float x);
+    static Contributions _contributions(int sourceLength, int sourceFirst, int sourceCount,
+                                        int targetLength, Filter filter, int& targetFirst);
+};
+
+#endif // IMAGESCALE_H
@@ -24,8 +24,6 @@ class QImage;
 class ImageTrim {
 public:
     static QImage createImage(const QImage& sourceImage, bool maxAlphaValue, QRect& cropRect);
-
-protected:
     static QRect getBoundingBox(const QImage& sourceImage, bool maxAlphaValue);
 };
 
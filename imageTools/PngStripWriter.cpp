@@ -0,0 +1,246 @@
+/* PngStripWriter.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "PngStripWriter.h"
+#include "ImageConvert.h"
+#include "ColorQuantizer.h"
+
+#include <QIODevice>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+const int kIdatChunkSize = 1 << 16;
+const uchar kPngSignature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void _appendUInt32(QByteArray& out, quint32 value) {
+    out.append(char(value >> 24));
+    out.append(char(value >> 16));
+    out.append(char(value >> 8));
+    out.append(char(value));
+}
+
+static int _paeth(int a, int b, int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+PngStripWriter::PngStripWriter(QIODevice* device, const QSize& size, QImage::Format outputFormat)
+: _device(device)
+, _size(size)
+, _outputFormat(outputFormat)
+, _quantizer(nullptr)
+, _rowsWritten(0)
+, _ok(true) {
+    const auto stored = ImageConvert::storedFormat(outputFormat);
+    _bitDepth = stored == QImage::Format_Mono ? 1 : 8;
+    switch (stored) {
+    case QImage::Format_Mono:
+    case QImage::Format_Grayscale8: _channels = 1; break;
+    case QImage::Format_Alpha8: _channels = 2; break;
+    case QImage::Format_RGB888: _channels = 3; break;
+    default: _channels = 4; break;
+    }
+    _init();
+}
+
+PngStripWriter::PngStripWriter(QIODevice* device, const QSize& size, ColorQuantizer* quantizer)
+: _device(device)
+, _size(size)
+, _outputFormat(QImage::Format_Indexed8)
+, _quantizer(quantizer)
+, _channels(1)
+, _bitDepth(8)
+, _rowsWritten(0)
+, _ok(true) {
+    _init();
+}
+
+void PngStripWriter::_init() {
+    _rowBytes = (_size.width() * _channels * _bitDepth + 7) / 8;
+    _converted.resize(_size.width() * 4);
+    _previous.assign(_rowBytes, 0);
+    _filtered.resize(_rowBytes + 1);
+    _candidate.resize(_rowBytes + 1);
+
+    auto stream = new z_stream();
+    stream->zalloc = Z_NULL;
+    stream->zfree = Z_NULL;
+    stream->opaque = Z_NULL;
+    _ok = deflateInit(stream, Z_DEFAULT_COMPRESSION) == Z_OK;
+    _stream = stream;
+
+    _ok = _ok && _writeHeader() && (!_quantizer || _writePalette());
+}
+
+PngStripWriter::~PngStripWriter() {
+    auto stream = static_cast<z_stream*>(_stream);
+    deflateEnd(stream);
+    delete stream;
+}
+
+bool PngStripWriter::writeStrip(const QImage& canvasStrip) {
+    if (!_ok || canvasStrip.width() != _size.width() || _rowsWritten + canvasStrip.height() > _size.height())
+        return false;
+
+    const QImage strip = canvasStrip.format() == ImageConvert::kCanvasFormat
+        ? canvasStrip
+        : canvasStrip.convertToFormat(ImageConvert::kCanvasFormat);
+
+    // png stores straight alpha, so premultiplied output is written unpremultiplied
+    const auto kernelFormat = _outputFormat == QImage::Format_RGBA8888_Premultiplied
+        ? QImage::Format_RGBA8888
+        : _outputFormat;
+
+    for (int y = 0; y < strip.height() && _ok; ++y) {
+        const auto src = reinterpret_cast<const QRgb*>(strip.constScanLine(y));
+        if (_quantizer) {
+            _quantizer->mapRow(_converted.data(), src, _size.width());
+        } else if (ImageConvert::storedFormat(kernelFormat) == QImage::Format_Alpha8) {
+            // written as black gray + alpha
+            ImageConvert::convertRow(_converted.data() + _size.width(), src, _size.width(), kernelFormat);
+            for (int x = 0; x < _size.width(); ++x) {
+                _converted[x * 2] = 0;
+                _converted[x * 2 + 1] = _converted[_size.width() + x];
+            }
+        } else {
+            ImageConvert::convertRow(_converted.data(), src, _size.width(), kernelFormat);
+        }
+        _filterRow(_converted.data());
+        _ok = _deflate(_filtered.data(), int(_filtered.size()), false);
+        ++_rowsWritten;
+    }
+    return _ok;
+}
+
+bool PngStripWriter::finish() {
+    if (!_ok || _rowsWritten != _size.height())
+        return false;
+
+    _ok = _deflate(nullptr, 0, true) && _writeChunk("IEND", QByteArray());
+    return _ok;
+}
+
+bool PngStripWriter::_writeHeader() {
+    if (_device->write(reinterpret_cast<const char*>(kPngSignature), sizeof(kPngSignature)) != sizeof(kPngSignature))
+        return false;
+
+    QByteArray header;
+    _appendUInt32(header, _size.width());
+    _appendUInt32(header, _size.height());
+    header.append(char(_bitDepth));
+    const char colorTypes[] = { 0, 0, 4, 2, 6 };
+    header.append(_quantizer ? char(3) : colorTypes[_channels]);
+    header.append(char(0)); // deflate
+    header.append(char(0)); // adaptive filtering
+    header.append(char(0)); // no interlace
+    return _writeChunk("IHDR", header);
+}
+
+// PLTE, plus tRNS up to the last entry that isn't opaque.
+bool PngStripWriter::_writePalette() {
+    const auto table = _quantizer->colorTable();
+    QByteArray palette;
+    QByteArray alpha;
+    for (int n = 0; n < table.size(); ++n) {
+        palette.append(char(qRed(table[n])));
+        palette.append(char(qGreen(table[n])));
+        palette.append(char(qBlue(table[n])));
+        alpha.append(char(qAlpha(table[n])));
+    }
+    while (!alpha.isEmpty() && uchar(alpha.at(alpha.size() - 1)) == 255)
+        alpha.chop(1);
+    return _writeChunk("PLTE", palette) && (alpha.isEmpty() || _writeChunk("tRNS", alpha));
+}
+
+bool PngStripWriter::_writeChunk(const char* type, const QByteArray& data) {
+    QByteArray chunk;
+    chunk.reserve(data.size() + 12);
+    _appendUInt32(chunk, data.size());
+    chunk.append(type, 4);
+    chunk.append(data);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(chunk.constData() + 4), uInt(data.size() + 4));
+    _appendUInt32(chunk, quint32(crc));
+
+    return _device->write(chunk) == chunk.size();
+}
+
+bool PngStripWriter::_deflate(const uchar* data, int length, bool last) {
+    auto stream = static_cast<z_stream*>(_stream);
+    stream->next_in = const_cast<Bytef*>(data);
+    stream->avail_in = uInt(length);
+
+    uchar buffer[kIdatChunkSize];
+    int ret;
+    do {
+        stream->next_out = buffer;
+        stream->avail_out = sizeof(buffer);
+        ret = deflate(stream, last ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_ERROR)
+            return false;
+
+        _output.append(reinterpret_cast<const char*>(buffer), int(sizeof(buffer) - stream->avail_out));
+        if (_output.size() >= kIdatChunkSize || (last && !_output.isEmpty())) {
+            if (!_writeChunk("IDAT", _output))
+                return false;
+            _output.clear();
+        }
+    } while (stream->avail_out == 0 || (last && ret != Z_STREAM_END));
+    return true;
+}
+
+// Picks the png filter with the smallest sum of absolute residuals per row,
+// the same heuristic libpng uses for its adaptive filtering. Palette indices
+// don't predict each other, so indexed rows are left unfiltered as libpng does.
+void PngStripWriter::_filterRow(const uchar* row) {
+    const int bpp = std::max(1, _channels * _bitDepth / 8);
+    const uchar* prior = _previous.data();
+    const int filters = _quantizer ? 1 : 5;
+    long bestSum = -1;
+
+    for (int filter = 0; filter < filters; ++filter) {
+        _candidate[0] = uchar(filter);
+        long sum = 0;
+        for (int i = 0; i < _rowBytes; ++i) {
+            const int a = i >= bpp ? row[i - bpp] : 0;
+            const int b = prior[i];
+            const int c = i >= bpp ? prior[i - bpp] : 0;
+            int predictor = 0;
+            switch (filter) {
+            case 1: predictor = a; break;
+            case 2: predictor = b; break;
+            case 3: predictor = (a + b) / 2; break;
+            case 4: predictor = _paeth(a, b, c); break;
+            }
+            const uchar value = uchar(row[i] - predictor);
+            _candidate[i + 1] = value;
+            sum += value < 128 ? value : 256 - value;
+        }
+        if (bestSum < 0 || sum < bestSum) {
+            bestSum = sum;
+            _filtered.swap(_candidate);
+        }
+    }
+    std::copy(row, row + _rowBytes, _previous.begin());
+}
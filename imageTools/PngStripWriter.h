@@ -0,0 +1,66 @@
+/* PngStripWriter.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef PNGSTRIPWRITER_H
+#define PNGSTRIPWRITER_H
+
+#include <QImage>
+#include <QByteArray>
+#include <vector>
+
+class QIODevice;
+class ColorQuantizer;
+
+// Encodes a png incrementally from horizontal strips of canvas rows, so the
+// whole atlas never has to exist in memory at once. Strips are given in the
+// canvas format and converted to the output format on the fly.
+class PngStripWriter {
+public:
+    PngStripWriter(QIODevice* device, const QSize& size, QImage::Format outputFormat);
+    // Indexed8 output: the palette and the mapping of rows come from a quantizer
+    // that has already built its palette.
+    PngStripWriter(QIODevice* device, const QSize& size, ColorQuantizer* quantizer);
+    ~PngStripWriter();
+
+    bool writeStrip(const QImage& canvasStrip);
+    bool finish();
+
+protected:
+    void _init();
+    bool _writeHeader();
+    bool _writePalette();
+    bool _writeChunk(const char* type, const QByteArray& data);
+    bool _deflate(const uchar* data, int length, bool last);
+    void _filterRow(const uchar* row);
+
+    QIODevice*          _device;
+    QSize               _size;
+    QImage::Format      _outputFormat;
+    ColorQuantizer*     _quantizer;
+    int                 _channels;
+    int                 _bitDepth;
+    int                 _rowBytes;
+    int                 _rowsWritten;
+    bool                _ok;
+    void*               _stream;
+    std::vector<uchar>  _converted;
+    std::vector<uchar>  _previous;
+    std::vector<uchar>  _filtered;
+    std::vector<uchar>  _candidate;
+    QByteArray          _output;
+};
+
+#endif // PNGSTRIPWRITER_H
@@ -0,0 +1,170 @@
+/* PolygonTrim.cpp
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#include "PolygonTrim.h"
+#include <QImage>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static double _cross(const QPointF& o, const QPointF& a, const QPointF& b) {
+    return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+}
+
+std::vector<QPoint> PolygonTrim::createOutline(const QImage& image, int maxVertices) {
+    const int width = image.width();
+    const int height = image.height();
+    const std::vector<QPoint> rect = { QPoint(0, 0), QPoint(width, 0), QPoint(width, height), QPoint(0, height) };
+    if (width < 2 || height < 2 || !image.hasAlphaChannel())
+        return rect;
+
+    const QImage argb = image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_ARGB32_Premultiplied
+        ? image
+        : image.convertToFormat(QImage::Format_ARGB32);
+
+    // the outer corners of the leftmost and rightmost visible pixel of every row
+    std::vector<QPointF> corners;
+    for (int y = 0; y < height; ++y) {
+        const auto row = reinterpret_cast<const QRgb*>(argb.constScanLine(y));
+        int left = 0;
+        while (left < width && !qAlpha(row[left]))
+            ++left;
+        if (left == width)
+            continue;
+        int right = width - 1;
+        while (!qAlpha(row[right]))
+            --right;
+
+        corners.push_back(QPointF(left, y));
+        corners.push_back(QPointF(left, y + 1));
+        corners.push_back(QPointF(right + 1, y));
+        corners.push_back(QPointF(right + 1, y + 1));
+    }
+
+    auto polygon = _convexHull(corners);
+    while (int(polygon.size()) > std::max(3, maxVertices) && _removeEdge(polygon, width, height)) {
+    }
+    if (int(polygon.size()) > std::max(3, maxVertices) || _area(polygon) >= 0.95 * width * height)
+        return rect;
+
+    // Round away from the centroid so the integer outline still covers every pixel.
+    QPointF centroid;
+    for (const auto& point : polygon)
+        centroid += point;
+    centroid /= polygon.size();
+
+    std::vector<QPoint> result;
+    for (const auto& point : polygon) {
+        const int x = point.x() < centroid.x() ? int(std::floor(point.x())) : int(std::ceil(point.x()));
+        const int y = point.y() < centroid.y() ? int(std::floor(point.y())) : int(std::ceil(point.y()));
+        const QPoint rounded(std::min(width, std::max(0, x)), std::min(height, std::max(0, y)));
+        if (result.empty() || (result.back() != rounded && result.front() != rounded))
+            result.push_back(rounded);
+    }
+    return result.size() < 3 ? rect : result;
+}
+
+std::vector<int> PolygonTrim::triangulate(const std::vector<QPoint>& outline) {
+    std::vector<int> result;
+    for (int n = 1; n + 1 < int(outline.size()); ++n) {
+        result.push_back(0);
+        result.push_back(n);
+        result.push_back(n + 1);
+    }
+    return result;
+}
+
+// Andrew's monotone chain.
+std::vector<QPointF> PolygonTrim::_convexHull(std::vector<QPointF> points) {
+    std::sort(points.begin(), points.end(), [](const QPointF& a, const QPointF& b) {
+        return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+    });
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    if (points.size() < 3)
+        return points;
+
+    std::vector<QPointF> hull(points.size() * 2);
+    size_t k = 0;
+    for (size_t n = 0; n < points.size(); ++n) {
+        while (k >= 2 && _cross(hull[k - 2], hull[k - 1], points[n]) <= 0)
+            --k;
+        hull[k++] = points[n];
+    }
+    for (size_t n = points.size() - 1, lower = k + 1; n > 0; --n) {
+        while (k >= lower && _cross(hull[k - 2], hull[k - 1], points[n - 1]) <= 0)
+            --k;
+        hull[k++] = points[n - 1];
+    }
+    hull.resize(k - 1);
+    return hull;
+}
+
+// Drops the edge whose removal (extending both neighbouring edges until they
+// meet) adds the least area while staying inside the sprite rectangle.
+bool PolygonTrim::_removeEdge(std::vector<QPointF>& polygon, double width, double height) {
+    const size_t count = polygon.size();
+    double bestArea = std::numeric_limits<double>::max();
+    size_t bestEdge = count;
+    QPointF bestPoint;
+
+    for (size_t n = 0; n < count; ++n) {
+        const auto& prev = polygon[(n + count - 1) % count];
+        const auto& a = polygon[n];
+        const auto& b = polygon[(n + 1) % count];
+        const auto& next = polygon[(n + 2) % count];
+
+        const QPointF d1 = a - prev;
+        const QPointF d2 = next - b;
+        const QPointF ab = b - a;
+        const double denominator = d1.x() * d2.y() - d1.y() * d2.x();
+        if (std::fabs(denominator) < 1e-9)
+            continue;
+
+        const double t = (ab.x() * d2.y() - ab.y() * d2.x()) / denominator;
+        const double u = (ab.x() * d1.y() - ab.y() * d1.x()) / denominator;
+        if (t < 0.0 || u > 0.0)
+            continue;
+
+        const QPointF point = a + d1 * t;
+        if (point.x() < -1e-6 || point.y() < -1e-6 || point.x() > width + 1e-6 || point.y() > height + 1e-6)
+            continue;
+
+        const double area = std::fabs(_cross(point, a, b)) / 2.0;
+        if (area < bestArea) {
+            bestArea = area;
+            bestEdge = n;
+            bestPoint = point;
+        }
+    }
+
+    if (bestEdge == count)
+        return false;
+
+    polygon[bestEdge] = bestPoint;
+    polygon.erase(polygon.begin() + (bestEdge + 1) % count);
+    return true;
+}
+
+double PolygonTrim::_area(const std::vector<QPointF>& polygon) {
+    double area = 0.0;
+    for (size_t n = 0; n < polygon.size(); ++n) {
+        const auto& a = polygon[n];
+        const auto& b = polygon[(n + 1) % polygon.size()];
+        area += a.x() * b.y() - b.x() * a.y();
+    }
+    return std::fabs(area) / 2.0;
+}
@@ -0,0 +1,41 @@
+/* PolygonTrim.h
+Copyright (C) 2015 Taras Tovchenko
+Email: doctorset@gmail.com
+
+You can redistribute and/or modify this software under the terms of the GNU
+General Public License as published by the Free Software Foundation;
+either version 2 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this
+program; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+Suite 330, Boston, MA 02111-1307 USA */
+
+#ifndef POLYGONTRIM_H
+#define POLYGONTRIM_H
+
+#include <QPoint>
+#include <QPointF>
+#include <vector>
+
+class QImage;
+
+class PolygonTrim {
+public:
+    // Convex outline around every visible pixel of the (already trimmed) image, in
+    // pixel corner coordinates, with at most maxVertices points.
+    static std::vector<QPoint> createOutline(const QImage& image, int maxVertices);
+
+    // Triangle indices into a convex outline.
+    static std::vector<int> triangulate(const std::vector<QPoint>& outline);
+
+protected:
+    static std::vector<QPointF> _convexHull(std::vector<QPointF> points);
+    static bool _removeEdge(std::vector<QPointF>& polygon, double width, double height);
+    static double _area(const std::vector<QPointF>& polygon);
+};
+
+#endif // POLYGONTRIM_H
@@ -26,7 +26,7 @@ QImage rotate90(const QImage &src);
 QImage rotate180(const QImage &src);
 QImage rotate270(const QImage &src);
 
-QImage rotate(int degrees, const QImage &src) {
+inline QImage rotate(int degrees, const QImage &src) {
     if (degrees == 90) {
         return rotate90(src);
     } else if (degrees == 180) {
@@ -39,7 +39,7 @@ QImage rotate(int degrees, const QImage &src) {
         return QImage();
     }
 }
-QImage rotate90(const QImage &src) {
+inline QImage rotate90(const QImage &src) {
     QImage dst(src.height(), src.width(), src.format());
     for (int y=0;y<src.height();++y) {
         const uint *srcLine = reinterpret_cast< const uint * >(src.scanLine(y));
@@ -49,7 +49,7 @@ QImage rotate90(const QImage &src) {
     }
     return dst;
 }
-QImage rotate180(const QImage &src) {
+inline QImage rotate180(const QImage &src) {
     QImage dst(src.width(), src.height(), src.format());
     for (int y=0;y<src.height();++y) {
         const uint *srcLine = reinterpret_cast< const uint * >(src.scanLine(y));
@@ -59,7 +59,7 @@ QImage rotate180(const QImage &src) {
     }
     return dst;
 }
-QImage rotate270(const QImage &src) {
+inline QImage rotate270(const QImage &src) {
     QImage dst(src.height(), src.width(), src.format());
     for (int y=0;y<src.height();++y) {
         const uint *srcLine = reinterpret_cast< const uint * >(src.scanLine(y));
@@ -75,16 +75,16 @@ QPixmap rotate(int degrees, const QPixmap &src);
 QPixmap rotate90(const QPixmap &src);
 QPixmap rotate180(const QPixmap &src);
 QPixmap rotate270(const QPixmap &src);
-QPixmap rotate(int degrees, const QPixmap &src) {
+inline QPixmap rotate(int degrees, const QPixmap &src) {
     return QPixmap::fromImage(rotate(degrees, src.toImage()));
 }
-QPixmap rotate90(const QPixmap &src) {
+inline QPixmap rotate90(const QPixmap &src) {
     return QPixmap::fromImage(rotate90(src.toImage()));
 }
-QPixmap rotate180(const QPixmap &src) {
+inline QPixmap rotate180(const QPixmap &src) {
     return QPixmap::fromImage(rotate180(src.toImage()));
 }
-QPixmap rotate270(const QPixmap &src) {
+inline QPixmap rotate270(const QPixmap &src) {
     return QPixmap::fromImage(rotate270(src.toImage()));
 }
 
@@ -0,0 +1,9 @@
+# Generator and its image tools as a static library, see Generator::generate
+# for packing in-memory images.
+
+TARGET = spriteglue
+CONFIG += staticlib
+
+TEMPLATE = lib
+
+include(../spriteglue.pri)
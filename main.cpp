@@ -18,29 +18,56 @@ Suite 330, Boston, MA 02111-1307 USA */
 #include <QCommandLineParser>
 
 #include "Generator.h"
+#include "Trace.h"
 
 const int kDefaultTextureSize = 4096;
 const auto kSheetInfo = "result texture path";
 const auto kDataInfo = "data file path (default: same path with texture)";
 const auto kScaleInfo = "scale image factor (default: 1)";
+const auto kScalesInfo = "comma separated scale factors, one sheet per factor named with an @Nx suffix (e.g. 1,0.5,0.25)";
+const auto kScaleFilterInfo = "resampling filter used by --scale (default: bilinear, available: box, lanczos3)";
 const auto kTrimInfo = "trims source images according to the mode (default: max-alpha, available: all-alpha, none)";
+const auto kPolygonInfo = "also writes a convex outline mesh with at most that many vertices for every sprite (default: 0, rectangles only)";
+const auto kAliasTransformsInfo = "also stores mirrored and rotated copies of a sprite as aliases of one atlas frame (default: only identical copies)";
 const auto kPaddingInfo = "general padding between sprites and border (default: 0)";
 const auto kMarginInfo = "distance between sprites (default: 1)";
 const auto kSuffixInfo = "path extension which will be used by the atlas data file (default: will be same as resulting texture)";
 const auto kMaxSizeWInfo = "max atlas width. if undefined it will use height instead (default: 4096)";
 const auto kMaxSizeHInfo = "max atlas height. if undefined it will use width instead (default: 4096)";
-const auto kFormatInfo = "color format of resulting texture (default: rgba8888, available: rgb888, rgb666, rgb555, rgb444, alpha8, grayscale8, mono, rgba8888p)";
+const auto kFormatInfo = "color format of resulting texture (default: rgba8888, available: rgb888, rgb666, rgb555, rgb444, alpha8, grayscale8, mono, rgba8888p, indexed8; block compressed into a .ktx or .pvr sheet: bc1, bc3, etc2, etc2a)";
+const auto kDitherInfo = "dithers indexed8 textures (default: nearest palette color)";
+const auto kMaxErrorInfo = "writes rgba8888 instead of indexed8 when the palette error (rms per channel, in 8-bit levels) is above it (default: 4)";
+const auto kBlockCacheInfo = "file keeping the compressed blocks of the last build, blocks of unchanged sprites are copied from it instead of encoded";
 const auto kSquareInfo = "makes texture width and height equal (default: isn\'t square)";
 const auto kPowerOf2Info = "makes texture power of 2 (default: isn\'t powerOf2)";
+const auto kTraceInfo = "writes a Chrome trace event file (chrome://tracing, ui.perfetto.dev) with the time spent in every phase";
+const auto kStatsInfo = "prints size search iterations, occupancy and packer counters for every texture";
+const auto kIncludeInfo = "only packs files matching the glob, may be repeated (a glob with / is matched against the path relative to the source directory, otherwise against the file name)";
+const auto kExcludeInfo = "skips files and directories matching the glob, may be repeated";
+const auto kDryRunInfo = "only reports the predicted texture size, occupancy and frame rectangles, nothing is composited or written";
+const auto kTrimCacheInfo = "file caching the trim rectangles of the source images, lets --dry-run skip decoding unchanged files";
+const auto kMemoryBudgetInfo = "memory for decoded sprites, the least recently used ones spill to a scratch file beyond it, with K/M/G suffixes (default: 1G, 0 for unlimited)";
+const auto kWriteBufferInfo = "queues up to that many bytes of output for a writer thread, with K/M/G suffixes, so encoding doesn't wait on slow network storage (default: 0, written directly)";
+const auto kForceInfo = "rebuilds even when the sources and options match the fingerprint recorded next to the texture";
+const auto kOptimizeTimeInfo = "after the greedy layout, searches sprite order and rotation on all cores for up to that long per texture (e.g. 30s, 2m) to fit a smaller one";
+const auto kGroupAnimationsInfo = "packs the frames of each animation (numbered files sharing a name, else a directory) next to each other and lists their regions in the data file";
+const auto kScenesInfo = "json manifest of the sprites every scene uses; splits the sprites into pages of the max size (sheet-0, sheet-1, ...) so each scene binds as few of them as it can";
+const auto kStripHeightInfo = "composites and encodes the texture in strips of that many rows to bound memory use (default: 0, whole texture at once)";
 
 static auto _printUsage()->void {
-    fprintf(stdout, "\n%s\n", qPrintable("spritesheet [path to directory with source images]"));
+    fprintf(stdout, "\n%s\n", qPrintable("spritesheet [path to directory, .zip or .tar with source images]"));
     fprintf(stdout, "\n%s\n", qPrintable("required:"));
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--sheet"), kSheetInfo);
     fprintf(stdout, "\n%s\n", qPrintable("optional:"));
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--data"), kDataInfo);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--scale"), kScaleInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--scales"), kScalesInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--scale-filter"), kScaleFilterInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--include"), kIncludeInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--exclude"), kExcludeInfo);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--trim"), kTrimInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--polygon"), kPolygonInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--alias-transforms"), kAliasTransformsInfo);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--padding"), kPaddingInfo);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--margin"), kMarginInfo);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--suffix"), kSuffixInfo);
@@ -49,6 +76,52 @@ static auto _printUsage()->void {
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--square"), kSquareInfo);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--powerOf2"), kPowerOf2Info);
     fprintf(stdout, "\t%s\t%s\n", qPrintable("--opt"), kFormatInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--dither"), kDitherInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--max-error"), kMaxErrorInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--block-cache"), kBlockCacheInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--strip-height"), kStripHeightInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--memory-budget"), kMemoryBudgetInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--write-buffer"), kWriteBufferInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--force"), kForceInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--optimize-time"), kOptimizeTimeInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--group-animations"), kGroupAnimationsInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--scenes"), kScenesInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--trace"), kTraceInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--stats"), kStatsInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--dry-run"), kDryRunInfo);
+    fprintf(stdout, "\t%s\t%s\n", qPrintable("--trim-cache"), kTrimCacheInfo);
+}
+
+static auto _parseBytes(const QString& value, bool& ok)->qint64 {
+    QString number = value.trimmed().toUpper();
+    qint64 unit = 1;
+    if (number.endsWith('B'))
+        number.chop(1);
+    if (number.endsWith('K'))
+        unit = qint64(1) << 10;
+    else if (number.endsWith('M'))
+        unit = qint64(1) << 20;
+    else if (number.endsWith('G'))
+        unit = qint64(1) << 30;
+    if (unit != 1)
+        number.chop(1);
+
+    const double amount = number.toDouble(&ok);
+    ok = ok && amount >= 0.0;
+    return qint64(amount * unit);
+}
+
+static auto _parseSeconds(const QString& value, bool& ok)->double {
+    QString number = value.trimmed().toLower();
+    double unit = 1.0;
+    if (number.endsWith('m'))
+        unit = 60.0;
+    if (number.endsWith('s') || number.endsWith('m'))
+        number.chop(1);
+
+    const double amount = number.toDouble(&ok);
+    ok = ok && amount >= 0.0;
+    return amount * unit;
 }
 
 auto main(int argc, char *argv[])->int {
@@ -63,17 +136,39 @@ auto main(int argc, char *argv[])->int {
     QCommandLineOption sheetOption(QStringList() << "sheet", kSheetInfo, "sheet");
     QCommandLineOption dataOption(QStringList() << "data", kDataInfo, "data");
     QCommandLineOption scaleOption(QStringList() << "scale", kScaleInfo, "scale");
+    QCommandLineOption scalesOption(QStringList() << "scales", kScalesInfo, "scales");
+    QCommandLineOption scaleFilterOption(QStringList() << "scale-filter", kScaleFilterInfo, "filter");
     QCommandLineOption trimOption(QStringList() << "trim", kTrimInfo, "trim");
+    QCommandLineOption polygonOption(QStringList() << "polygon", kPolygonInfo, "vertices");
+    QCommandLineOption aliasTransformsOption(QStringList() << "alias-transforms", kAliasTransformsInfo);
     QCommandLineOption paddingOption(QStringList() << "padding", kPaddingInfo, "padding");
     QCommandLineOption marginOption(QStringList() << "margin", kMarginInfo, "margin");
     QCommandLineOption suffixOption(QStringList() << "suffix", kSuffixInfo, "suffix");
     QCommandLineOption maxSizeWOption(QStringList() << "max-size-w", kMaxSizeWInfo, "width");
     QCommandLineOption maxSizeHOption(QStringList() << "max-size-h", kMaxSizeHInfo, "height");
     QCommandLineOption formatOption(QStringList() << "opt", kFormatInfo, "format");
+    QCommandLineOption ditherOption(QStringList() << "dither", kDitherInfo);
+    QCommandLineOption maxErrorOption(QStringList() << "max-error", kMaxErrorInfo, "error");
+    QCommandLineOption blockCacheOption(QStringList() << "block-cache", kBlockCacheInfo, "file");
     QCommandLineOption squareOption(QStringList() << "square", kSquareInfo);
     QCommandLineOption powerOf2Option(QStringList() << "powerOf2", kPowerOf2Info);
-    cmd.addOptions(QList<QCommandLineOption>() << sheetOption << dataOption << scaleOption << trimOption << paddingOption << marginOption
-                   << suffixOption << maxSizeWOption << maxSizeHOption << formatOption << squareOption << powerOf2Option);
+    QCommandLineOption stripHeightOption(QStringList() << "strip-height", kStripHeightInfo, "rows");
+    QCommandLineOption traceOption(QStringList() << "trace", kTraceInfo, "trace");
+    QCommandLineOption statsOption(QStringList() << "stats", kStatsInfo);
+    QCommandLineOption includeOption(QStringList() << "include", kIncludeInfo, "glob");
+    QCommandLineOption excludeOption(QStringList() << "exclude", kExcludeInfo, "glob");
+    QCommandLineOption dryRunOption(QStringList() << "dry-run", kDryRunInfo);
+    QCommandLineOption trimCacheOption(QStringList() << "trim-cache", kTrimCacheInfo, "file");
+    QCommandLineOption memoryBudgetOption(QStringList() << "memory-budget", kMemoryBudgetInfo, "bytes");
+    QCommandLineOption writeBufferOption(QStringList() << "write-buffer", kWriteBufferInfo, "bytes");
+    QCommandLineOption forceOption(QStringList() << "force", kForceInfo);
+    QCommandLineOption optimizeTimeOption(QStringList() << "optimize-time", kOptimizeTimeInfo, "time");
+    QCommandLineOption groupAnimationsOption(QStringList() << "group-animations", kGroupAnimationsInfo);
+    QCommandLineOption scenesOption(QStringList() << "scenes", kScenesInfo, "manifest");
+    cmd.addOptions(QList<QCommandLineOption>() << sheetOption << dataOption << scaleOption << scalesOption << scaleFilterOption << trimOption << polygonOption << aliasTransformsOption << paddingOption << marginOption
+                   << suffixOption << maxSizeWOption << maxSizeHOption << formatOption << ditherOption << maxErrorOption << blockCacheOption << squareOption << powerOf2Option
+                   << stripHeightOption << traceOption << statsOption << includeOption << excludeOption
+                   << dryRunOption << trimCacheOption << memoryBudgetOption << writeBufferOption << forceOption << optimizeTimeOption << groupAnimationsOption << scenesOption);
     cmd.process(app.arguments());
 
     const QStringList srcPath = cmd.positionalArguments();
@@ -83,6 +178,8 @@ auto main(int argc, char *argv[])->int {
         return 1;
     }
     Generator spritesheet(*srcPath.begin());
+    spritesheet.setIncludePatterns(cmd.values(includeOption));
+    spritesheet.setExcludePatterns(cmd.values(excludeOption));
 
     if (!cmd.isSet(sheetOption)) {
         fprintf(stderr, "%s\n", qPrintable("No destination texture path passed."));
@@ -106,6 +203,35 @@ auto main(int argc, char *argv[])->int {
     }
     spritesheet.setScale(scale);
 
+    if (cmd.isSet(scalesOption)) {
+        std::vector<float> scales;
+        for (const auto& value : cmd.value(scalesOption).split(',')) {
+            if (value.trimmed().isEmpty())
+                continue;
+            bool ok = false;
+            scales.push_back(value.trimmed().toFloat(&ok));
+            if (!ok) {
+                fprintf(stderr, "%s\n", qPrintable("The value after --scales is not a list of numbers"));
+                _printUsage();
+                return 1;
+            }
+        }
+        if (!scales.empty() && !spritesheet.setScales(scales)) {
+            fprintf(stderr, "%s\n", qPrintable("The values after --scales must be positive and distinct whole multiples of the smallest one (e.g. 1,0.5,0.25)"));
+            _printUsage();
+            return 1;
+        }
+    }
+
+    auto scaleFilter = ImageScale::BILINEAR;
+    if (cmd.isSet(scaleFilterOption)) {
+        if (cmd.value(scaleFilterOption) == "box")
+            scaleFilter = ImageScale::BOX;
+        else if (cmd.value(scaleFilterOption) == "lanczos3")
+            scaleFilter = ImageScale::LANCZOS3;
+    }
+    spritesheet.setScaleFilter(scaleFilter);
+
     int maxWidth = -1;
     if (cmd.isSet(maxSizeWOption)) {
         bool ok = false;
@@ -142,6 +268,19 @@ auto main(int argc, char *argv[])->int {
     }
     spritesheet.setTrimMode(trimMode);
 
+    int polygonVertices = 0;
+    if (cmd.isSet(polygonOption)) {
+        bool ok = false;
+        polygonVertices = cmd.value(polygonOption).toInt(&ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --polygon is not a number value"));
+            _printUsage();
+            return 1;
+        }
+    }
+    spritesheet.setPolygonVertices(polygonVertices);
+    spritesheet.setAliasTransforms(cmd.isSet(aliasTransformsOption));
+
     int padding = 0;
     if (cmd.isSet(paddingOption)) {
         bool ok = false;
@@ -170,6 +309,7 @@ auto main(int argc, char *argv[])->int {
         spritesheet.setTextureSuffixInData(cmd.value(suffixOption));
 
     QImage::Format format = QImage::Format::Format_RGBA8888;
+    BlockEncoder::Format compression = BlockEncoder::NONE;
     if (cmd.isSet(formatOption)) {
         const auto fmt = cmd.value(formatOption);
         if ("rgb888" == fmt) format = QImage::Format::Format_RGB888;
@@ -180,13 +320,98 @@ auto main(int argc, char *argv[])->int {
         else if ("grayscale8" == fmt) format = QImage::Format::Format_Grayscale8;
         else if ("mono" == fmt) format = QImage::Format::Format_Mono;
         else if ("rgba8888p" == fmt) format = QImage::Format::Format_RGBA8888_Premultiplied;
+        else if ("indexed8" == fmt) format = QImage::Format::Format_Indexed8;
+        else if ("bc1" == fmt) compression = BlockEncoder::BC1;
+        else if ("bc3" == fmt) compression = BlockEncoder::BC3;
+        else if ("etc2" == fmt) compression = BlockEncoder::ETC2_RGB;
+        else if ("etc2a" == fmt) compression = BlockEncoder::ETC2_RGBA;
     }
     spritesheet.setOutputFormat(format);
+    spritesheet.setCompression(compression);
+    if (cmd.isSet(blockCacheOption))
+        spritesheet.setBlockCachePath(cmd.value(blockCacheOption));
+    spritesheet.setDither(cmd.isSet(ditherOption));
+
+    if (cmd.isSet(maxErrorOption)) {
+        bool ok = false;
+        const double maxError = cmd.value(maxErrorOption).toDouble(&ok);
+        if (!ok || maxError < 0.0) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --max-error is not a non-negative number"));
+            _printUsage();
+            return 1;
+        }
+        spritesheet.setMaxQuantizeError(maxError);
+    }
 
     spritesheet.setIsSquare(cmd.isSet(squareOption));
     spritesheet.setIsPowerOf2(cmd.isSet(powerOf2Option));
 
-    if (spritesheet.generateTo(cmd.value(sheetOption), dataPath))
+    int stripHeight = 0;
+    if (cmd.isSet(stripHeightOption)) {
+        bool ok = false;
+        stripHeight = cmd.value(stripHeightOption).toInt(&ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --strip-height is not a number value"));
+            _printUsage();
+            return 1;
+        }
+    }
+    spritesheet.setStripHeight(stripHeight);
+
+    if (cmd.isSet(memoryBudgetOption)) {
+        bool ok = false;
+        const qint64 budget = _parseBytes(cmd.value(memoryBudgetOption), ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --memory-budget is not a size (e.g. 512M, 2G)"));
+            _printUsage();
+            return 1;
+        }
+        spritesheet.setMemoryBudget(budget);
+    }
+    if (cmd.isSet(writeBufferOption)) {
+        bool ok = false;
+        const qint64 bytes = _parseBytes(cmd.value(writeBufferOption), ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --write-buffer is not a size (e.g. 8M)"));
+            _printUsage();
+            return 1;
+        }
+        spritesheet.setWriteBuffer(bytes);
+    }
+    if (cmd.isSet(optimizeTimeOption)) {
+        bool ok = false;
+        const double seconds = _parseSeconds(cmd.value(optimizeTimeOption), ok);
+        if (!ok) {
+            fprintf(stderr, "%s\n", qPrintable("The value after --optimize-time is not a duration (e.g. 30s, 2m)"));
+            _printUsage();
+            return 1;
+        }
+        spritesheet.setOptimizeTime(seconds);
+    }
+    spritesheet.setGroupAnimations(cmd.isSet(groupAnimationsOption));
+    if (cmd.isSet(scenesOption)) {
+        std::vector<ScenePartitioner::Scene> scenes;
+        QString error;
+        if (!ScenePartitioner::readManifest(cmd.value(scenesOption), scenes, error)) {
+            fprintf(stderr, "%s\n", qPrintable("Can't read the scene manifest " + cmd.value(scenesOption) + ": " + error));
+            _printUsage();
+            return 1;
+        }
+        spritesheet.setScenes(scenes);
+    }
+    spritesheet.setPrintStats(cmd.isSet(statsOption));
+    spritesheet.setDryRun(cmd.isSet(dryRunOption));
+    spritesheet.setSkipUnchanged(!cmd.isSet(forceOption));
+    if (cmd.isSet(trimCacheOption))
+        spritesheet.setTrimCachePath(cmd.value(trimCacheOption));
+
+    if (cmd.isSet(traceOption))
+        Trace::start(cmd.value(traceOption));
+
+    const bool succeeded = spritesheet.generateTo(cmd.value(sheetOption), dataPath);
+    if (!Trace::finish())
+        fprintf(stderr, "%s\n", qPrintable("Can't write the trace file " + cmd.value(traceOption)));
+    if (succeeded)
         return 0;
 
     fprintf(stderr, "%s\n", qPrintable("Error!"));
@@ -0,0 +1,19 @@
+TARGET = spriteglue
+CONFIG += console
+
+TEMPLATE = app
+
+include(spriteglue-config.pri)
+
+SOURCES += main.cpp
+
+# links the static library built by lib/spriteglue-lib.pro instead of compiling its sources again
+win32: CONFIG(debug, debug|release): SPRITEGLUE_LIB_DIR = $$OUT_PWD/lib/debug
+else: win32: SPRITEGLUE_LIB_DIR = $$OUT_PWD/lib/release
+else: SPRITEGLUE_LIB_DIR = $$OUT_PWD/lib
+
+# ahead of the libraries it needs itself
+LIBS = -L$$SPRITEGLUE_LIB_DIR -lspriteglue $$LIBS
+
+win32-msvc*: PRE_TARGETDEPS += $$SPRITEGLUE_LIB_DIR/spriteglue.lib
+else: PRE_TARGETDEPS += $$SPRITEGLUE_LIB_DIR/libspriteglue.a
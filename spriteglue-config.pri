@@ -0,0 +1,20 @@
+# Qt modules, flags and system libraries of the spriteglue sources, for
+# projects that compile them (spriteglue.pri) or link the library.
+
+QT += core
+QT += xml
+QT += concurrent
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD
+
+# qmake CONFIG+=packstats collects the MaxRectsBinPack counters printed by --stats
+packstats: DEFINES += RBP_STATS
+
+# peak working set for the memory report
+win32: LIBS += -lpsapi
+
+# zlib for the strip png encoder and zip archives: Qt's bundled copy on Windows, the system one elsewhere
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+else: LIBS += -lz
@@ -0,0 +1,54 @@
+# Sources of the spriteglue library, also compiled into the benchmark.
+
+include(spriteglue-config.pri)
+
+SOURCES += \
+    $$PWD/plist/plistserializer.cpp \
+    $$PWD/binPack/MaxRectsBinPack.cpp \
+    $$PWD/imageTools/ImageTrim.cpp \
+    $$PWD/Generator.cpp \
+    $$PWD/binPack/Rect.cpp \
+    $$PWD/ImageSorter.cpp \
+    $$PWD/PackOptimizer.cpp \
+    $$PWD/LayoutCompactor.cpp \
+    $$PWD/ScenePartitioner.cpp \
+    $$PWD/imageTools/ImageConvert.cpp \
+    $$PWD/imageTools/PngStripWriter.cpp \
+    $$PWD/imageTools/ColorQuantizer.cpp \
+    $$PWD/imageTools/BlockEncoder.cpp \
+    $$PWD/imageTools/CompressedTextureWriter.cpp \
+    $$PWD/imageTools/ImageScale.cpp \
+    $$PWD/imageTools/PolygonTrim.cpp \
+    $$PWD/Trace.cpp \
+    $$PWD/FileScanner.cpp \
+    $$PWD/ArchiveReader.cpp \
+    $$PWD/TrimCache.cpp \
+    $$PWD/BlockCache.cpp \
+    $$PWD/SpriteCache.cpp \
+    $$PWD/OutputFile.cpp
+
+HEADERS += \
+    $$PWD/plist/plistserializer.h \
+    $$PWD/binPack/MaxRectsBinPack.h \
+    $$PWD/imageTools/ImageTrim.h \
+    $$PWD/Generator.h \
+    $$PWD/binPack/Rect.h \
+    $$PWD/imageTools/imagerotate.h \
+    $$PWD/ImageSorter.h \
+    $$PWD/PackOptimizer.h \
+    $$PWD/LayoutCompactor.h \
+    $$PWD/ScenePartitioner.h \
+    $$PWD/imageTools/ImageConvert.h \
+    $$PWD/imageTools/PngStripWriter.h \
+    $$PWD/imageTools/ColorQuantizer.h \
+    $$PWD/imageTools/BlockEncoder.h \
+    $$PWD/imageTools/CompressedTextureWriter.h \
+    $$PWD/imageTools/ImageScale.h \
+    $$PWD/imageTools/PolygonTrim.h \
+    $$PWD/Trace.h \
+    $$PWD/FileScanner.h \
+    $$PWD/ArchiveReader.h \
+    $$PWD/TrimCache.h \
+    $$PWD/BlockCache.h \
+    $$PWD/SpriteCache.h \
+    $$PWD/OutputFile.h
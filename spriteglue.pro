@@ -1,26 +1,11 @@
-QT += core
-QT += xml
+# The static library for embedding the generator, and the spriteglue tool linking it.
 
-TARGET = spriteglue
-CONFIG += console
-CONFIG += c++11
+TEMPLATE = subdirs
 
-TEMPLATE = app
-
-SOURCES += main.cpp \
-    plist/plistserializer.cpp \
-    binPack/MaxRectsBinPack.cpp \
-    imageTools/ImageTrim.cpp \
-    Generator.cpp \
-    binPack/Rect.cpp \
-    ImageSorter.cpp
-
-HEADERS += \
-    plist/plistserializer.h \
-    binPack/MaxRectsBinPack.h \
-    imageTools/ImageTrim.h \
-    Generator.h \
-    binPack/Rect.h \
-    imageTools/imagerotate.h \
-    ImageSorter.h
+SUBDIRS += \
+    cli \
+    lib
 
+cli.file = spriteglue-cli.pro
+lib.file = lib/spriteglue-lib.pro
+cli.depends = lib